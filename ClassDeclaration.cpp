@@ -1,5 +1,6 @@
 #include <ConfigurableFirmata.h>
 #include "ClassDeclaration.h"
+#include "MethodBody.h"
 
 #include "MemoryManagement.h"
 #include "Exceptions.h"
@@ -22,23 +23,294 @@ void SortedClassList::clear(bool includingFlash)
 	}
 	
 	_ramEntries.clear(true);
+	InvalidateHierarchy();
+}
+
+void SortedClassList::ReadListFromFlash(void* flashAddress)
+{
+	SortedList<ClassDeclaration>::ReadListFromFlash(flashAddress);
+	InvalidateHierarchy();
+}
+
+void SortedClassList::InvalidateHierarchy()
+{
+	_hierarchyNumbered = false;
+	_hierarchyComplete = false;
+	memset(_typeCheckCache, 0, sizeof(_typeCheckCache));
+}
+
+/// <summary>
+/// Assigns consecutive numbers to cls and all its subclasses (depth first). Returns the next free number.
+/// </summary>
+uint16_t SortedClassList::NumberSubtree(ClassDeclaration* cls, uint16_t next)
+{
+	cls->HierarchyStart = next++;
+	for (size_t i = 0; i < _ramEntries.size(); i++)
+	{
+		ClassDeclaration* child = _ramEntries[i];
+		if (child->ParentToken == cls->ClassToken && child != cls)
+		{
+			next = NumberSubtree(child, next);
+		}
+	}
+
+	cls->HierarchyEnd = next - 1;
+	return next;
+}
+
+void SortedClassList::NumberHierarchy()
+{
+	// The classes in flash can't be changed any more
+	if (_flashEntries.size() == 0)
+	{
+		uint16_t next = 1;
+		for (size_t i = 0; i < _ramEntries.size(); i++)
+		{
+			ClassDeclaration* cls = _ramEntries[i];
+			if (cls->ParentToken == 0 || cls->ParentToken == cls->ClassToken || GetClassWithToken(cls->ParentToken, false) == nullptr)
+			{
+				next = NumberSubtree(cls, next);
+			}
+		}
+	}
+
+	_hierarchyComplete = true;
+	auto iterator = GetIterator();
+	while (iterator.Next())
+	{
+		if (iterator.Current()->HierarchyStart == 0)
+		{
+			_hierarchyComplete = false;
+			break;
+		}
+	}
+
+	_hierarchyNumbered = true;
+}
+
+bool SortedClassList::IsSubclassOf(ClassDeclaration* cls, ClassDeclaration* baseClass)
+{
+	if (!_hierarchyNumbered)
+	{
+		NumberHierarchy();
+	}
+
+	if (cls->HierarchyStart != 0 && baseClass->HierarchyStart != 0)
+	{
+		if (cls->HierarchyStart > baseClass->HierarchyStart && cls->HierarchyStart <= baseClass->HierarchyEnd)
+		{
+			return true;
+		}
+
+		if (_hierarchyComplete)
+		{
+			return false;
+		}
+	}
+
+	// Some classes were added after the numbering was written to flash
+	ClassDeclaration* parent = GetClassWithToken(cls->ParentToken, false);
+	while (parent != nullptr)
+	{
+		if (parent->ClassToken == baseClass->ClassToken)
+		{
+			return true;
+		}
+
+		parent = GetClassWithToken(parent->ParentToken, false);
+	}
+
+	return false;
+}
+
+bool SortedClassList::IsAssignableTo(ClassDeclaration* source, ClassDeclaration* target, bool useCache)
+{
+	if (IsSubclassOf(source, target))
+	{
+		return true;
+	}
+
+	TypeCheckCacheEntry* entry = nullptr;
+	if (useCache)
+	{
+		size_t hash = (((size_t)source >> 3) ^ ((size_t)target >> 2)) & (TYPE_CHECK_CACHE_SIZE - 1);
+		entry = &_typeCheckCache[hash];
+		if (entry->Source == source && entry->Target == target)
+		{
+			return entry->Result;
+		}
+	}
+
+	// Either the source is an interface the target implements or the target is an interface implemented by the source
+	bool result = target->ImplementsInterface(source->ClassToken) || source->ImplementsInterface(target->ClassToken);
+	if (entry != nullptr)
+	{
+		entry->Source = source;
+		entry->Target = target;
+		entry->Result = result;
+	}
+
+	return result;
 }
 
 void SortedClassList::CopyContentsToFlash(FlashMemoryManager* manager)
 {
+	CopyContentsToFlash(manager, nullptr);
+}
+
+void SortedClassList::CopyContentsToFlash(FlashMemoryManager* manager, SortedMethodList* methods)
+{
+	// The flash copies keep the numbers
+	NumberHierarchy();
 	for(auto iterator = _ramEntries.begin(); iterator != _ramEntries.end(); ++iterator)
 	{
-		ClassDeclarationFlash* flash = CreateFlashDeclaration(manager, (ClassDeclarationDynamic*)*iterator);
+		ClassDeclarationFlash* flash = CreateFlashDeclaration(manager, (ClassDeclarationDynamic*)*iterator, methods);
 		_flashEntries.push_back(flash);
 	}
 
 	clear(false);
 }
 
-ClassDeclarationFlash* SortedClassList::CreateFlashDeclaration(FlashMemoryManager* manager, ClassDeclarationDynamic* dynamic)
+void SortedClassList::AddDispatchEntry(stdSimple::vector<DispatchEntry>& table, int32_t declaredToken, int32_t implementationToken, SortedMethodList* methods, bool direct)
+{
+	size_t index = stdSimple::LowerBound(table.begin(), table.size(), declaredToken);
+	if (index < table.size() && table[index].DeclaredToken == declaredToken)
+	{
+		// Already implemented by a more derived class (or an earlier method of the same class)
+		return;
+	}
+
+	DispatchEntry entry;
+	entry.DeclaredToken = declaredToken;
+	entry.ImplementationToken = implementationToken;
+	entry.Implementation = methods != nullptr ? methods->BinarySearchKey(implementationToken) : nullptr;
+	entry.Direct = direct;
+	table.insert(index, entry);
+}
+
+/// <summary>
+/// Builds the flattened dispatch table for the given class. This does the same lookups as the virtual method resolution
+/// in ExecuteIlCode, but for all methods at once: The most derived implementation wins, and System.Object is never searched.
+/// </summary>
+void SortedClassList::BuildDispatchTable(ClassDeclaration* cls, SortedMethodList* methods, stdSimple::vector<DispatchEntry>& table)
+{
+	ClassDeclaration* current = cls;
+	while (current != nullptr)
+	{
+		bool direct = current == cls;
+		int idx = 0;
+		for (auto met = current->GetMethodByIndex(idx); met != nullptr; met = current->GetMethodByIndex(++idx))
+		{
+			AddDispatchEntry(table, met->MethodToken(), met->MethodToken(), methods, direct);
+			for (int i = 0; i < met->_numBaseTokens; i++)
+			{
+				AddDispatchEntry(table, met->_baseTokens[i], met->MethodToken(), methods, direct);
+			}
+		}
+
+		if (current->ParentToken == 0)
+		{
+			break;
+		}
+
+		current = GetClassWithToken(current->ParentToken, false);
+		if (current != nullptr && current->ParentToken == 0)
+		{
+			break;
+		}
+	}
+}
+
+/// <summary>
+/// Builds the table of instance field offsets for the given class. The fields are laid out in the order CollectFields
+/// returns them: Starting at System.Object, base class fields first.
+/// </summary>
+void SortedClassList::BuildFieldOffsetTable(ClassDeclaration* cls, stdSimple::vector<FieldOffsetEntry>& table)
+{
+	stdSimple::vector<ClassDeclaration*> hierarchy;
+	ClassDeclaration* current = cls;
+	while (current != nullptr)
+	{
+		hierarchy.push_back(current);
+		current = current->ParentToken != 0 ? GetClassWithToken(current->ParentToken, false) : nullptr;
+	}
+
+	uint16_t offset = 0;
+	for (int level = hierarchy.size() - 1; level >= 0; level--)
+	{
+		current = hierarchy[level];
+		int idx = 0;
+		for (auto handle = current->GetFieldByIndex(idx); handle != nullptr; handle = current->GetFieldByIndex(++idx))
+		{
+			if ((handle->Type & VariableKind::StaticMember) != VariableKind::Void)
+			{
+				continue;
+			}
+
+			FieldOffsetEntry entry;
+			entry.Token = handle->Int32;
+			entry.Offset = offset;
+			entry.Size = handle->fieldSize();
+			entry.Type = handle->Type;
+			offset += entry.Size;
+
+			table.insert(stdSimple::LowerBound(table.begin(), table.size(), entry.Token), entry);
+		}
+	}
+
+	hierarchy.clear(true);
+}
+
+void SortedClassList::BuildFieldOffsetTables()
+{
+	for (size_t i = 0; i < _ramEntries.size(); i++)
+	{
+		FindFieldOffset(_ramEntries[i], 0);
+	}
+}
+
+void SortedClassList::InvalidateFieldOffsets()
+{
+	for (size_t i = 0; i < _ramEntries.size(); i++)
+	{
+		ClassDeclaration* cls = _ramEntries[i];
+		if (cls->GetType() != ClassDeclarationType::Flash)
+		{
+			ClassDeclarationDynamic* dynamic = (ClassDeclarationDynamic*)cls;
+			dynamic->fieldOffsetsValid = false;
+			dynamic->fieldOffsets.clear(true);
+		}
+	}
+}
+
+const FieldOffsetEntry* SortedClassList::FindFieldOffset(ClassDeclaration* cls, int32_t fieldToken)
+{
+	if (cls->GetType() == ClassDeclarationType::Flash)
+	{
+		return ((ClassDeclarationFlash*)cls)->FindFieldOffset(fieldToken);
+	}
+
+	ClassDeclarationDynamic* dynamic = (ClassDeclarationDynamic*)cls;
+	if (!dynamic->fieldOffsetsValid)
+	{
+		dynamic->fieldOffsets.clear();
+		BuildFieldOffsetTable(dynamic, dynamic->fieldOffsets);
+		dynamic->fieldOffsetsValid = true;
+	}
+
+	return stdSimple::BinarySearch(dynamic->fieldOffsets.begin(), dynamic->fieldOffsets.size(), fieldToken);
+}
+
+ClassDeclarationFlash* SortedClassList::CreateFlashDeclaration(FlashMemoryManager* manager, ClassDeclarationDynamic* dynamic, SortedMethodList* methods)
 {
+	stdSimple::vector<DispatchEntry> dispatchTable;
+	BuildDispatchTable(dynamic, methods, dispatchTable);
+	stdSimple::vector<FieldOffsetEntry> fieldOffsets;
+	BuildFieldOffsetTable(dynamic, fieldOffsets);
+
 	// First create the class in RAM
-	int totalSize = sizeof(ClassDeclarationFlash) + dynamic->fieldTypes.size() * sizeof(Variable) + dynamic->interfaceTokens.size() * sizeof(int32_t);
+	int totalSize = sizeof(ClassDeclarationFlash) + dispatchTable.size() * sizeof(DispatchEntry) + fieldOffsets.size() * sizeof(FieldOffsetEntry) +
+		dynamic->fieldTypes.size() * sizeof(Variable) + dynamic->interfaceTokens.size() * sizeof(int32_t);
 	for (size_t i = 0; i < dynamic->methodTypes.size(); i++)
 	{
 		totalSize += sizeof(Method);
@@ -53,6 +325,36 @@ ClassDeclarationFlash* SortedClassList::CreateFlashDeclaration(FlashMemoryManage
 	temp = AddBytes(temp, sizeof(ClassDeclarationFlash));
 	
 	ClassDeclarationFlash* flash = new ClassDeclarationFlash(dynamic);
+
+	// The dispatch table comes first, because it contains pointers, which might need stronger alignment
+	size_t dispatchTableLength = dispatchTable.size() * sizeof(DispatchEntry);
+	flash->_dispatchTableCount = dispatchTable.size();
+	if (dispatchTableLength > 0)
+	{
+		memcpy(temp, &dispatchTable.at(0), dispatchTableLength);
+		flash->_dispatchTable = (DispatchEntry*)Relocate(flashCopy, temp, flashTarget);
+		temp = AddBytes(temp, dispatchTableLength);
+	}
+	else
+	{
+		flash->_dispatchTable = nullptr;
+	}
+	dispatchTable.clear(true);
+
+	size_t fieldOffsetsLength = fieldOffsets.size() * sizeof(FieldOffsetEntry);
+	flash->_fieldOffsetCount = fieldOffsets.size();
+	if (fieldOffsetsLength > 0)
+	{
+		memcpy(temp, &fieldOffsets.at(0), fieldOffsetsLength);
+		flash->_fieldOffsets = (FieldOffsetEntry*)Relocate(flashCopy, temp, flashTarget);
+		temp = AddBytes(temp, fieldOffsetsLength);
+	}
+	else
+	{
+		flash->_fieldOffsets = nullptr;
+	}
+	fieldOffsets.clear(true);
+
 	flash->_fieldTypeCount = dynamic->fieldTypes.size();
 	size_t fieldTypesLength = dynamic->fieldTypes.size() * sizeof(Variable);
 	if (fieldTypesLength > 0)
@@ -181,6 +483,11 @@ Method* ClassDeclarationFlash::GetMethodByIndex(uint32_t idx)
 	return _methodTypes + idx;
 }
 
+const DispatchEntry* ClassDeclarationFlash::FindDispatchEntry(int32_t methodToken)
+{
+	return stdSimple::BinarySearch(_dispatchTable, _dispatchTableCount, methodToken);
+}
+
 bool ClassDeclarationFlash::ImplementsInterface(int token)
 {
 	for (uint32_t i = 0; i < _interfaceTokenCount; i++)
@@ -231,3 +538,122 @@ void SortedConstantList::CopyContentsToFlash(FlashMemoryManager* manager)
 
 	clear(false);
 }
+
+static int CompareFieldIndexEntries(const void* a, const void* b)
+{
+	int32_t tokenA = ((const FieldIndexEntry*)a)->Field.Token;
+	int32_t tokenB = ((const FieldIndexEntry*)b)->Field.Token;
+	if (tokenA == tokenB)
+	{
+		return 0;
+	}
+	return tokenA < tokenB ? -1 : 1;
+}
+
+/// <summary>
+/// Collects all fields of all classes (or only of the classes in RAM). Instance fields get the offset they have in the
+/// declaring class, which is the same for all derived classes.
+/// </summary>
+void FieldTokenIndex::Build(SortedClassList& classes, bool includeFlashClasses, stdSimple::vector<FieldIndexEntry>& table)
+{
+	for (auto iterator = classes.GetIterator(); iterator.Next();)
+	{
+		ClassDeclaration* current = iterator.Current();
+		if (!includeFlashClasses && current->GetType() == ClassDeclarationType::Flash)
+		{
+			continue;
+		}
+
+		int idx = 0;
+		for (auto handle = current->GetFieldByIndex(idx); handle != nullptr; handle = current->GetFieldByIndex(++idx))
+		{
+			FieldIndexEntry entry;
+			entry.Class = current;
+			const FieldOffsetEntry* instanceField = nullptr;
+			if ((handle->Type & VariableKind::StaticMember) == VariableKind::Void)
+			{
+				instanceField = classes.FindFieldOffset(current, handle->Int32);
+			}
+
+			if (instanceField != nullptr)
+			{
+				entry.Field = *instanceField;
+			}
+			else
+			{
+				entry.Field.Token = handle->Int32;
+				entry.Field.Offset = 0;
+				entry.Field.Size = handle->fieldSize();
+				entry.Field.Type = handle->Type;
+			}
+
+			table.push_back(entry);
+		}
+	}
+
+	// The table can have a few thousand entries, so don't use insertion sort here
+	if (table.size() > 1)
+	{
+		qsort(&table.at(0), table.size(), sizeof(FieldIndexEntry), CompareFieldIndexEntries);
+	}
+}
+
+const FieldIndexEntry* FieldTokenIndex::Find(int32_t fieldToken, SortedClassList& classes)
+{
+	const FieldIndexEntry* entry = stdSimple::BinarySearch(_flashEntries, _flashCount, fieldToken);
+	if (entry != nullptr)
+	{
+		return entry;
+	}
+
+	if (!_ramValid)
+	{
+		// Without an index in flash, this also has to cover the classes that are already in flash
+		Build(classes, _flashEntries == nullptr, _ramEntries);
+		_ramValid = true;
+	}
+
+	return stdSimple::BinarySearch(_ramEntries.begin(), _ramEntries.size(), fieldToken);
+}
+
+void* FieldTokenIndex::CopyToFlash(FlashMemoryManager* manager, SortedClassList& classes)
+{
+	stdSimple::vector<FieldIndexEntry> table;
+	Build(classes, true, table);
+
+	int size = table.size();
+	void* target = manager->FlashAlloc(size * sizeof(FieldIndexEntry) + sizeof(int));
+	manager->CopyToFlash(&size, target, sizeof(int), "FieldTokenIndex::CopyToFlash::size");
+	if (size > 0)
+	{
+		manager->CopyToFlash(&table.at(0), AddBytes(target, sizeof(int)), size * sizeof(FieldIndexEntry), "FieldTokenIndex::CopyToFlash::content");
+	}
+	table.clear(true);
+
+	ReadFromFlash(target);
+	return target;
+}
+
+void FieldTokenIndex::ReadFromFlash(void* flashAddress)
+{
+	Invalidate();
+	if (flashAddress == nullptr)
+	{
+		_flashEntries = nullptr;
+		_flashCount = 0;
+		return;
+	}
+
+	_flashCount = *((int*)flashAddress);
+	_flashEntries = (FieldIndexEntry*)AddBytes(flashAddress, sizeof(int));
+}
+
+void FieldTokenIndex::clear(bool includingFlash)
+{
+	Invalidate();
+	if (includingFlash)
+	{
+		_flashEntries = nullptr;
+		_flashCount = 0;
+	}
+}
@@ -61,6 +61,67 @@ private:
 	int* _baseTokens;
 };
 
+class MethodBody;
+class SortedMethodList;
+class ClassDeclaration;
+
+/// <summary>
+/// One entry of the flattened dispatch table of a class. Maps a method token as seen by the caller (a virtual base method or
+/// an interface method) to the method implementing it for instances of the class.
+/// </summary>
+struct DispatchEntry
+{
+	int32_t DeclaredToken;
+	int32_t ImplementationToken;
+	// The implementing method, if it was known when the table was built
+	MethodBody* Implementation;
+	// True if the implementation is declared in this class, false if it is inherited
+	bool Direct;
+
+	int32_t GetKey() const
+	{
+		return DeclaredToken;
+	}
+};
+
+/// <summary>
+/// The location of an instance field. Since base class fields always come first, the offset of a field is the same for
+/// the declaring class and all derived classes.
+/// </summary>
+struct FieldOffsetEntry
+{
+	int32_t Token;
+	// Offset from the start of the instance data (that is, after the vtable pointer for reference types)
+	uint16_t Offset;
+	uint16_t Size;
+	VariableKind Type;
+
+	int32_t GetKey() const
+	{
+		return Token;
+	}
+};
+
+/// <summary>
+/// One entry of the global field token index: The class declaring a field and the field's location. For static fields,
+/// Field.Type includes the StaticMember flag and the offset is unused.
+/// </summary>
+struct FieldIndexEntry
+{
+	ClassDeclaration* Class;
+	FieldOffsetEntry Field;
+
+	bool IsStatic() const
+	{
+		return (Field.Type & VariableKind::StaticMember) != VariableKind::Void;
+	}
+
+	int32_t GetKey() const
+	{
+		return Field.Token;
+	}
+};
+
 // Hand-Made type info, because the arduino compiler doesn't support dynamic_cast (not even on the Due)
 enum class ClassDeclarationType
 {
@@ -79,6 +140,8 @@ protected:
 		ClassDynamicSize = dynamicSize;
 		ClassStaticSize = staticSize;
 		ClassFlags = flags;
+		HierarchyStart = 0;
+		HierarchyEnd = 0;
 	}
 
 
@@ -104,6 +167,24 @@ public:
 
 	virtual ClassDeclarationType GetType() = 0;
 
+	/// <summary>
+	/// True if this class has a flattened dispatch table, in which case FindDispatchEntry can be used instead of
+	/// walking the class hierarchy.
+	/// </summary>
+	virtual bool HasDispatchTable()
+	{
+		return false;
+	}
+
+	/// <summary>
+	/// Returns the dispatch table entry for the given method token, or null if no method of this class or its bases
+	/// (excluding System.Object) implements it.
+	/// </summary>
+	virtual const DispatchEntry* FindDispatchEntry(int32_t)
+	{
+		return nullptr;
+	}
+
 	bool IsValueType() const
 	{
 		return (int)ClassFlags & (int)ClassProperties::ValueType;
@@ -129,6 +210,10 @@ public:
 	int32_t ParentToken;
 	uint16_t ClassDynamicSize; // Including superclasses, but without vtable
 	uint16_t ClassStaticSize; // Size of static members 
+	// Preorder numbering of the class hierarchy: A class derives from another if its HierarchyStart lies within
+	// [HierarchyStart, HierarchyEnd] of the other. 0 if the class has not been numbered.
+	uint16_t HierarchyStart;
+	uint16_t HierarchyEnd;
 };
 
 class ClassDeclarationDynamic : public ClassDeclaration
@@ -137,6 +222,7 @@ public:
 	ClassDeclarationDynamic(int32_t token, int32_t parent, int16_t dynamicSize, int16_t staticSize, ClassProperties flags)
 		: ClassDeclaration(token, parent, dynamicSize, staticSize, flags)
 	{
+		fieldOffsetsValid = false;
 	}
 
 	virtual ~ClassDeclarationDynamic()
@@ -149,6 +235,7 @@ public:
 		}
 		methodTypes.clear(true);
 		interfaceTokens.clear(true);
+		fieldOffsets.clear(true);
 	}
 
 	virtual Variable* GetFieldByIndex(uint32_t idx) override;
@@ -169,6 +256,9 @@ public:
 	stdSimple::vector<Method> methodTypes;
 	// List of interfaces implemented by this class
 	stdSimple::vector<int> interfaceTokens;
+	// The offsets of all instance fields of this class and its bases, sorted by token. Built on first use, when all bases are known.
+	stdSimple::vector<FieldOffsetEntry> fieldOffsets;
+	bool fieldOffsetsValid;
 };
 
 /// <summary>
@@ -187,6 +277,12 @@ public:
 		_methodTypes = nullptr;
 		_interfaceTokenCount = 0;
 		_interfaceTokens = nullptr;
+		_dispatchTableCount = 0;
+		_dispatchTable = nullptr;
+		_fieldOffsetCount = 0;
+		_fieldOffsets = nullptr;
+		HierarchyStart = source->HierarchyStart;
+		HierarchyEnd = source->HierarchyEnd;
 	}
 
 	virtual ~ClassDeclarationFlash() override
@@ -204,6 +300,18 @@ public:
 	{
 		return ClassDeclarationType::Flash;
 	}
+
+	virtual bool HasDispatchTable() override
+	{
+		return true;
+	}
+
+	virtual const DispatchEntry* FindDispatchEntry(int32_t methodToken) override;
+
+	const FieldOffsetEntry* FindFieldOffset(int32_t fieldToken) const
+	{
+		return stdSimple::BinarySearch(_fieldOffsets, _fieldOffsetCount, fieldToken);
+	}
 	
 private:
 	uint32_t _fieldTypeCount;
@@ -212,6 +320,12 @@ private:
 	Method* _methodTypes;
 	uint32_t _interfaceTokenCount;
 	int* _interfaceTokens;
+	// Sorted by DeclaredToken
+	uint32_t _dispatchTableCount;
+	DispatchEntry* _dispatchTable;
+	// Sorted by Token
+	uint32_t _fieldOffsetCount;
+	FieldOffsetEntry* _fieldOffsets;
 };
 
 template<class TBase>
@@ -446,12 +560,75 @@ public:
 	}
 };
 
+/// <summary>
+/// A cached result of a type test that needed the interface lists
+/// </summary>
+struct TypeCheckCacheEntry
+{
+	ClassDeclaration* Source;
+	ClassDeclaration* Target;
+	bool Result;
+};
+
+// Must be a power of two
+#define TYPE_CHECK_CACHE_SIZE 16
+
 class SortedClassList : public SortedList<ClassDeclaration>
 {
 public:
+	SortedClassList()
+	{
+		InvalidateHierarchy();
+	}
+
 	void CopyContentsToFlash(FlashMemoryManager* manager) override;
+	/// <summary>
+	/// Copies the classes to flash, building their dispatch tables. The methods should already be in flash, so that the
+	/// dispatch tables can point directly to the implementing methods.
+	/// </summary>
+	void CopyContentsToFlash(FlashMemoryManager* manager, SortedMethodList* methods);
 	void ThrowNotFoundException(int token) override;
 	void clear(bool includingFlash) override;
+	void ReadListFromFlash(void* flashAddress) override;
+
+	/// <summary>
+	/// Numbers the class hierarchy, so that subclass tests take constant time. Classes in flash are numbered when they're
+	/// written, so classes loaded later into RAM stay unnumbered and are tested by walking their parents.
+	/// </summary>
+	void NumberHierarchy();
+
+	/// <summary>
+	/// Builds the field offset tables of all classes in RAM, which are otherwise built on first use
+	/// </summary>
+	void BuildFieldOffsetTables();
+
+	/// <summary>
+	/// Discards the field offset tables of all classes in RAM. Must be called whenever a field is added, since the tables
+	/// of subclasses include the inherited fields.
+	/// </summary>
+	void InvalidateFieldOffsets();
+
+	/// <summary>
+	/// Discards the hierarchy numbering and the type check cache. Must be called whenever a class or its interface list changes.
+	/// </summary>
+	void InvalidateHierarchy();
+
+	/// <summary>
+	/// Returns true if cls is a (direct or indirect) subclass of baseClass. Does not test for identity.
+	/// </summary>
+	bool IsSubclassOf(ClassDeclaration* cls, ClassDeclaration* baseClass);
+
+	/// <summary>
+	/// Returns true if instances of source can be assigned to variables of type target, because source is derived from target
+	/// or one of them implements the other as interface. Does not test for identity. The result of the interface test is cached,
+	/// unless useCache is false (the cache can't be used concurrently).
+	/// </summary>
+	bool IsAssignableTo(ClassDeclaration* source, ClassDeclaration* target, bool useCache);
+
+	/// <summary>
+	/// Returns the location of the given instance field in instances of the given class, or null if the class has no such field.
+	/// </summary>
+	const FieldOffsetEntry* FindFieldOffset(ClassDeclaration* cls, int32_t fieldToken);
 	
 	/// <summary>
 	/// Gets the class declaration for a given token. Throws an exception if the token is not found, unless throwIfNotFound is false.
@@ -477,8 +654,63 @@ public:
 		return GetClassWithToken((int)token, true);
 	}
 private:
-	ClassDeclarationFlash* CreateFlashDeclaration(FlashMemoryManager* manager, ClassDeclarationDynamic* dynamic);
+	ClassDeclarationFlash* CreateFlashDeclaration(FlashMemoryManager* manager, ClassDeclarationDynamic* dynamic, SortedMethodList* methods);
+	void BuildDispatchTable(ClassDeclaration* cls, SortedMethodList* methods, stdSimple::vector<DispatchEntry>& table);
+	static void AddDispatchEntry(stdSimple::vector<DispatchEntry>& table, int32_t declaredToken, int32_t implementationToken, SortedMethodList* methods, bool direct);
+	void BuildFieldOffsetTable(ClassDeclaration* cls, stdSimple::vector<FieldOffsetEntry>& table);
+	uint16_t NumberSubtree(ClassDeclaration* cls, uint16_t next);
+
+	bool _hierarchyNumbered;
+	// True if all classes were numbered together, so that a failing interval test is final
+	bool _hierarchyComplete;
+	TypeCheckCacheEntry _typeCheckCache[TYPE_CHECK_CACHE_SIZE];
+};
+
+/// <summary>
+/// Maps field tokens to their declaring class, sorted by token. The index over the classes in flash is built when the
+/// program is written to flash and stored there. The index over the classes still in RAM is built on first use and
+/// discarded whenever a class is added or changed.
+/// </summary>
+class FieldTokenIndex
+{
+public:
+	FieldTokenIndex()
+	{
+		_flashEntries = nullptr;
+		_flashCount = 0;
+		_ramValid = false;
+	}
+
+	/// <summary>
+	/// Returns the index entry for the given field token, or null if no class declares such a field.
+	/// </summary>
+	const FieldIndexEntry* Find(int32_t fieldToken, SortedClassList& classes);
+
+	/// <summary>
+	/// Discards the index over the classes in RAM. Must be called whenever the class list changes.
+	/// </summary>
+	void Invalidate()
+	{
+		_ramEntries.clear(true);
+		_ramValid = false;
+	}
+
+	/// <summary>
+	/// Builds the index over all classes (which must be in flash already) and writes it to flash. Returns the flash address of the index.
+	/// </summary>
+	void* CopyToFlash(FlashMemoryManager* manager, SortedClassList& classes);
+
+	void ReadFromFlash(void* flashAddress);
+
+	void clear(bool includingFlash);
+
+private:
+	void Build(SortedClassList& classes, bool includeFlashClasses, stdSimple::vector<FieldIndexEntry>& table);
 
+	FieldIndexEntry* _flashEntries;
+	uint32_t _flashCount;
+	stdSimple::vector<FieldIndexEntry> _ramEntries;
+	bool _ramValid;
 };
 
 class ConstantEntry
@@ -0,0 +1,716 @@
+
+#include <ConfigurableFirmata.h>
+#include "DecodedMethod.h"
+#include "MemoryManagement.h"
+#include "Exceptions.h"
+#include "interface/MethodFlags.h"
+
+/// <summary>
+/// Reads a 32 bit value from an address that need not be aligned
+/// </summary>
+static int32_t ReadInt32(const byte* pCode)
+{
+	return (int32_t)(((uint32_t)pCode[0]) | (((uint32_t)pCode[1]) << 8) | (((uint32_t)pCode[2]) << 16) | (((uint32_t)pCode[3]) << 24));
+}
+
+static bool ReturnsValue(MethodBody* method)
+{
+	return (method->MethodFlags() & (byte)MethodFlags::Void) == 0 && (method->MethodFlags() & (byte)MethodFlags::Ctor) == 0;
+}
+
+/// <summary>
+/// True if the opcode is a prefix that changes the meaning of the next instruction
+/// </summary>
+static bool IsPrefix(OPCODE opcode)
+{
+	switch (opcode)
+	{
+	case CEE_TAIL_:
+	case CEE_CONSTRAINED_:
+	case CEE_VOLATILE_:
+	case CEE_UNALIGNED_:
+	case CEE_READONLY_:
+	case CEE_NO_:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/// <summary>
+/// Returns the number of the argument the instruction loads, or -1 if it's not a ldarg instruction
+/// </summary>
+static int LoadedArgument(const byte* pCode, OPCODE opcode)
+{
+	if (opcode >= CEE_LDARG_0 && opcode <= CEE_LDARG_3)
+	{
+		return opcode - CEE_LDARG_0;
+	}
+
+	if (opcode == CEE_LDARG_S)
+	{
+		return pCode[1];
+	}
+
+	return -1;
+}
+
+uint16_t InstructionLength(const byte* pCode, OPCODE& opcode)
+{
+	uint16_t len;
+	opcode = DecodeOpcode(pCode, &len);
+	if (opcode == CEE_COUNT)
+	{
+		return len;
+	}
+
+	switch (GetOpcodeFormat(opcode))
+	{
+	case InlineNone:
+		return len;
+	case ShortInlineVar:
+	case ShortInlineI:
+	case ShortInlineBrTarget:
+		return len + 1;
+	case InlineVar:
+		return len + 2;
+	case InlineI8:
+	case InlineR:
+		return len + 8;
+	case InlineSwitch:
+		return len + 4 + 4 * ReadInt32(pCode + len);
+	default:
+		return len + 4;
+	}
+}
+
+DecodedHandler DecodedMethod::HandlerForOpcode(OPCODE opcode, int32_t& operand)
+{
+	switch (opcode)
+	{
+	case CEE_NOP:
+		return DecodedHandler::Nop;
+	case CEE_LDARG_0:
+	case CEE_LDARG_1:
+	case CEE_LDARG_2:
+	case CEE_LDARG_3:
+		operand = opcode - CEE_LDARG_0;
+		return DecodedHandler::LdArg;
+	case CEE_LDLOC_0:
+	case CEE_LDLOC_1:
+	case CEE_LDLOC_2:
+	case CEE_LDLOC_3:
+		operand = opcode - CEE_LDLOC_0;
+		return DecodedHandler::LdLoc;
+	case CEE_STLOC_0:
+	case CEE_STLOC_1:
+	case CEE_STLOC_2:
+	case CEE_STLOC_3:
+		operand = opcode - CEE_STLOC_0;
+		return DecodedHandler::StLoc;
+	case CEE_LDARG_S:
+		return DecodedHandler::LdArg;
+	case CEE_STARG_S:
+		return DecodedHandler::StArg;
+	case CEE_LDLOC_S:
+		return DecodedHandler::LdLoc;
+	case CEE_STLOC_S:
+		return DecodedHandler::StLoc;
+	case CEE_LDC_I4_M1:
+	case CEE_LDC_I4_0:
+	case CEE_LDC_I4_1:
+	case CEE_LDC_I4_2:
+	case CEE_LDC_I4_3:
+	case CEE_LDC_I4_4:
+	case CEE_LDC_I4_5:
+	case CEE_LDC_I4_6:
+	case CEE_LDC_I4_7:
+	case CEE_LDC_I4_8:
+		operand = opcode - CEE_LDC_I4_0;
+		return DecodedHandler::LdcI4;
+	case CEE_LDC_I4_S:
+	case CEE_LDC_I4:
+		return DecodedHandler::LdcI4;
+	case CEE_LDC_R4:
+		return DecodedHandler::LdcR4;
+	case CEE_LDNULL:
+		return DecodedHandler::LdNull;
+	case CEE_DUP:
+		return DecodedHandler::Dup;
+	case CEE_POP:
+		return DecodedHandler::Pop;
+	case CEE_ADD:
+		return DecodedHandler::Add;
+	case CEE_SUB:
+		return DecodedHandler::Sub;
+	case CEE_MUL:
+		return DecodedHandler::Mul;
+	case CEE_AND:
+		return DecodedHandler::And;
+	case CEE_OR:
+		return DecodedHandler::Or;
+	case CEE_XOR:
+		return DecodedHandler::Xor;
+	case CEE_SHL:
+		return DecodedHandler::Shl;
+	case CEE_SHR:
+		return DecodedHandler::Shr;
+	case CEE_SHR_UN:
+		return DecodedHandler::ShrUn;
+	case CEE_CEQ:
+		return DecodedHandler::Ceq;
+	case CEE_CGT:
+		return DecodedHandler::Cgt;
+	case CEE_CGT_UN:
+		return DecodedHandler::CgtUn;
+	case CEE_CLT:
+		return DecodedHandler::Clt;
+	case CEE_CLT_UN:
+		return DecodedHandler::CltUn;
+	case CEE_BR:
+	case CEE_BR_S:
+		return DecodedHandler::Br;
+	case CEE_BRTRUE:
+	case CEE_BRTRUE_S:
+		return DecodedHandler::BrTrue;
+	case CEE_BRFALSE:
+	case CEE_BRFALSE_S:
+		return DecodedHandler::BrFalse;
+	case CEE_BEQ:
+	case CEE_BEQ_S:
+		return DecodedHandler::Beq;
+	case CEE_BNE_UN:
+	case CEE_BNE_UN_S:
+		return DecodedHandler::BneUn;
+	case CEE_BGE:
+	case CEE_BGE_S:
+		return DecodedHandler::Bge;
+	case CEE_BGE_UN:
+	case CEE_BGE_UN_S:
+		return DecodedHandler::BgeUn;
+	case CEE_BGT:
+	case CEE_BGT_S:
+		return DecodedHandler::Bgt;
+	case CEE_BGT_UN:
+	case CEE_BGT_UN_S:
+		return DecodedHandler::BgtUn;
+	case CEE_BLE:
+	case CEE_BLE_S:
+		return DecodedHandler::Ble;
+	case CEE_BLE_UN:
+	case CEE_BLE_UN_S:
+		return DecodedHandler::BleUn;
+	case CEE_BLT:
+	case CEE_BLT_S:
+		return DecodedHandler::Blt;
+	case CEE_BLT_UN:
+	case CEE_BLT_UN_S:
+		return DecodedHandler::BltUn;
+	case CEE_CALL:
+	case CEE_NEWOBJ:
+		return DecodedHandler::Call;
+	case CEE_CALLVIRT:
+		return DecodedHandler::CallVirt;
+	case CEE_LDFLD:
+		return DecodedHandler::LdFld;
+	case CEE_STFLD:
+		return DecodedHandler::StFld;
+	default:
+		// Everything else (calls, field access, object creation, exception handling...) is done by the interpreter
+		return DecodedHandler::Fallback;
+	}
+}
+
+/// <summary>
+/// Checks whether the call instruction at pCode can be replaced by the body of the called method. Returns LdFld or StFld if the
+/// called method is a simple property getter or setter (fieldToken is the field it accesses) and Call if the method only passes
+/// its arguments on to another method (target is the method that finally does the work). Returns Fallback if the method must be called.
+/// Such methods cannot have exception clauses. If the inlined handler cannot deal with its operands (i.e. the instance is null),
+/// it falls back to the interpreter, which executes the original call, so the behavior doesn't change.
+/// </summary>
+DecodedHandler DecodedMethod::InlineCall(const byte* pCode, OPCODE opcode, SortedMethodList& methods, int32_t& fieldToken, MethodBody*& target)
+{
+	if (opcode != CEE_CALL && opcode != CEE_CALLVIRT)
+	{
+		return DecodedHandler::Fallback;
+	}
+
+	DecodedHandler result = DecodedHandler::Fallback;
+	MethodBody* method = methods.BinarySearchKey(ReadInt32(pCode + 1));
+	for (int depth = 0; depth < INLINE_MAX_DEPTH && method != nullptr; depth++)
+	{
+		// A virtual method may be overridden, a synchronized method needs its lock and special methods are handled by the runtime
+		byte flags = method->MethodFlags();
+		if ((flags & ((byte)MethodFlags::Synchronized | (byte)MethodFlags::SpecialMethod)) != 0 ||
+			(opcode == CEE_CALLVIRT && (flags & (byte)MethodFlags::Virtual) != 0))
+		{
+			break;
+		}
+
+		// Split the body into its instructions. The methods we're looking for have at most two more instructions than arguments.
+		const int maxInstructions = 8;
+		const byte* instructions[maxInstructions];
+		OPCODE opcodes[maxInstructions];
+		const byte* il = method->_methodIl;
+		uint16_t length = method->MethodLength();
+		int count = 0;
+		uint16_t pc = 0;
+		while (pc < length && count < maxInstructions)
+		{
+			instructions[count] = il + pc;
+			pc += InstructionLength(il + pc, opcodes[count]);
+			count++;
+		}
+
+		if (count < 2 || pc != length || opcodes[count - 1] != CEE_RET)
+		{
+			break;
+		}
+
+		int numArgs = method->NumberOfArguments();
+		if (count == 3 && numArgs == 1 && opcodes[0] == CEE_LDARG_0 && opcodes[1] == CEE_LDFLD && ReturnsValue(method))
+		{
+			// ldarg.0; ldfld; ret
+			fieldToken = ReadInt32(instructions[1] + 1);
+			return DecodedHandler::LdFld;
+		}
+
+		if (count == 4 && numArgs == 2 && opcodes[0] == CEE_LDARG_0 && opcodes[1] == CEE_LDARG_1 && opcodes[2] == CEE_STFLD && !ReturnsValue(method))
+		{
+			// ldarg.0; ldarg.1; stfld; ret
+			fieldToken = ReadInt32(instructions[2] + 1);
+			return DecodedHandler::StFld;
+		}
+
+		// ldarg.0 ... ldarg.n-1; call; ret: The arguments are already where the inner method expects them. A callvirt is not
+		// forwarded, because it must fail for a null instance even if the inner method doesn't use it.
+		if (opcode != CEE_CALL || count != numArgs + 2 || opcodes[numArgs] != CEE_CALL)
+		{
+			break;
+		}
+
+		bool forwardsArguments = true;
+		for (int i = 0; i < numArgs; i++)
+		{
+			if (LoadedArgument(instructions[i], opcodes[i]) != i)
+			{
+				forwardsArguments = false;
+				break;
+			}
+		}
+
+		MethodBody* inner = methods.BinarySearchKey(ReadInt32(instructions[numArgs] + 1));
+		if (!forwardsArguments || inner == nullptr || inner == method || inner->NumberOfArguments() != numArgs || ReturnsValue(inner) != ReturnsValue(method))
+		{
+			break;
+		}
+
+		// The inner method may be trivial as well
+		target = inner;
+		result = DecodedHandler::Call;
+		method = inner;
+	}
+
+	return result;
+}
+
+DecodedMethod* DecodedMethod::Decode(MethodBody* method, SortedMethodList& methods, bool fuseInstructions, bool inlineCalls)
+{
+	DecodedMethod* decoded = new DecodedMethod(method);
+	if (decoded == nullptr)
+	{
+		return nullptr;
+	}
+
+	byte* pCode = method->_methodIl;
+	uint16_t length = method->MethodLength();
+	if (pCode == nullptr || length == 0)
+	{
+		return decoded;
+	}
+
+	// First pass: Count the instructions, the virtual call sites and the field accesses (including those of inlined calls)
+	uint16_t count = 0;
+	uint16_t callSiteCount = 0;
+	uint16_t fieldSiteCount = 0;
+	uint16_t pc = 0;
+	OPCODE opcode;
+	int32_t fieldToken;
+	MethodBody* target;
+	bool prefixed = false;
+	while (pc < length)
+	{
+		uint16_t len = InstructionLength(pCode + pc, opcode);
+		DecodedHandler inlined = DecodedHandler::Fallback;
+		if (inlineCalls && !prefixed)
+		{
+			inlined = InlineCall(pCode + pc, opcode, methods, fieldToken, target);
+		}
+
+		if (inlined == DecodedHandler::LdFld || inlined == DecodedHandler::StFld)
+		{
+			fieldSiteCount++;
+		}
+		else if (opcode == CEE_CALLVIRT)
+		{
+			callSiteCount++;
+		}
+		else if (opcode == CEE_LDFLD || opcode == CEE_STFLD)
+		{
+			fieldSiteCount++;
+		}
+		prefixed = IsPrefix(opcode);
+		pc += len;
+		count++;
+	}
+
+	DecodedInstruction* code = (DecodedInstruction*)mallocEx(count * sizeof(DecodedInstruction));
+	CallSite* callSites = nullptr;
+	if (callSiteCount > 0)
+	{
+		callSites = (CallSite*)mallocEx(callSiteCount * sizeof(CallSite));
+	}
+
+	FieldSite* fieldSites = nullptr;
+	if (fieldSiteCount > 0)
+	{
+		fieldSites = (FieldSite*)mallocEx(fieldSiteCount * sizeof(FieldSite));
+	}
+
+	if (code == nullptr || (callSiteCount > 0 && callSites == nullptr) || (fieldSiteCount > 0 && fieldSites == nullptr))
+	{
+		// Not fatal, the method is then just executed by the interpreter
+		freeEx(code);
+		freeEx(callSites);
+		freeEx(fieldSites);
+		return decoded;
+	}
+
+	if (callSites != nullptr)
+	{
+		memset(callSites, 0, callSiteCount * sizeof(CallSite));
+	}
+
+	if (fieldSites != nullptr)
+	{
+		memset(fieldSites, 0, fieldSiteCount * sizeof(FieldSite));
+	}
+
+	CallSite* nextCallSite = callSites;
+	FieldSite* nextFieldSite = fieldSites;
+
+	// Second pass: Decode the instructions and their operands
+	pc = 0;
+	prefixed = false;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		DecodedInstruction& instr = code[i];
+		uint16_t len = InstructionLength(pCode + pc, opcode);
+		uint16_t opcodeLength;
+		DecodeOpcode(pCode + pc, &opcodeLength);
+		const byte* operandPtr = pCode + pc + opcodeLength;
+		instr.Pc = pc;
+		instr.Operand.Int32 = 0;
+		instr.Handler = opcode == CEE_COUNT ? DecodedHandler::Fallback : HandlerForOpcode(opcode, instr.Operand.Int32);
+		if (instr.Handler != DecodedHandler::Fallback)
+		{
+			switch (GetOpcodeFormat(opcode))
+			{
+			case ShortInlineVar:
+				instr.Operand.Int32 = *operandPtr;
+				break;
+			case ShortInlineI:
+				instr.Operand.Int32 = (int8_t)*operandPtr;
+				break;
+			case ShortInlineBrTarget:
+				// For now, this is the absolute target pc. Converted to an instruction index below
+				instr.Operand.Int32 = pc + len + (int8_t)*operandPtr;
+				break;
+			case InlineBrTarget:
+				instr.Operand.Int32 = pc + len + ReadInt32(operandPtr);
+				break;
+			case InlineI:
+			case ShortInlineR:
+				instr.Operand.Int32 = ReadInt32(operandPtr);
+				break;
+			case InlineMethod:
+				{
+					DecodedHandler inlined = DecodedHandler::Fallback;
+					if (inlineCalls && !prefixed)
+					{
+						inlined = InlineCall(pCode + pc, opcode, methods, fieldToken, target);
+					}
+
+					if (inlined == DecodedHandler::LdFld || inlined == DecodedHandler::StFld)
+					{
+						FieldSite* fieldSite = nextFieldSite++;
+						fieldSite->Token = fieldToken;
+						instr.Handler = inlined;
+						instr.Operand.Ptr = fieldSite;
+						decoded->InlinedCallCount++;
+						break;
+					}
+
+					if (inlined == DecodedHandler::Call)
+					{
+						// Executed by the interpreter, but without the frames of the forwarding methods
+						instr.Operand.Ptr = target;
+						decoded->InlinedCallCount++;
+						break;
+					}
+				}
+
+				// Link the call to its target, so we don't have to look up the token each time the call is executed.
+				// If the token is unknown, the interpreter will report the error when (and if) the call executes.
+				instr.Operand.Ptr = methods.BinarySearchKey(ReadInt32(operandPtr));
+				if (instr.Operand.Ptr == nullptr)
+				{
+					instr.Handler = DecodedHandler::Fallback;
+				}
+				else if (instr.Handler == DecodedHandler::CallVirt)
+				{
+					CallSite* callSite = nextCallSite++;
+					callSite->Method = (MethodBody*)instr.Operand.Ptr;
+					instr.Operand.Ptr = callSite;
+				}
+				break;
+			case InlineField:
+				{
+					// The offset is resolved on first use, when we know the class of the instance
+					FieldSite* fieldSite = nextFieldSite++;
+					fieldSite->Token = ReadInt32(operandPtr);
+					instr.Operand.Ptr = fieldSite;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		prefixed = IsPrefix(opcode);
+		pc += len;
+	}
+
+	decoded->Code = code;
+	decoded->Count = count;
+	decoded->CallSites = callSites;
+	decoded->CallSiteCount = callSiteCount;
+	decoded->FieldSites = fieldSites;
+	decoded->FieldSiteCount = fieldSiteCount;
+
+	// Third pass: Convert the branch targets to instruction indices
+	for (uint16_t i = 0; i < count; i++)
+	{
+		DecodedInstruction& instr = code[i];
+		if (instr.Handler >= DecodedHandler::Br && instr.Handler <= DecodedHandler::BltUn)
+		{
+			uint16_t targetPc = (uint16_t)instr.Operand.Int32;
+			uint16_t index = decoded->IndexOfPc(targetPc);
+			if (index >= count || code[index].Pc != targetPc)
+			{
+				// Branch into the middle of an instruction? Let the interpreter deal with that.
+				instr.Handler = DecodedHandler::Fallback;
+				continue;
+			}
+			instr.Operand.Int32 = index;
+		}
+	}
+
+	if (fuseInstructions)
+	{
+		FuseInstructions(code, count);
+	}
+
+	return decoded;
+}
+
+/// <summary>
+/// Returns the branch superinstruction for a ldloc; ldloc; branch sequence, or Fallback if there's none for this kind of branch
+/// </summary>
+static DecodedHandler FusedLocalBranch(DecodedHandler branch)
+{
+	switch (branch)
+	{
+	case DecodedHandler::Blt:
+		return DecodedHandler::LdLocLdLocBlt;
+	case DecodedHandler::Ble:
+		return DecodedHandler::LdLocLdLocBle;
+	case DecodedHandler::Bgt:
+		return DecodedHandler::LdLocLdLocBgt;
+	case DecodedHandler::Bge:
+		return DecodedHandler::LdLocLdLocBge;
+	default:
+		return DecodedHandler::Fallback;
+	}
+}
+
+/// <summary>
+/// Peephole pass over the decoded instructions: Replaces the handler of the first instruction of a frequent sequence with
+/// a superinstruction that executes the whole sequence. Runs after the branch targets have been resolved.
+/// </summary>
+void DecodedMethod::FuseInstructions(DecodedInstruction* code, uint16_t count)
+{
+	uint16_t i = 0;
+	while (i < count)
+	{
+		DecodedInstruction* instr = code + i;
+		uint16_t remaining = count - i;
+		uint16_t fusedLength = 1;
+		if (instr->Handler == DecodedHandler::LdArg && remaining >= 3 && instr[1].Handler == DecodedHandler::LdArg && instr[2].Handler == DecodedHandler::StFld)
+		{
+			instr->Handler = DecodedHandler::LdArgLdArgStFld;
+			fusedLength = 3;
+		}
+		else if (instr->Handler == DecodedHandler::LdArg && remaining >= 2 && instr[1].Handler == DecodedHandler::LdFld)
+		{
+			instr->Handler = DecodedHandler::LdArgLdFld;
+			fusedLength = 2;
+		}
+		else if (instr->Handler == DecodedHandler::LdLoc && remaining >= 4 && instr[1].Handler == DecodedHandler::LdcI4 && instr[2].Handler == DecodedHandler::Add &&
+			instr[3].Handler == DecodedHandler::StLoc && instr[3].Operand.Int32 == instr->Operand.Int32)
+		{
+			instr->Handler = DecodedHandler::IncLoc;
+			fusedLength = 4;
+		}
+		else if (instr->Handler == DecodedHandler::LdLoc && remaining >= 3 && instr[1].Handler == DecodedHandler::LdLoc && FusedLocalBranch(instr[2].Handler) != DecodedHandler::Fallback)
+		{
+			instr->Handler = FusedLocalBranch(instr[2].Handler);
+			fusedLength = 3;
+		}
+
+		i += fusedLength;
+	}
+}
+
+DecodedHandler DecodedMethod::Quicken(DecodedHandler generic, VariableKind operandType)
+{
+	int first;
+	switch (generic)
+	{
+	case DecodedHandler::Add:
+		first = (int)DecodedHandler::AddI4;
+		break;
+	case DecodedHandler::Sub:
+		first = (int)DecodedHandler::SubI4;
+		break;
+	case DecodedHandler::Mul:
+		first = (int)DecodedHandler::MulI4;
+		break;
+	case DecodedHandler::Ceq:
+		first = (int)DecodedHandler::CeqI4;
+		break;
+	case DecodedHandler::Cgt:
+		first = (int)DecodedHandler::CgtI4;
+		break;
+	case DecodedHandler::Clt:
+		first = (int)DecodedHandler::CltI4;
+		break;
+	default:
+		return DecodedHandler::Fallback;
+	}
+
+	switch (operandType)
+	{
+	case VariableKind::Int32:
+		return (DecodedHandler)first;
+	case VariableKind::Int64:
+		return (DecodedHandler)(first + 1);
+	case VariableKind::Float:
+		return (DecodedHandler)(first + 2);
+	case VariableKind::Double:
+		return (DecodedHandler)(first + 3);
+	default:
+		return DecodedHandler::Fallback;
+	}
+}
+
+const char* DecodedMethod::FusedHandlerName(DecodedHandler handler)
+{
+	static const char* const names[] =
+	{
+#define DECODED_HANDLER_NAME(name) #name,
+		DECODED_FUSED_HANDLER_LIST(DECODED_HANDLER_NAME)
+#undef DECODED_HANDLER_NAME
+	};
+
+	int index = (int)handler - (int)DecodedHandler::FirstFused;
+	if (index < 0 || index >= (int)DecodedHandler::NumberOfFusedHandlers)
+	{
+		return "";
+	}
+
+	return names[index];
+}
+
+/// <summary>
+/// Returns the index of the instruction at the given pc, or the index where it would be inserted
+/// </summary>
+uint16_t DecodedMethod::IndexOfPc(uint16_t pc) const
+{
+	return (uint16_t)stdSimple::LowerBound(Code, Count, pc);
+}
+
+DecodedInstruction* DecodedMethod::InstructionAt(uint16_t pc) const
+{
+	uint16_t index = IndexOfPc(pc);
+	if (index >= Count || Code[index].Pc != pc)
+	{
+		return nullptr;
+	}
+
+	return Code + index;
+}
+
+DecodedMethod* DecodedMethodCache::GetDecodedMethod(MethodBody* method, SortedMethodList& methods)
+{
+	uint32_t key = method->methodToken;
+	size_t index = stdSimple::LowerBound(_methods.begin(), _methods.size(), key);
+	if (index < _methods.size() && _methods[index]->GetKey() == key)
+	{
+		DecodedMethod* entry = _methods[index];
+		return entry->Code != nullptr ? entry : nullptr;
+	}
+
+	DecodedMethod* decoded = DecodedMethod::Decode(method, methods, _fuseInstructions, _inlineCalls);
+	if (decoded == nullptr)
+	{
+		return nullptr;
+	}
+
+	// Methods that cannot be decoded are also kept, so we don't try again.
+	_methods.insert(index, decoded);
+
+	return decoded->Code != nullptr ? decoded : nullptr;
+}
+
+void DecodedMethodCache::clear()
+{
+	for (size_t i = 0; i < _methods.size(); i++)
+	{
+		deleteEx(_methods[i]);
+	}
+
+	_methods.clear(true);
+}
+
+size_t DecodedMethodCache::MemoryUsage()
+{
+	size_t total = 0;
+	for (size_t i = 0; i < _methods.size(); i++)
+	{
+		total += _methods[i]->MemoryUsage();
+	}
+
+	return total;
+}
+
+uint32_t DecodedMethodCache::InlinedCallSites()
+{
+	uint32_t total = 0;
+	for (size_t i = 0; i < _methods.size(); i++)
+	{
+		total += _methods[i]->InlinedCallCount;
+	}
+
+	return total;
+}
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <ConfigurableFirmata.h>
+#include "ObjectVector.h"
+#include "openum.h"
+#include "MethodBody.h"
+#include "ClassDeclaration.h"
+
+OPCODE DecodeOpcode(const byte *pCode, uint16_t *pdwLen);
+OPCODE_FORMAT GetOpcodeFormat(OPCODE opcode);
+
+/// <summary>
+/// Returns the length of the instruction at the given address, including the opcode and its inline operands
+/// </summary>
+uint16_t InstructionLength(const byte* pCode, OPCODE& opcode);
+
+/// <summary>
+/// The list of handlers of the pre-decoded execution engine. The order of this list defines the handler numbers
+/// and the order of the dispatch table. Everything that is not listed here is executed by the IL interpreter (Fallback).
+/// </summary>
+#define DECODED_HANDLER_LIST(X) \
+	X(Fallback) \
+	X(Nop) \
+	X(LdArg) \
+	X(StArg) \
+	X(LdLoc) \
+	X(StLoc) \
+	X(LdcI4) \
+	X(LdcR4) \
+	X(LdNull) \
+	X(Dup) \
+	X(Pop) \
+	X(Add) \
+	X(Sub) \
+	X(Mul) \
+	X(And) \
+	X(Or) \
+	X(Xor) \
+	X(Shl) \
+	X(Shr) \
+	X(ShrUn) \
+	X(Ceq) \
+	X(Cgt) \
+	X(CgtUn) \
+	X(Clt) \
+	X(CltUn) \
+	X(Br) \
+	X(BrTrue) \
+	X(BrFalse) \
+	X(Beq) \
+	X(BneUn) \
+	X(Bge) \
+	X(BgeUn) \
+	X(Bgt) \
+	X(BgtUn) \
+	X(Ble) \
+	X(BleUn) \
+	X(Blt) \
+	X(BltUn) \
+	X(Call) \
+	X(CallVirt) \
+	X(LdFld) \
+	X(StFld) \
+	DECODED_FUSED_HANDLER_LIST(X) \
+	DECODED_QUICKENED_HANDLER_LIST(X)
+
+/// <summary>
+/// Superinstructions: Handlers that execute a frequent sequence of instructions at once. The fused handler replaces the handler of
+/// the first instruction of the sequence only, the other instructions are kept as they are. The fused handler reads their operands
+/// from there, and branches into the middle of the sequence (or a fallback to the interpreter) still find the original instructions.
+/// </summary>
+#define DECODED_FUSED_HANDLER_LIST(X) \
+	X(LdArgLdFld) /* ldarg; ldfld */ \
+	X(LdArgLdArgStFld) /* ldarg; ldarg; stfld */ \
+	X(IncLoc) /* ldloc x; ldc.i4; add; stloc x */ \
+	X(LdLocLdLocBlt) /* ldloc; ldloc; blt */ \
+	X(LdLocLdLocBle) \
+	X(LdLocLdLocBgt) \
+	X(LdLocLdLocBge)
+
+/// <summary>
+/// Type-specialised variants of the arithmetic and comparison handlers. The generic handler replaces itself with one of these
+/// when it is first executed, according to the type of its operands. The specialised handler only checks that the type is still
+/// the same and goes back to the generic handler otherwise. Each group must list the types in the order Int32, Int64, Float, Double.
+/// </summary>
+#define DECODED_QUICKENED_HANDLER_LIST(X) \
+	X(AddI4) X(AddI8) X(AddR4) X(AddR8) \
+	X(SubI4) X(SubI8) X(SubR4) X(SubR8) \
+	X(MulI4) X(MulI8) X(MulR4) X(MulR8) \
+	X(CeqI4) X(CeqI8) X(CeqR4) X(CeqR8) \
+	X(CgtI4) X(CgtI8) X(CgtR4) X(CgtR8) \
+	X(CltI4) X(CltI8) X(CltR4) X(CltR8)
+
+enum class DecodedHandler : uint16_t
+{
+#define DECODED_HANDLER_ENUM(name) name,
+	DECODED_HANDLER_LIST(DECODED_HANDLER_ENUM)
+#undef DECODED_HANDLER_ENUM
+	NumberOfHandlers,
+	FirstFused = LdArgLdFld,
+	NumberOfFusedHandlers = AddI4 - FirstFused
+};
+
+#ifndef DEFAULT_SUPERINSTRUCTIONS
+#define DEFAULT_SUPERINSTRUCTIONS true
+#endif
+
+#ifndef DEFAULT_CALL_INLINING
+#define DEFAULT_CALL_INLINING true
+#endif
+
+// How many forwarding methods are followed when inlining a call
+#define INLINE_MAX_DEPTH 4
+
+/// <summary>
+/// One pre-decoded IL instruction. Inline operands are already decoded, branch targets are indices into the instruction array.
+/// For calls, the operand is the already resolved target method, for virtual calls it points to the CallSite and for
+/// instance field access to the FieldSite. An inlined call keeps the Pc of the call instruction, but gets the handler of the
+/// body of the called method (i.e. LdFld for a property getter).
+/// </summary>
+struct DecodedInstruction
+{
+	DecodedHandler Handler;
+	// Offset of the original instruction in the IL stream (used when falling back to the interpreter and for the debugger)
+	uint16_t Pc;
+	union
+	{
+		int32_t Int32;
+		uint32_t Uint32;
+		float Float;
+		void* Ptr;
+	} Operand;
+
+	uint16_t GetKey() const
+	{
+		return Pc;
+	}
+};
+
+#define CALL_SITE_CACHE_ENTRIES 2
+
+/// <summary>
+/// An inline cache for a callvirt instruction. Remembers the resolved target method for the last few receiver classes,
+/// so that repeated calls from the same call site don't need to walk the class hierarchy.
+/// </summary>
+struct CallSite
+{
+	// The method token of the call instruction, linked to its declaration
+	MethodBody* Method;
+	ClassDeclaration* ReceiverClass[CALL_SITE_CACHE_ENTRIES];
+	MethodBody* Target[CALL_SITE_CACHE_ENTRIES];
+	byte NextEntry;
+
+	MethodBody* Lookup(ClassDeclaration* receiverClass) const
+	{
+		for (int i = 0; i < CALL_SITE_CACHE_ENTRIES; i++)
+		{
+			if (ReceiverClass[i] == receiverClass)
+			{
+				return Target[i];
+			}
+		}
+
+		return nullptr;
+	}
+
+	void Add(ClassDeclaration* receiverClass, MethodBody* target)
+	{
+		// Replace the oldest entry
+		ReceiverClass[NextEntry] = receiverClass;
+		Target[NextEntry] = target;
+		NextEntry = (NextEntry + 1) % CALL_SITE_CACHE_ENTRIES;
+	}
+};
+
+/// <summary>
+/// The field token of a ldfld or stfld instruction, together with its location in the last class it was used on.
+/// </summary>
+struct FieldSite
+{
+	int32_t Token;
+	ClassDeclaration* Class;
+	const FieldOffsetEntry* Field;
+};
+
+/// <summary>
+/// The pre-decoded instruction stream of one method.
+/// </summary>
+class DecodedMethod
+{
+public:
+	DecodedMethod(MethodBody* method)
+	{
+		Method = method;
+		Code = nullptr;
+		Count = 0;
+		CallSites = nullptr;
+		CallSiteCount = 0;
+		FieldSites = nullptr;
+		FieldSiteCount = 0;
+		InlinedCallCount = 0;
+	}
+
+	~DecodedMethod()
+	{
+		freeEx(Code);
+		freeEx(CallSites);
+		freeEx(FieldSites);
+		Count = 0;
+		CallSiteCount = 0;
+		FieldSiteCount = 0;
+	}
+
+	/// <summary>
+	/// Translates the IL code of the given method. Returns an instance without code if the method has no IL (i.e. is native)
+	/// or there's not enough memory for the translated code. Method tokens of call instructions are resolved using the given method list.
+	/// If fuseInstructions is true, frequent instruction sequences are replaced by superinstructions. If inlineCalls is true,
+	/// calls to trivial methods (simple property accessors and methods that only forward their arguments) are replaced by their body.
+	/// </summary>
+	static DecodedMethod* Decode(MethodBody* method, SortedMethodList& methods, bool fuseInstructions, bool inlineCalls);
+
+	/// <summary>
+	/// Returns the name of a fused handler, for the statistics
+	/// </summary>
+	static const char* FusedHandlerName(DecodedHandler handler);
+
+	/// <summary>
+	/// Returns the type-specialised variant of a generic arithmetic or comparison handler for operands of the given type,
+	/// or Fallback if there is none.
+	/// </summary>
+	static DecodedHandler Quicken(DecodedHandler generic, VariableKind operandType);
+
+	/// <summary>
+	/// Returns the instruction starting at the given IL offset, or null if there's none (i.e. the pc points to an instruction after a prefix)
+	/// </summary>
+	DecodedInstruction* InstructionAt(uint16_t pc) const;
+
+	uint32_t GetKey() const
+	{
+		return Method->methodToken;
+	}
+
+	size_t MemoryUsage() const
+	{
+		return sizeof(DecodedMethod) + Count * sizeof(DecodedInstruction) + CallSiteCount * sizeof(CallSite) + FieldSiteCount * sizeof(FieldSite);
+	}
+
+	MethodBody* Method;
+	DecodedInstruction* Code;
+	uint16_t Count;
+	CallSite* CallSites;
+	uint16_t CallSiteCount;
+	FieldSite* FieldSites;
+	uint16_t FieldSiteCount;
+	// Number of call instructions that were replaced by the body of the called method
+	uint16_t InlinedCallCount;
+
+private:
+	uint16_t IndexOfPc(uint16_t pc) const;
+	static DecodedHandler HandlerForOpcode(OPCODE opcode, int32_t& operand);
+	static DecodedHandler InlineCall(const byte* pCode, OPCODE opcode, SortedMethodList& methods, int32_t& fieldToken, MethodBody*& target);
+	static void FuseInstructions(DecodedInstruction* code, uint16_t count);
+};
+
+/// <summary>
+/// The pre-decoded methods, sorted by method token. Methods are decoded when they are first executed.
+/// </summary>
+class DecodedMethodCache
+{
+private:
+	stdSimple::vector<DecodedMethod*> _methods;
+	bool _fuseInstructions;
+	bool _inlineCalls;
+public:
+	DecodedMethodCache()
+	{
+		_fuseInstructions = DEFAULT_SUPERINSTRUCTIONS;
+		_inlineCalls = DEFAULT_CALL_INLINING;
+	}
+
+	~DecodedMethodCache()
+	{
+		clear();
+	}
+
+	/// <summary>
+	/// Enables or disables the superinstructions. Only affects methods decoded afterwards, so the cache should be cleared.
+	/// </summary>
+	void SetFuseInstructions(bool fuseInstructions)
+	{
+		_fuseInstructions = fuseInstructions;
+	}
+
+	bool GetFuseInstructions() const
+	{
+		return _fuseInstructions;
+	}
+
+	/// <summary>
+	/// Enables or disables the inlining of trivial methods. Only affects methods decoded afterwards, so the cache should be cleared.
+	/// </summary>
+	void SetInlineCalls(bool inlineCalls)
+	{
+		_inlineCalls = inlineCalls;
+	}
+
+	bool GetInlineCalls() const
+	{
+		return _inlineCalls;
+	}
+
+	/// <summary>
+	/// Returns the decoded form of the given method, translating it if needed. Returns null if the method cannot be executed by the
+	/// pre-decoded engine.
+	/// </summary>
+	DecodedMethod* GetDecodedMethod(MethodBody* method, SortedMethodList& methods);
+
+	void clear();
+
+	size_t size()
+	{
+		return _methods.size();
+	}
+
+	size_t MemoryUsage();
+
+	/// <summary>
+	/// The number of call instructions that were inlined in the currently decoded methods
+	/// </summary>
+	uint32_t InlinedCallSites();
+};
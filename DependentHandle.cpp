@@ -22,6 +22,7 @@ bool DependentHandle::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executi
 		ASSERT(args.size() == 2);
 			// We're currently not reusing existing entries. But these handles are rarely used, so this should not normally cause a memory leak
 		pair<void*, void*> newElem(args[0].Object, args[1].Object);
+		ScopeLock lk;
 		int offset = executor->_weakDependencies.push_back(newElem);
 		result.Type = VariableKind::Int32;
 		result.setSize(4),
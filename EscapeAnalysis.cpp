@@ -0,0 +1,589 @@
+#include <ConfigurableFirmata.h>
+#include "EscapeAnalysis.h"
+#include "DecodedMethod.h"
+#include "Exceptions.h"
+#include "interface/MethodFlags.h"
+
+// Number of values each instruction pops from and pushes to the evaluation stack. VAR_STACK_EFFECT if that depends on the operand.
+#define VAR_STACK_EFFECT 0x7f
+#define Pop0 0
+#define Pop1 1
+#define PopI 1
+#define PopI8 1
+#define PopR4 1
+#define PopR8 1
+#define PopRef 1
+#define VarPop VAR_STACK_EFFECT
+#define Push0 0
+#define Push1 1
+#define PushI 1
+#define PushI8 1
+#define PushR4 1
+#define PushR8 1
+#define PushRef 1
+#define VarPush VAR_STACK_EFFECT
+
+static const byte StackPops[] PROGMEM =
+{
+#define OPDEF(c,s,pop,push,args,type,l,s1,s2,ctrl) pop,
+#include "opcode.def.h"
+#undef OPDEF
+};
+
+static const byte StackPushes[] PROGMEM =
+{
+#define OPDEF(c,s,pop,push,args,type,l,s1,s2,ctrl) push,
+#include "opcode.def.h"
+#undef OPDEF
+};
+
+/// <summary>
+/// Reads a 32 bit value from an address that need not be aligned
+/// </summary>
+static int32_t ReadInt32(const byte* pCode)
+{
+	return (int32_t)(((uint32_t)pCode[0]) | (((uint32_t)pCode[1]) << 8) | (((uint32_t)pCode[2]) << 16) | (((uint32_t)pCode[3]) << 24));
+}
+
+static uint16_t ReadUint16(const byte* pCode)
+{
+	return (uint16_t)(pCode[0] | (pCode[1] << 8));
+}
+
+static bool ReturnsValue(MethodBody* method)
+{
+	return (method->MethodFlags() & (byte)MethodFlags::Void) == 0 && (method->MethodFlags() & (byte)MethodFlags::Ctor) == 0;
+}
+
+const MethodEscapeInfo* EscapeAnalysis::FindEscapeInfo(int32_t methodToken)
+{
+	MethodEscapeInfo* const* entry = stdSimple::BinarySearch(_methods.begin(), _methods.size(), (uint32_t)methodToken);
+	return entry != nullptr ? *entry : nullptr;
+}
+
+const MethodEscapeInfo* EscapeAnalysis::AddEscapeInfo(MethodEscapeInfo* info)
+{
+	size_t index = stdSimple::LowerBound(_methods.begin(), _methods.size(), info->GetKey());
+	if (index < _methods.size() && _methods[index]->GetKey() == info->GetKey())
+	{
+		// Another core analyzed the same method in the meantime
+		deleteEx(info);
+		return _methods[index];
+	}
+
+	_stackAllocatableSites += info->Count;
+	_methods.insert(index, info);
+	return info;
+}
+
+void EscapeAnalysis::clear()
+{
+	for (size_t i = 0; i < _methods.size(); i++)
+	{
+		deleteEx(_methods[i]);
+	}
+
+	_methods.clear(true);
+	_stackAllocatableSites = 0;
+}
+
+MethodEscapeInfo* EscapeAnalysis::Analyze(MethodBody* method, SortedMethodList& methods)
+{
+	MethodEscapeInfo* info = new MethodEscapeInfo(method->methodToken);
+	if (info == nullptr)
+	{
+		stdSimple::OutOfMemoryException::Throw("Out of memory analyzing method");
+	}
+
+	byte* pCode = method->_methodIl;
+	uint16_t length = method->MethodLength();
+	stdSimple::vector<uint16_t> sites;
+	uint16_t pc = 0;
+	while (pc < length)
+	{
+		OPCODE opcode;
+		uint16_t len = InstructionLength(pCode + pc, opcode);
+		if (opcode == CEE_COUNT)
+		{
+			// Invalid code. The interpreter will complain when it gets there.
+			break;
+		}
+
+		if (opcode == CEE_NEWOBJ && !IsInLoop(method, pc) && !Escapes(method, pc, -1, methods, 0))
+		{
+			sites.push_back(pc);
+		}
+
+		pc += len;
+	}
+
+	if (sites.size() > 0)
+	{
+		info->Sites = (uint16_t*)mallocEx(sites.size() * sizeof(uint16_t));
+		if (info->Sites == nullptr)
+		{
+			// Not fatal, the objects are just created on the heap
+			return info;
+		}
+
+		for (size_t i = 0; i < sites.size(); i++)
+		{
+			info->Sites[i] = sites[i];
+		}
+		info->Count = (uint16_t)sites.size();
+	}
+
+	return info;
+}
+
+/// <summary>
+/// True if the given instruction could be executed more than once per call to the method, because a backward branch jumps over it.
+/// </summary>
+bool EscapeAnalysis::IsInLoop(MethodBody* method, uint16_t sitePc)
+{
+	byte* pCode = method->_methodIl;
+	uint16_t length = method->MethodLength();
+	uint16_t pc = 0;
+	while (pc < length)
+	{
+		OPCODE opcode;
+		uint16_t len = InstructionLength(pCode + pc, opcode);
+		if (opcode == CEE_COUNT)
+		{
+			return true;
+		}
+
+		if (pc >= sitePc)
+		{
+			uint16_t opcodeLength;
+			DecodeOpcode(pCode + pc, &opcodeLength);
+			const byte* operand = pCode + pc + opcodeLength;
+			switch (GetOpcodeFormat(opcode))
+			{
+			case ShortInlineBrTarget:
+				if (pc + len + (int8_t)*operand <= sitePc)
+				{
+					return true;
+				}
+				break;
+			case InlineBrTarget:
+				if (pc + len + ReadInt32(operand) <= sitePc)
+				{
+					return true;
+				}
+				break;
+			case InlineSwitch:
+				{
+					int32_t count = ReadInt32(operand);
+					for (int32_t i = 0; i < count; i++)
+					{
+						if (pc + len + ReadInt32(operand + 4 + 4 * i) <= sitePc)
+						{
+							return true;
+						}
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		pc += len;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Returns true if the object created at sourcePc (or passed in the given argument, if sourcePc is -1) may escape the method
+/// </summary>
+bool EscapeAnalysis::Escapes(MethodBody* method, int32_t sourcePc, int argument, SortedMethodList& methods, int depth)
+{
+	if (method->_methodIl == nullptr || method->MethodLength() == 0 || depth > ESCAPE_ANALYSIS_MAX_DEPTH)
+	{
+		return true;
+	}
+
+	// One flag per stack slot, local and argument, telling whether it might hold the object
+	int maxStack = method->MaxExecutionStack() + 1;
+	int numLocals = method->NumberOfLocals();
+	int numArguments = method->NumberOfArguments();
+	byte* flags = (byte*)mallocEx(maxStack + numLocals + numArguments + 1);
+	if (flags == nullptr)
+	{
+		return true;
+	}
+
+	memset(flags, 0, maxStack + numLocals + numArguments + 1);
+	if (argument >= 0)
+	{
+		flags[maxStack + numLocals + argument] = 1;
+	}
+
+	bool result = Escapes(method, sourcePc, methods, depth, flags, flags + maxStack, flags + maxStack + numLocals);
+	freeEx(flags);
+	return result;
+}
+
+bool EscapeAnalysis::Escapes(MethodBody* method, int32_t sourcePc, SortedMethodList& methods, int depth, byte* stack, byte* locals, byte* arguments)
+{
+	byte* pCode = method->_methodIl;
+	uint16_t length = method->MethodLength();
+	int maxStack = method->MaxExecutionStack() + 1;
+	int numLocals = method->NumberOfLocals();
+	int numArguments = method->NumberOfArguments();
+
+// Values popped from an empty stack were put there by the runtime (i.e. the exception at the start of a catch block)
+#define POP() (stackDepth > 0 ? stack[--stackDepth] : 0)
+#define PUSH(x) if (stackDepth >= maxStack) { return true; } stack[stackDepth++] = (x)
+
+	// The flags of the locals and the arguments are set for the whole method (regardless of where they are stored),
+	// so repeat until they don't change any more
+	for (int pass = 0; pass < 4; pass++)
+	{
+		bool changed = false;
+		bool prefixed = false;
+		int stackDepth = 0;
+		uint16_t pc = 0;
+		while (pc < length)
+		{
+			OPCODE opcode;
+			uint16_t len = InstructionLength(pCode + pc, opcode);
+			if (opcode == CEE_COUNT)
+			{
+				return true;
+			}
+
+			uint16_t opcodeLength;
+			DecodeOpcode(pCode + pc, &opcodeLength);
+			const byte* operand = pCode + pc + opcodeLength;
+
+			int index = -1;
+			bool isLocal = false;
+			bool unconditionalBranch = false;
+			bool conditionalBranch = false;
+			switch (opcode)
+			{
+			case CEE_TAIL_:
+			case CEE_CONSTRAINED_:
+				// The object must not be passed to a tail call (the frame is gone before the callee runs) and constrained
+				// calls can't be resolved here
+				prefixed = true;
+				pc += len;
+				continue;
+			case CEE_VOLATILE_:
+			case CEE_UNALIGNED_:
+			case CEE_READONLY_:
+			case CEE_NO_:
+			case CEE_NOP:
+				pc += len;
+				continue;
+			case CEE_LDARG_0:
+			case CEE_LDARG_1:
+			case CEE_LDARG_2:
+			case CEE_LDARG_3:
+				index = opcode - CEE_LDARG_0;
+				break;
+			case CEE_LDARG_S:
+				index = *operand;
+				break;
+			case CEE_LDARG:
+				index = ReadUint16(operand);
+				break;
+			case CEE_LDLOC_0:
+			case CEE_LDLOC_1:
+			case CEE_LDLOC_2:
+			case CEE_LDLOC_3:
+				index = opcode - CEE_LDLOC_0;
+				isLocal = true;
+				break;
+			case CEE_LDLOC_S:
+				index = *operand;
+				isLocal = true;
+				break;
+			case CEE_LDLOC:
+				index = ReadUint16(operand);
+				isLocal = true;
+				break;
+			default:
+				break;
+			}
+
+			if (index >= 0)
+			{
+				// A load of a local or an argument
+				if (index >= (isLocal ? numLocals : numArguments))
+				{
+					return true;
+				}
+				PUSH(isLocal ? locals[index] : arguments[index]);
+				pc += len;
+				continue;
+			}
+
+			switch (opcode)
+			{
+			case CEE_STLOC_0:
+			case CEE_STLOC_1:
+			case CEE_STLOC_2:
+			case CEE_STLOC_3:
+				index = opcode - CEE_STLOC_0;
+				isLocal = true;
+				break;
+			case CEE_STLOC_S:
+				index = *operand;
+				isLocal = true;
+				break;
+			case CEE_STLOC:
+				index = ReadUint16(operand);
+				isLocal = true;
+				break;
+			case CEE_STARG_S:
+				index = *operand;
+				break;
+			case CEE_STARG:
+				index = ReadUint16(operand);
+				break;
+			default:
+				break;
+			}
+
+			if (index >= 0)
+			{
+				// A store to a local or an argument
+				if (index >= (isLocal ? numLocals : numArguments))
+				{
+					return true;
+				}
+				byte* target = isLocal ? locals + index : arguments + index;
+				if (POP() && !*target)
+				{
+					*target = 1;
+					changed = true;
+				}
+				pc += len;
+				continue;
+			}
+
+			switch (opcode)
+			{
+			case CEE_LDLOCA_S:
+			case CEE_LDLOCA:
+			case CEE_LDARGA_S:
+			case CEE_LDARGA:
+				{
+					// The address of a variable holding the object could be stored anywhere
+					index = opcode == CEE_LDLOCA_S || opcode == CEE_LDARGA_S ? *operand : ReadUint16(operand);
+					isLocal = opcode == CEE_LDLOCA_S || opcode == CEE_LDLOCA;
+					if (index >= (isLocal ? numLocals : numArguments) || (isLocal ? locals[index] : arguments[index]))
+					{
+						return true;
+					}
+					PUSH(0);
+				}
+				break;
+			case CEE_DUP:
+				{
+					byte value = POP();
+					PUSH(value);
+					PUSH(value);
+				}
+				break;
+			case CEE_POP:
+				POP();
+				break;
+			case CEE_LDFLD:
+				// Loading a field of the object is fine
+				POP();
+				PUSH(0);
+				break;
+			case CEE_STFLD:
+				{
+					byte value = POP();
+					POP();
+					if (value)
+					{
+						return true;
+					}
+				}
+				break;
+			case CEE_ISINST:
+			case CEE_CASTCLASS:
+				{
+					byte value = POP();
+					PUSH(value);
+				}
+				break;
+			case CEE_CEQ:
+			case CEE_CGT:
+			case CEE_CGT_UN:
+			case CEE_CLT:
+			case CEE_CLT_UN:
+				POP();
+				POP();
+				PUSH(0);
+				break;
+			case CEE_BRFALSE:
+			case CEE_BRFALSE_S:
+			case CEE_BRTRUE:
+			case CEE_BRTRUE_S:
+			case CEE_SWITCH:
+				POP();
+				conditionalBranch = true;
+				break;
+			case CEE_BEQ:
+			case CEE_BEQ_S:
+			case CEE_BNE_UN:
+			case CEE_BNE_UN_S:
+			case CEE_BGE:
+			case CEE_BGE_S:
+			case CEE_BGE_UN:
+			case CEE_BGE_UN_S:
+			case CEE_BGT:
+			case CEE_BGT_S:
+			case CEE_BGT_UN:
+			case CEE_BGT_UN_S:
+			case CEE_BLE:
+			case CEE_BLE_S:
+			case CEE_BLE_UN:
+			case CEE_BLE_UN_S:
+			case CEE_BLT:
+			case CEE_BLT_S:
+			case CEE_BLT_UN:
+			case CEE_BLT_UN_S:
+				POP();
+				POP();
+				conditionalBranch = true;
+				break;
+			case CEE_BR:
+			case CEE_BR_S:
+			case CEE_LEAVE:
+			case CEE_LEAVE_S:
+				unconditionalBranch = true;
+				break;
+			case CEE_RET:
+				if (ReturnsValue(method) && POP())
+				{
+					return true;
+				}
+				unconditionalBranch = true;
+				break;
+			case CEE_CALL:
+			case CEE_CALLVIRT:
+			case CEE_NEWOBJ:
+				{
+					MethodBody* callee = methods.BinarySearchKey(ReadInt32(operand));
+					if (callee == nullptr)
+					{
+						// We don't know how many arguments it takes
+						return true;
+					}
+
+					int argumentCount = callee->NumberOfArguments();
+					int firstArgument = 0;
+					if (opcode == CEE_NEWOBJ)
+					{
+						// The this pointer is not on the stack
+						firstArgument = 1;
+					}
+
+					for (int i = argumentCount - 1; i >= firstArgument; i--)
+					{
+						if (!POP())
+						{
+							continue;
+						}
+
+						if (prefixed || (callee->MethodFlags() & (byte)MethodFlags::Synchronized) ||
+							(opcode == CEE_CALLVIRT && (callee->MethodFlags() & (byte)MethodFlags::Virtual)) ||
+							Escapes(callee, -1, i, methods, depth + 1))
+						{
+							return true;
+						}
+					}
+
+					if (opcode == CEE_NEWOBJ)
+					{
+						if (pc == sourcePc)
+						{
+							// This is the allocation we're looking at. The ctor must not leak its this pointer either.
+							if ((callee->MethodFlags() & (byte)MethodFlags::Synchronized) || Escapes(callee, -1, 0, methods, depth + 1))
+							{
+								return true;
+							}
+							PUSH(1);
+						}
+						else
+						{
+							PUSH(0);
+						}
+					}
+					else if (ReturnsValue(callee))
+					{
+						PUSH(0);
+					}
+				}
+				break;
+			default:
+				{
+					// Any other use lets the object escape
+					byte pops = pgm_read_byte(StackPops + opcode);
+					byte pushes = pgm_read_byte(StackPushes + opcode);
+					if (pops == VAR_STACK_EFFECT || pushes == VAR_STACK_EFFECT)
+					{
+						// i.e. calli or jmp
+						return true;
+					}
+
+					for (int i = 0; i < pops; i++)
+					{
+						if (POP())
+						{
+							return true;
+						}
+					}
+
+					for (int i = 0; i < pushes; i++)
+					{
+						PUSH(0);
+					}
+
+					unconditionalBranch = opcode == CEE_THROW || opcode == CEE_RETHROW || opcode == CEE_ENDFINALLY || opcode == CEE_ENDFILTER;
+				}
+				break;
+			}
+
+			if (conditionalBranch || unconditionalBranch)
+			{
+				// The object must not be on the stack when the control flow merges, because we don't follow the branches
+				for (int i = 0; i < stackDepth; i++)
+				{
+					if (stack[i])
+					{
+						return true;
+					}
+				}
+			}
+
+			if (unconditionalBranch)
+			{
+				// The following instruction is only reached by branches, which never carry the object on the stack
+				stackDepth = 0;
+			}
+
+			prefixed = false;
+			pc += len;
+		}
+
+		if (!changed)
+		{
+			return false;
+		}
+	}
+
+#undef POP
+#undef PUSH
+	// Didn't converge
+	return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <ConfigurableFirmata.h>
+#include "ObjectVector.h"
+#include "MethodBody.h"
+#include "MemoryManagement.h"
+
+// How deep calls are followed to find out whether an object passed as argument escapes
+#define ESCAPE_ANALYSIS_MAX_DEPTH 3
+// Larger objects are always allocated from the GC heap, so they don't fill up the frame arena
+#define MAX_STACK_OBJECT_SIZE 64
+
+/// <summary>
+/// The newobj instructions of one method that create objects which never leave the method (they're not stored in a field,
+/// returned, thrown or passed to a method where they might escape). These objects can be allocated in the frame of the method.
+/// </summary>
+class MethodEscapeInfo
+{
+public:
+	MethodEscapeInfo(int32_t methodToken)
+	{
+		MethodToken = methodToken;
+		Sites = nullptr;
+		Count = 0;
+	}
+
+	~MethodEscapeInfo()
+	{
+		freeEx(Sites);
+		Count = 0;
+	}
+
+	uint32_t GetKey() const
+	{
+		return MethodToken;
+	}
+
+	/// <summary>
+	/// True if the object created by the newobj instruction at the given IL offset does not escape
+	/// </summary>
+	bool IsStackAllocatable(uint16_t pc) const
+	{
+		for (uint16_t i = 0; i < Count; i++)
+		{
+			if (Sites[i] == pc)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	int32_t MethodToken;
+	// IL offsets of the newobj instructions, ascending
+	uint16_t* Sites;
+	uint16_t Count;
+};
+
+/// <summary>
+/// Finds the object allocations whose result does not escape the allocating method. Methods are analyzed when they first
+/// create an object, the results are kept sorted by method token. Must be cleared whenever the method list changes.
+/// The analysis is conservative: Anything it doesn't understand (including virtual calls and natives) lets the object escape.
+/// Allocations within loops are never moved to the frame, since their memory would only be released when the method returns.
+/// </summary>
+class EscapeAnalysis
+{
+private:
+	stdSimple::vector<MethodEscapeInfo*> _methods;
+	uint32_t _stackAllocatableSites;
+public:
+	EscapeAnalysis()
+	{
+		_stackAllocatableSites = 0;
+	}
+
+	~EscapeAnalysis()
+	{
+		clear();
+	}
+
+	/// <summary>
+	/// Returns the escape information for the given method, or null if it was not analyzed yet
+	/// </summary>
+	const MethodEscapeInfo* FindEscapeInfo(int32_t methodToken);
+
+	/// <summary>
+	/// Adds the result of Analyze and returns it. If the method was already added, the new result is deleted and the
+	/// existing one is returned.
+	/// </summary>
+	const MethodEscapeInfo* AddEscapeInfo(MethodEscapeInfo* info);
+
+	/// <summary>
+	/// Analyzes the allocations of the given method. Doesn't access the cache, so it can run without holding a lock.
+	/// </summary>
+	static MethodEscapeInfo* Analyze(MethodBody* method, SortedMethodList& methods);
+
+	void clear();
+
+	size_t size()
+	{
+		return _methods.size();
+	}
+
+	/// <summary>
+	/// The number of newobj instructions found to be stack allocatable in all methods analyzed so far
+	/// </summary>
+	uint32_t StackAllocatableSites() const
+	{
+		return _stackAllocatableSites;
+	}
+
+private:
+	static bool IsInLoop(MethodBody* method, uint16_t sitePc);
+	static bool Escapes(MethodBody* method, int32_t sourcePc, int argument, SortedMethodList& methods, int depth);
+	static bool Escapes(MethodBody* method, int32_t sourcePc, SortedMethodList& methods, int depth, byte* stack, byte* locals, byte* arguments);
+};
@@ -85,8 +85,21 @@ FirmataIlExecutor::FirmataIlExecutor()
 
 	_stringHeapRam = nullptr;
 	_stringHeapRamSize = 0;
+	_stringHeapRamUsed = 0;
 	_stringHeapFlash = nullptr;
+	_stringDirectoryFlash = nullptr;
+	_stringDirectoryFlashCount = 0;
 	_instructionsExecuted = 0;
+	_decodedInstructionsExecuted = 0;
+	_callSiteCacheHits = 0;
+	_callSiteCacheMisses = 0;
+	_instructionsQuickened = 0;
+	_quickeningGuardFailures = 0;
+	_locksInflated = 0;
+	_stackAllocations = 0;
+	_tailCalls = 0;
+	memset(_superinstructionsExecuted, 0, sizeof(_superinstructionsExecuted));
+	_executionEngine = DEFAULT_EXECUTION_ENGINE;
 	_startupToken = 0;
 	_startupFlags = 0;
 	_startedFromFlash = false;
@@ -100,8 +113,13 @@ FirmataIlExecutor::FirmataIlExecutor()
 	_commandsToSkip = 0;
 	_lastError = 0;
 	_breakOnException = false;
-	_nextLookup = 0;
-	_lastThreadRun = 0;
+	for (int i = 0; i < NUMBER_OF_EXECUTION_CORES; i++)
+	{
+		_lastThreadRun[i] = 0;
+	}
+	_dualCoreActive = false;
+	_schedulerMode = DEFAULT_SCHEDULER_MODE;
+	_timeSliceMicros = DEFAULT_TIME_SLICE_MICROS;
 	_debuggingThread = -1;
 }
 
@@ -110,22 +128,16 @@ void FirmataIlExecutor::ClearHandles()
 	for (int i = 0; i < MAX_THREADS; i++)
 	{
 		_threads[i] = nullptr;
+		_timerQueue[i] = nullptr;
 	}
 
-	for (int i = 0; i < MAX_LOCKS; i++)
-	{
-		_activeLocks[i] = MonitorLock();
-	}
+	_timerQueueCount = 0;
+	_activeLocks.clear(true);
 
 	for (int i = 0; i < MAX_HANDLES; i++)
 	{
 		_waitHandles[i] = EventWaitHandle();
 	}
-
-	for (int i = 0; i < CACHE_LINES; i++)
-	{
-		_fieldLookupCache[i] = FieldLookupCacheEntry();
-	}
 }
 
 bool FirmataIlExecutor::AutoStartProgram()
@@ -153,7 +165,7 @@ bool FirmataIlExecutor::AutoStartProgram()
 		// There's a problem: Because we're writing full objects to flash (including the vtable pointer), updating the firmware almost always
 		// invalidates the program, causing this line to cause a core dump, because the virtual method calls fail.
 		// We should somehow validate that the program matches the current firmware.
-		ExecutionState* rootState = new ExecutionState(0, method->MaxExecutionStack(), method);
+		ExecutionState* rootState = ExecutionState::Create(nullptr, 0, method);
 		if (rootState == nullptr)
 		{
 			Firmata.sendString(F("Out of memory starting application"));
@@ -162,6 +174,8 @@ bool FirmataIlExecutor::AutoStartProgram()
 		}
 		
 		_instructionsExecuted = 0;
+		_decodedInstructionsExecuted = 0;
+		memset(_superinstructionsExecuted, 0, sizeof(_superinstructionsExecuted));
 		_taskStartTime = millis();
 
 		if (!InitializeMainThread(rootState))
@@ -201,9 +215,9 @@ void FirmataIlExecutor::Init()
 
 	size_t memToPreallocate = MIN(freeMemory() / 2, 128 * 1024);
 	
-	void* classes, *methods, *constants, *stringHeap, *clauses;
+	void* classes, *methods, *constants, *stringHeap, *stringDirectory, *clauses, *fieldIndex;
 	int* specialTokens;
-	_flashMemoryManager->Init(classes, methods, constants, stringHeap, specialTokens, clauses, _startupToken, _startupFlags, _staticVectorMemorySize);
+	_flashMemoryManager->Init(classes, methods, constants, stringHeap, stringDirectory, specialTokens, clauses, fieldIndex, _startupToken, _startupFlags, _staticVectorMemorySize);
 
 	if (classes == nullptr)
 	{
@@ -216,7 +230,10 @@ void FirmataIlExecutor::Init()
 	_methods.ReadListFromFlash(methods);
 	_constants.ReadListFromFlash(constants);
 	_clauses.ReadListFromFlash(clauses);
+	_clauseTables.clear();
+	_fieldIndex.ReadFromFlash(fieldIndex);
 	_stringHeapFlash = (byte*)stringHeap;
+	ReadStringDirectoryFromFlash(stringDirectory);
 	_specialTypeListFlash = specialTokens;
 	if (_startupToken != 0)
 	{
@@ -231,14 +248,17 @@ void FirmataIlExecutor::handleCapability(byte pin)
 	if (pin == 1)
 	{
 		// In simulation, re-read the flash after a reset, to emulate a board reset.
-		void* classes, * methods, * constants, * stringHeap, * clauses;
+		void* classes, * methods, * constants, * stringHeap, * stringDirectory, * clauses, * fieldIndex;
 		int* specialTokenList;
-		_flashMemoryManager->Init(classes, methods, constants, stringHeap, specialTokenList, clauses, _startupToken, _startupFlags, _staticVectorMemorySize);
+		_flashMemoryManager->Init(classes, methods, constants, stringHeap, stringDirectory, specialTokenList, clauses, fieldIndex, _startupToken, _startupFlags, _staticVectorMemorySize);
 		_classes.ReadListFromFlash(classes);
 		_methods.ReadListFromFlash(methods);
 		_constants.ReadListFromFlash(constants);
 		_clauses.ReadListFromFlash(clauses);
+		_clauseTables.clear();
+		_fieldIndex.ReadFromFlash(fieldIndex);
 		_stringHeapFlash = (byte*)stringHeap;
+		ReadStringDirectoryFromFlash(stringDirectory);
 		_specialTypeListFlash = specialTokenList;
 	}
 #endif
@@ -468,13 +488,21 @@ boolean FirmataIlExecutor::handleSysex(byte command, byte argc, byte* argv)
 				_startupFlags = 0;
 				_flashMemoryManager->Clear();
 				_gc.Clear(true, true);
+				_stringLiterals.clear(true);
+				_decodedMethods.clear();
+				_escapeAnalysis.clear();
+				_fieldIndex.clear(true);
 				_classes.clear(true);
 				_methods.clear(true);
 				_constants.clear(true);
 				_clauses.clear(true);
+				_clauseTables.clear();
 				_stringHeapFlash = nullptr;
 				freeEx(_stringHeapRam);
 				_stringHeapRamSize = 0;
+				_stringHeapRamUsed = 0;
+				_stringDirectoryRam.clear(true);
+				ReadStringDirectoryFromFlash(nullptr);
 				_startupToken = 0;
 				
 				_specialTypeListFlash = nullptr;
@@ -506,10 +534,15 @@ boolean FirmataIlExecutor::handleSysex(byte command, byte argc, byte* argv)
 				{
 				FirmataStatusLed::FirmataStatusLedInstance->setStatus(STATUS_LOADING_PROGRAM, 500);
 					// Copy all members currently in ram to flash
-				_classes.CopyContentsToFlash(_flashMemoryManager);
+				_decodedMethods.clear();
+				_escapeAnalysis.clear();
+				// The methods go first, so that the dispatch tables of the classes can point to their final location
 				_methods.CopyContentsToFlash(_flashMemoryManager);
+				_classes.CopyContentsToFlash(_flashMemoryManager, &_methods);
+				_fieldIndex.Invalidate();
 				_constants.CopyContentsToFlash(_flashMemoryManager);
 				_clauses.CopyContentsToFlash(_flashMemoryManager);
+				_clauseTables.clear();
 				}
 				SendAckOrNack(subCommand, sequenceNo, ExecutionError::None);
 				break;
@@ -521,6 +554,8 @@ boolean FirmataIlExecutor::handleSysex(byte command, byte argc, byte* argv)
 				void* methodsPtr = _methods.CopyListToFlash(_flashMemoryManager);
 				void* constantPtr = _constants.CopyListToFlash(_flashMemoryManager);
 				void* clausesPtr = _clauses.CopyListToFlash(_flashMemoryManager);
+				void* fieldIndexPtr = _fieldIndex.CopyToFlash(_flashMemoryManager, _classes);
+				void* stringDirectoryPtr = CopyStringDirectoryToFlash();
 				void* stringPtr = CopyStringsToFlash();
 				int* specialTokenListPtr = CopySpecialTokenListToFlash();
 				_startupToken = DecodePackedUint32(argv + 2 + 10);
@@ -530,7 +565,7 @@ boolean FirmataIlExecutor::handleSysex(byte command, byte argc, byte* argv)
 				_methods.ValidateListOrder();
 				_constants.ValidateListOrder();
 				_flashMemoryManager->WriteHeader(DecodePackedUint32(argv + 2), DecodePackedUint32(argv + 2 + 5), classesPtr, methodsPtr, constantPtr, stringPtr,
-					specialTokenListPtr, clausesPtr, _startupToken, _startupFlags, _staticVectorMemorySize);
+					stringDirectoryPtr, specialTokenListPtr, clausesPtr, fieldIndexPtr, _startupToken, _startupFlags, _staticVectorMemorySize);
 
 				// Reset this flag after programming, or we'll immediately start executing code if there was _any_ valid program in flash when the CPU started.
 				_startedFromFlash = false;
@@ -560,6 +595,12 @@ boolean FirmataIlExecutor::handleSysex(byte command, byte argc, byte* argv)
 						debuggerArg2 = DecodePackedUint32(argv + 2 + 10);
 					}
 
+				if (debuggerCommand >= (uint32_t)EngineCommand::First)
+				{
+					SendAckOrNack(subCommand, sequenceNo, ExecuteEngineCommand((EngineCommand)debuggerCommand, debuggerArg1, debuggerArg2));
+					break;
+				}
+
 				SendAckOrNack(subCommand, sequenceNo, ExecuteDebuggerCommand(_threads[0] ? _threads[0]->rootOfExecutionStack : nullptr, (DebuggerCommand)debuggerCommand, debuggerArg1, debuggerArg2));
 				}
 				break;
@@ -610,6 +651,7 @@ ExecutionError FirmataIlExecutor::LoadExceptionClause(int methodToken, int claus
 	clause->HandlerLength = (uint16_t)handlerLength;
 	clause->FilterToken = exceptionFilterToken;
 	_clauses.Insert(clause);
+	_clauseTables.clear();
 	return ExecutionError::None;
 }
 
@@ -629,12 +671,50 @@ void* FirmataIlExecutor::CopyStringsToFlash()
 		freeEx(_stringHeapRam);
 		_stringHeapRam = nullptr;
 		_stringHeapRamSize = 0;
+		_stringHeapRamUsed = 0;
 	}
 	
 	_stringHeapFlash = target;
 	return target;
 }
 
+/// <summary>
+/// Copies the directory of the string heap to flash. Must be called before CopyStringsToFlash, which discards the RAM heap.
+/// The offsets in the directory are relative to the heap, so they remain valid.
+/// </summary>
+void* FirmataIlExecutor::CopyStringDirectoryToFlash()
+{
+	if (_stringDirectoryFlash != nullptr)
+	{
+		throw ExecutionEngineException("String directory already written");
+	}
+
+	int size = _stringDirectoryRam.size();
+	void* target = _flashMemoryManager->FlashAlloc(size * sizeof(StringHeapEntry) + sizeof(int));
+	_flashMemoryManager->CopyToFlash(&size, target, sizeof(int), "FirmataIlExecutor::CopyStringDirectoryToFlash::size");
+	if (size > 0)
+	{
+		_flashMemoryManager->CopyToFlash(&_stringDirectoryRam.at(0), AddBytes(target, sizeof(int)), size * sizeof(StringHeapEntry), "FirmataIlExecutor::CopyStringDirectoryToFlash::content");
+	}
+
+	_stringDirectoryRam.clear(true);
+	ReadStringDirectoryFromFlash(target);
+	return target;
+}
+
+void FirmataIlExecutor::ReadStringDirectoryFromFlash(void* flashAddress)
+{
+	if (flashAddress == nullptr)
+	{
+		_stringDirectoryFlash = nullptr;
+		_stringDirectoryFlashCount = 0;
+		return;
+	}
+
+	_stringDirectoryFlashCount = *((int*)flashAddress);
+	_stringDirectoryFlash = (StringHeapEntry*)AddBytes(flashAddress, sizeof(int));
+}
+
 int* FirmataIlExecutor::CopySpecialTokenListToFlash()
 {
 	if (_specialTypeListFlash != nullptr)
@@ -659,43 +739,20 @@ int* FirmataIlExecutor::CopySpecialTokenListToFlash()
 
 char* FirmataIlExecutor::GetString(int stringToken, int& length)
 {
-	byte* ret = GetString(_stringHeapRam, stringToken, length);
-	if (ret == nullptr)
-	{
-		ret = GetString(_stringHeapFlash, stringToken, length);
-	}
-
-	if (ret == nullptr)
-	{
-		throw ClrException(SystemException::NotSupported, stringToken);
-	}
-	
-	return reinterpret_cast<char*>(ret);
-}
-
-byte* FirmataIlExecutor::GetString(byte* heap, int stringToken, int& length)
-{
-	if (heap == nullptr)
-	{
-		return nullptr;
-	}
-
-	int* tokenPtr = (int*)heap;
-	int token = *tokenPtr;
 	length = stringToken & 0xFFFF;
-	while (token != 0 && token != stringToken)
+	const StringHeapEntry* entry = stdSimple::BinarySearch(_stringDirectoryRam.begin(), _stringDirectoryRam.size(), stringToken);
+	if (entry != nullptr)
 	{
-		int len = token & 0xFFFF;
-		tokenPtr = AddBytes(tokenPtr, len + 4); // Including the token itself
-		token = *tokenPtr;
+		return reinterpret_cast<char*>(AddBytes(_stringHeapRam, entry->Offset));
 	}
 
-	if (token == stringToken)
+	entry = stdSimple::BinarySearch(_stringDirectoryFlash, _stringDirectoryFlashCount, stringToken);
+	if (entry != nullptr)
 	{
-		return (byte*)AddBytes(tokenPtr, 4);
+		return reinterpret_cast<char*>(AddBytes(_stringHeapFlash, entry->Offset));
 	}
 
-	return nullptr;
+	throw ClrException(SystemException::NotSupported, stringToken);
 }
 
 /// <summary>
@@ -712,6 +769,8 @@ ExecutionError FirmataIlExecutor::PrepareStringLoad(uint32_t constantSize, uint3
 		_stringHeapRam = nullptr;
 		_stringHeapRamSize = 0;
 	}
+	_stringHeapRamUsed = 0;
+	_stringDirectoryRam.clear(true);
 	if (stringListSize > 0)
 	{
 		_stringHeapRamSize = stringListSize;
@@ -772,20 +831,30 @@ ExecutionError FirmataIlExecutor::LoadConstant(ExecutorCommand executorCommand,
 		{
 			return ExecutionError::InvalidArguments;
 		}
-		int* tokenPtr = (int*)_stringHeapRam;
-		int token = *tokenPtr;
-		while (token != 0 && (uint32_t)token != constantToken)
+		int* tokenPtr;
+		const StringHeapEntry* entry = stdSimple::BinarySearch(_stringDirectoryRam.begin(), _stringDirectoryRam.size(), constantToken);
+		if (entry != nullptr)
 		{
-			int len = token & 0xFFFF;
-			tokenPtr = AddBytes(tokenPtr, len + 4); // Including the token itself
-			token = *tokenPtr;
+			// Another part of a string we have already seen
+			tokenPtr = (int*)AddBytes(_stringHeapRam, entry->Offset - sizeof(int));
 		}
-		if (tokenPtr > (int*)AddBytes(_stringHeapRam, _stringHeapRamSize - currentEntryLength))
+		else
 		{
-			OutOfMemoryException::Throw("String Heap not large enough");
+			// A new string: Append it to the heap
+			if (_stringHeapRamUsed + sizeof(int) + currentEntryLength > _stringHeapRamSize)
+			{
+				OutOfMemoryException::Throw("String Heap not large enough");
+			}
+
+			tokenPtr = (int*)AddBytes(_stringHeapRam, _stringHeapRamUsed);
+			*tokenPtr = constantToken;
+			StringHeapEntry newEntry;
+			newEntry.Token = constantToken;
+			newEntry.Offset = _stringHeapRamUsed + sizeof(int);
+			_stringDirectoryRam.insert(stdSimple::LowerBound(_stringDirectoryRam.begin(), _stringDirectoryRam.size(), constantToken), newEntry);
+			_stringHeapRamUsed += sizeof(int) + currentEntryLength;
 		}
-		
-		*tokenPtr = constantToken;
+
 		int numToDecode = num7BitOutbytes(argc);
 		data = (char*)AddBytes(tokenPtr, 4 + offset);
 		Encoder7BitClass::readBinary(numToDecode, argv, (byte*)data);
@@ -829,16 +898,13 @@ ExecutionError FirmataIlExecutor::LoadConstant(ExecutorCommand executorCommand,
 /// </summary>
 byte* FirmataIlExecutor::GetConstant(int token)
 {
-	for (auto iterator = _constants.GetIterator(); iterator.Next();)
+	ConstantEntry* entry = _constants.BinarySearchKey(token);
+	if (entry == nullptr)
 	{
-		int* currentWithHeader = (int*)iterator.Current();
-		if (*currentWithHeader == token)
-		{
-			return (byte*)AddBytes(currentWithHeader, 2 * sizeof(int));
-		}
+		return nullptr;
 	}
 
-	return nullptr;
+	return (byte*)&entry->DataStart;
 }
 
 /// <summary>
@@ -881,7 +947,10 @@ bool FirmataIlExecutor::IsExecutingCode()
 
 byte* FirmataIlExecutor::AllocGcInstance(size_t bytes)
 {
-	byte* ret = _gc.Allocate(bytes, this);
+	ScopeLock lk;
+	// With two cores, the collector can only run at the end of a slice, so don't let the allocation trigger it.
+	// The allocation then gets a new memory block instead.
+	byte* ret = _gc.Allocate(bytes, _dualCoreActive ? nullptr : this);
 	if (ret != nullptr)
 	{
 		// The runtime guarantees that new object instances are zeroed out. There are some flags to remove that
@@ -927,18 +996,24 @@ void FirmataIlExecutor::KillCurrentTask()
 	_commandsToSkip = 0;
 	_lastError = 0;
 	_breakOnException = false;
-	_lastThreadRun = 0;
+	for (int i = 0; i < NUMBER_OF_EXECUTION_CORES; i++)
+	{
+		_lastThreadRun[i] = 0;
+	}
 	_debuggingThread = -1;
 	SetMemoryExecutionMode(false);
 }
 
 void FirmataIlExecutor::TerminateAllThreads()
 {
+	// The second core must not be executing any of the threads we delete
+	_world.StopTheWorld(false);
 	for (int i = 0; i < MAX_THREADS; i++)
 	{
 		// Kill all threads
 		CleanStack(i);
 	}
+	_world.ResumeTheWorld(false);
 }
 
 void FirmataIlExecutor::CleanStack(ExecutionState* state)
@@ -947,23 +1022,29 @@ void FirmataIlExecutor::CleanStack(ExecutionState* state)
 	{
 		auto previous = state;
 		state = state->_next;
-		delete previous;
+		ExecutionState::Destroy(previous);
 	}
 }
 
 void FirmataIlExecutor::CleanStack(int activeThreadId)
 {
+	// No other core may add itself to the joiners between waking them and deleting the thread
+	ScopeLock lk;
 	if (_threads[activeThreadId] == nullptr)
 	{
 		return;
 	}
 
+	RemoveFromWaitQueue(_threads[activeThreadId]);
+	RemoveFromTimerQueue(_threads[activeThreadId]);
+	WakeWaiters(&_threads[activeThreadId]->joinWaiters);
+
 	ExecutionState* state = _threads[activeThreadId]->rootOfExecutionStack;
 	while (state != nullptr)
 	{
 		auto previous = state;
 		state = state->_next;
-		delete previous;
+		ExecutionState::Destroy(previous);
 	}
 
 	delete _threads[activeThreadId];
@@ -993,7 +1074,14 @@ void FirmataIlExecutor::report(bool elapsed)
 
 	FirmataStatusLed::FirmataStatusLedInstance->setStatus(STATUS_EXECUTING_PROGRAM, 100);
 
-	int threadToSchedule = ThreadToSchedule();
+	_world.BeginSlice();
+	int threadToSchedule = ThreadToSchedule(0);
+	if (threadToSchedule < 0)
+	{
+		// All threads are blocked
+		_world.EndSlice();
+		return;
+	}
 
 	Variable retVal;
 	MethodState execResult = ExecuteIlCode(_threads[threadToSchedule], &retVal);
@@ -1001,28 +1089,22 @@ void FirmataIlExecutor::report(bool elapsed)
 	if (execResult == MethodState::Running)
 	{
 		// The method is still running
+		_world.EndSlice();
 		return;
 	}
 
-	for (int i = 0; i < MAX_LOCKS; i++)
-	{
-		if (_activeLocks[i].owningThread == _threads[threadToSchedule])
-		{
-			Firmata.sendStringf(F("Detected leaked monitor lock for thread %d"), threadToSchedule);
-			_activeLocks[i].lockCount = 0;
-			_activeLocks[i].owningThread = nullptr;
-			_activeLocks[i].object = nullptr;
-		}
-	}
+	ReleaseLocksOfThread(threadToSchedule);
 
 	// A thread other than the main thread has ended (either by itself or due to an unhandled exception)
 	if (threadToSchedule != 0)
 	{
 		Firmata.sendStringf(F("Thread %d has exited with code %d"), threadToSchedule, execResult);
 		CleanStack(threadToSchedule);
+		_world.EndSlice();
 		return;
 	}
 
+	_world.EndSlice();
 	SetMemoryExecutionMode(false);
 	int methodindex = _threads[0]->rootOfExecutionStack->TaskId();
 	SendExecutionResult(methodindex, _threads[0]->currentException, retVal, execResult);
@@ -1031,22 +1113,380 @@ void FirmataIlExecutor::report(bool elapsed)
 	TerminateAllThreads();
 }
 
-int FirmataIlExecutor::ThreadToSchedule()
+/// <summary>
+/// Releases the monitor locks a thread still holds when it ends
+/// </summary>
+void FirmataIlExecutor::ReleaseLocksOfThread(int threadId)
 {
-	int result = _lastThreadRun;
+	ScopeLock lk;
+	ThreadState* thread = _threads[threadId];
+	for (size_t i = 0; i < _activeLocks.size(); i++)
+	{
+		if (_activeLocks[i].owningThread == thread)
+		{
+			Firmata.sendStringf(F("Detected leaked monitor lock for thread %d"), threadId);
+			BlockHd* hd = _gc.HeaderOf(_activeLocks[i].object);
+			if (hd != nullptr)
+			{
+				hd->SetLockInflated(false);
+			}
+			WakeWaiters(&_activeLocks[i].waiters);
+			_activeLocks.remove(i);
+			i--;
+		}
+	}
+
+	if (thread->heldThinLocks > 0)
+	{
+		Firmata.sendStringf(F("Detected %d leaked monitor locks for thread %d"), thread->heldThinLocks, threadId);
+		_gc.ReleaseThinLocks(threadId);
+		thread->heldThinLocks = 0;
+	}
+}
+
+/// <summary>
+/// Selects the next runnable thread of the given core, round-robin. Returns -1 if all its threads are blocked.
+/// </summary>
+int FirmataIlExecutor::ThreadToSchedule(int core)
+{
+	ScopeLock lk;
+	WakeSignaledEventWaiters();
+	WakeExpiredTimers();
+	int result = _lastThreadRun[core];
 	do
 	{
 		result = (result + 1) % MAX_THREADS;
-		// Is there a started thread in that slot?
-		if (_threads[result] != nullptr && _threads[result]->rootOfExecutionStack != nullptr)
+		// Is there a started thread in that slot that is not blocked?
+		if (_threads[result] != nullptr && _threads[result]->IsRunnable() && CoreOfThread(result) == core)
 		{
-			_lastThreadRun = result;
+			_lastThreadRun[core] = result;
 			return result;
 		}
 		
-	} while (result != _lastThreadRun); // Abort when we're back at the same thread
+	} while (result != _lastThreadRun[core]); // Abort when we're back at the same thread
+
+	return -1;
+}
+
+static void SecondCoreEntry(void* executor)
+{
+	((FirmataIlExecutor*)executor)->SecondCoreLoop();
+}
+
+/// <summary>
+/// The interpreter loop of the second core. It executes the threads with odd ids, while the main loop executes the others.
+/// The main thread always stays on the main loop, so that only the main loop has to deal with the end of the program.
+/// </summary>
+void FirmataIlExecutor::SecondCoreLoop()
+{
+	while (true)
+	{
+		if (!_dualCoreActive || _debuggerEnabled || !IsExecutingCode())
+		{
+			CoreSleep();
+			continue;
+		}
+
+		_world.BeginSlice();
+		int threadToSchedule = ThreadToSchedule(1);
+		if (threadToSchedule < 0)
+		{
+			_world.EndSlice();
+			CoreSleep();
+			continue;
+		}
+
+		Variable retVal;
+		MethodState execResult = ExecuteIlCode(_threads[threadToSchedule], &retVal);
+		if (execResult != MethodState::Running)
+		{
+			ReleaseLocksOfThread(threadToSchedule);
+			CleanStack(threadToSchedule);
+		}
+		_world.EndSlice();
+	}
+}
+
+/// <summary>
+/// Enables or disables executing managed threads on the second core
+/// </summary>
+ExecutionError FirmataIlExecutor::SetDualCoreMode(bool enable)
+{
+#if MULTICORE_SUPPORT
+	if (enable == _dualCoreActive)
+	{
+		return ExecutionError::None;
+	}
+
+	if (enable)
+	{
+		// The field index, the field offsets and the hierarchy numbers are built on first use. Do that now, before two cores can use them.
+		_fieldIndex.Find(0, _classes);
+		_classes.BuildFieldOffsetTables();
+		_classes.NumberHierarchy();
+		_world.Init();
+		if (!StartSecondCore(SecondCoreEntry, this))
+		{
+			return ExecutionError::InternalError;
+		}
+	}
+
+	// This moves threads to the other core, so none of them may be executing
+	_world.StopTheWorld(false);
+	_dualCoreActive = enable;
+	_world.ResumeTheWorld(false);
+	return ExecutionError::None;
+#else
+	return enable ? ExecutionError::InvalidArguments : ExecutionError::None;
+#endif
+}
+
+/// <summary>
+/// Runs the garbage collector. With two cores, the other core is stopped at the end of its slice first, since the
+/// collector must see the stacks of all threads in a consistent state.
+/// </summary>
+void FirmataIlExecutor::CollectGarbage(int generation)
+{
+	if (_dualCoreActive)
+	{
+		// Don't stop the other core for a collection that would be skipped anyway
+		if (!_gc.CollectionRequired(generation))
+		{
+			return;
+		}
+
+		_world.StopTheWorld(true);
+		_gc.Collect(generation, this);
+		_world.ResumeTheWorld(true);
+		return;
+	}
+
+	_gc.Collect(generation, this);
+}
+
+/// <summary>
+/// Marks the thread as blocked and adds it to the given wait queue. The thread is not scheduled again until it is woken
+/// by WakeWaiters. It then retries the operation it was blocked in.
+/// </summary>
+void FirmataIlExecutor::BlockThread(ThreadState* thread, ThreadWaitReason reason, void* waitObject, ThreadState** queue)
+{
+	thread->waitReason = reason;
+	thread->waitObject = waitObject;
+	thread->nextWaiter = nullptr;
+	if (queue != nullptr)
+	{
+		thread->nextWaiter = *queue;
+		*queue = thread;
+	}
+}
+
+/// <summary>
+/// Makes all threads in the given wait queue runnable again and empties the queue
+/// </summary>
+void FirmataIlExecutor::WakeWaiters(ThreadState** queue)
+{
+	ThreadState* thread = *queue;
+	while (thread != nullptr)
+	{
+		ThreadState* next = thread->nextWaiter;
+		thread->waitReason = ThreadWaitReason::None;
+		thread->waitObject = nullptr;
+		thread->nextWaiter = nullptr;
+		thread = next;
+	}
+
+	*queue = nullptr;
+}
+
+/// <summary>
+/// Removes a blocked thread from the wait queue it is in (used when the thread is terminated)
+/// </summary>
+void FirmataIlExecutor::RemoveFromWaitQueue(ThreadState* thread)
+{
+	ThreadState** queue = nullptr;
+	switch (thread->waitReason)
+	{
+	case ThreadWaitReason::MonitorLock:
+	{
+		int lockIndex = FindInflatedLock(thread->waitObject);
+		if (lockIndex >= 0)
+		{
+			queue = &_activeLocks[lockIndex].waiters;
+		}
+	}
+		break;
+	case ThreadWaitReason::Event:
+		queue = &((EventWaitHandle*)thread->waitObject)->waiters;
+		break;
+	case ThreadWaitReason::Join:
+		queue = &((ThreadState*)thread->waitObject)->joinWaiters;
+		break;
+	default:
+		break;
+	}
+
+	while (queue != nullptr && *queue != nullptr)
+	{
+		if (*queue == thread)
+		{
+			*queue = thread->nextWaiter;
+			break;
+		}
+		queue = &(*queue)->nextWaiter;
+	}
+
+	thread->waitReason = ThreadWaitReason::None;
+	thread->waitObject = nullptr;
+	thread->nextWaiter = nullptr;
+}
+
+/// <summary>
+/// Starts a timed wait of the given thread, unless one is already running (i.e. the wait operation is being retried).
+/// The thread is woken when the deadline passes, even if it's blocked on an object.
+/// </summary>
+void FirmataIlExecutor::StartTimedWait(ThreadState* thread, int32_t timeoutMillis)
+{
+	if (thread->waitDeadline != NO_WAIT_DEADLINE)
+	{
+		return;
+	}
+
+	thread->waitDeadline = HardwareAccess::TickCount64() + timeoutMillis;
+
+	// Insert sorted. There are at most MAX_THREADS entries, since each thread can only be in one wait.
+	int i = _timerQueueCount;
+	while (i > 0 && _timerQueue[i - 1]->waitDeadline > thread->waitDeadline)
+	{
+		_timerQueue[i] = _timerQueue[i - 1];
+		i--;
+	}
+
+	_timerQueue[i] = thread;
+	_timerQueueCount++;
+}
+
+bool FirmataIlExecutor::TimedWaitExpired(ThreadState* thread) const
+{
+	return thread->waitDeadline != NO_WAIT_DEADLINE && HardwareAccess::TickCount64() >= thread->waitDeadline;
+}
+
+/// <summary>
+/// Ends the timed wait of the thread, because the wait operation completed (either successfully or because the deadline passed)
+/// </summary>
+void FirmataIlExecutor::EndTimedWait(ThreadState* thread)
+{
+	if (thread->waitDeadline == NO_WAIT_DEADLINE)
+	{
+		return;
+	}
+
+	RemoveFromTimerQueue(thread);
+	thread->waitDeadline = NO_WAIT_DEADLINE;
+}
+
+void FirmataIlExecutor::RemoveFromTimerQueue(ThreadState* thread)
+{
+	for (int i = 0; i < _timerQueueCount; i++)
+	{
+		if (_timerQueue[i] == thread)
+		{
+			for (int j = i; j < _timerQueueCount - 1; j++)
+			{
+				_timerQueue[j] = _timerQueue[j + 1];
+			}
+			_timerQueueCount--;
+			_timerQueue[_timerQueueCount] = nullptr;
+			return;
+		}
+	}
+}
+
+/// <summary>
+/// Makes the threads whose deadline has passed runnable again. They keep their deadline, so that the retried wait operation
+/// knows it timed out.
+/// </summary>
+void FirmataIlExecutor::WakeExpiredTimers()
+{
+	if (_timerQueueCount == 0)
+	{
+		return;
+	}
+
+	int64_t now = HardwareAccess::TickCount64();
+	int expired = 0;
+	while (expired < _timerQueueCount && _timerQueue[expired]->waitDeadline <= now)
+	{
+		RemoveFromWaitQueue(_timerQueue[expired]);
+		expired++;
+	}
+
+	if (expired == 0)
+	{
+		return;
+	}
+
+	for (int i = expired; i < _timerQueueCount; i++)
+	{
+		_timerQueue[i - expired] = _timerQueue[i];
+	}
+
+	_timerQueueCount -= expired;
+	for (int i = _timerQueueCount; i < _timerQueueCount + expired; i++)
+	{
+		_timerQueue[i] = nullptr;
+	}
+}
+
+/// <summary>
+/// Wait handles can be signaled directly from managed code, therefore we check them here. This is much cheaper
+/// than giving each waiting thread a time slice to find out that it's still waiting.
+/// </summary>
+void FirmataIlExecutor::WakeSignaledEventWaiters()
+{
+	for (int i = 0; i < MAX_HANDLES; i++)
+	{
+		if (_waitHandles[i].signaled && _waitHandles[i].waiters != nullptr)
+		{
+			WakeWaiters(&_waitHandles[i].waiters);
+		}
+	}
+}
+
+int FirmataIlExecutor::RunnableThreadCount(int core)
+{
+	ScopeLock lk;
+	int count = 0;
+	for (int i = 0; i < MAX_THREADS; i++)
+	{
+		if (_threads[i] != nullptr && _threads[i]->IsRunnable() && CoreOfThread(i) == core)
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/// <summary>
+/// Returns the length of the next time slice on the given core in microseconds. The configured time is shared among the runnable threads,
+/// so that each thread gets its turn within that time. On the main loop, the slice is shortened further when the host has sent data, so that
+/// it gets processed soon.
+/// </summary>
+uint32_t FirmataIlExecutor::CurrentTimeSlice(int core)
+{
+	uint32_t slice = _timeSliceMicros;
+	int runnable = RunnableThreadCount(core);
+	if (runnable > 1)
+	{
+		slice /= runnable;
+	}
+
+	if (core == 0 && Firmata.available() > 0)
+	{
+		slice /= 4;
+	}
 
-	return _lastThreadRun;
+	return MAX(slice, MIN_TIME_SLICE_MICROS);
 }
 
 
@@ -1144,6 +1584,8 @@ ExecutionError FirmataIlExecutor::LoadIlDataStream(int methodToken, uint16_t cod
 
 	if (offset == 0)
 	{
+		_decodedMethods.clear();
+		_escapeAnalysis.clear();
 		if (method->_methodIl != nullptr)
 		{
 			freeEx(method->_methodIl);
@@ -1268,6 +1710,10 @@ void FirmataIlExecutor::SendExecutionResult(int32_t codeReference, RuntimeExcept
 	{
 		int32_t troughput = _instructionsExecuted / (delta / 1000);
 		Firmata.sendStringf(F("Executed %d instructions in %dms (%d instructions/second)"), _instructionsExecuted, delta, troughput);
+		if (_decodedInstructionsExecuted > 0)
+		{
+			Firmata.sendStringf(F("Of these, %d instructions were executed by the pre-decoded engine"), _decodedInstructionsExecuted);
+		}
 	}
 }
 
@@ -1288,12 +1734,13 @@ bool FirmataIlExecutor::InitializeMainThread(ExecutionState* rootState)
 	if (thread == nullptr)
 	{
 		Firmata.sendString(F("Out of memory allocating thread"));
-		delete rootState;
+		ExecutionState::Destroy(rootState);
 		FirmataStatusLed::FirmataStatusLedInstance->setStatus(STATUS_ERROR, 5000);
 		return false;
 	}
 
 	thread->rootOfExecutionStack = rootState;
+	thread->innermostFrame = rootState;
 	_threads[0] = thread;
 	// If the class "Thread" is not available, we hopefully don't need it.
 	void* ptr = CreateInstanceOfClass((int)KnownTypeTokens::Thread, 0, false);
@@ -1319,12 +1766,14 @@ ExecutionError FirmataIlExecutor::DecodeParametersAndExecute(int methodToken, in
 	}
 
 	TRACE(Firmata.sendStringf(F("Code execution for %d starts. Stack Size is %d."), methodToken, method->MaxExecutionStack()));
-	ExecutionState* rootState = new ExecutionState(taskId, method->MaxExecutionStack(), method);
+	ExecutionState* rootState = ExecutionState::Create(nullptr, taskId, method);
 	if (rootState == nullptr)
 	{
 		OutOfMemoryException::Throw("Out of memory starting task");
 	}
 	_instructionsExecuted = 0;
+	_decodedInstructionsExecuted = 0;
+	memset(_superinstructionsExecuted, 0, sizeof(_superinstructionsExecuted));
 	_taskStartTime = millis();
 
 	InitializeMainThread(rootState);
@@ -1575,12 +2024,15 @@ TriStateBool FirmataIlExecutor::MonitorWait(ThreadState* currentThread, void* ob
 	bool lockReturned = MonitorExit(currentThread, object, false);
 	if (lockReturned)
 	{
+		if (timeout >= 0)
+		{
+			StartTimedWait(currentThread, timeout);
+		}
+
 		// The first time, always yield (otherwise, we would certainly get the lock back immediately)
 		return TriStateBool::Neither;
 	}
 
-	// We do not consider the timeout here, because this wouldn't help if we get here repeatedly, unless we
-	// use some external storage to store this lock state.
 	TriStateBool intermediate = MonitorTryEnter(currentThread, object, -1);
 	if (intermediate == TriStateBool::Neither)
 	{
@@ -1588,94 +2040,175 @@ TriStateBool FirmataIlExecutor::MonitorWait(ThreadState* currentThread, void* ob
 		return intermediate;
 	}
 
-	if (timeout >= 0 && timeout < 5)
+	// We got the lock back. Report whether that happened within the timeout.
+	bool timedOut = TimedWaitExpired(currentThread);
+	EndTimedWait(currentThread);
+	return timedOut ? TriStateBool::False : TriStateBool::True;
+}
+
+/// <summary>
+/// Returns the index of the inflated lock of the given object, -1 if there is none
+/// </summary>
+int FirmataIlExecutor::FindInflatedLock(void* object)
+{
+	for (size_t i = 0; i < _activeLocks.size(); i++)
 	{
-		// Workaround, so that there are cases when this returns false, if the timeout is externally decremented on each loop.
-		return TriStateBool::False;
+		if (_activeLocks[i].object == object)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/// <summary>
+/// Moves the lock of the given object to the lock table. The header is null if the object is not on the managed heap.
+/// </summary>
+int FirmataIlExecutor::InflateLock(void* object, BlockHd* header)
+{
+	MonitorLock lock;
+	lock.object = object;
+	if (header != nullptr)
+	{
+		int owner = header->ThinLockOwner();
+		if (owner >= 0)
+		{
+			lock.owningThread = _threads[owner];
+			lock.lockCount = header->ThinLockCount();
+			_threads[owner]->heldThinLocks--;
+			header->ClearThinLock();
+		}
+
+		header->SetLockInflated(true);
+		_locksInflated++;
 	}
 
-	return TriStateBool::True;
+	return _activeLocks.push_back(lock);
 }
 
 TriStateBool FirmataIlExecutor::MonitorTryEnter(ThreadState* currentThread,
 	void* object, int timeout)
 {
 	ScopeLock lk;
-	for (int i = 0; i < MAX_LOCKS; i++)
+	BlockHd* hd = _gc.HeaderOf(object);
+	int lockIndex;
+	if (hd != nullptr && hd->IsUnlocked())
 	{
-		auto& lock = _activeLocks[i];
-		if (lock.object == object)
+		// The common case: Nobody holds the lock
+		hd->SetThinLock(currentThread->threadId, 1);
+		currentThread->heldThinLocks++;
+		if (timeout != -1)
 		{
-			if (lock.owningThread == currentThread)
-			{
-				lock.lockCount++;
-				return TriStateBool::True;
-			}
-			else
-			{
-				// There exists already a lock for this object, but from another thread -> Wait
-				int now = millis();
-				if (timeout == -1)
-				{
-					// Infinite timeout
-					return TriStateBool::Neither;
-				}
-				else if (now > lock.endTime && !(now > 0 && lock.endTime < 0))
-				{
-					// Timeout - now is larger than endtime, but not still positive when the endtime is negative (wrapparound case)
-					return TriStateBool::False;
-				}
-				else
-				{
-					// Finite timeout that has not elapsed
-					return TriStateBool::Neither;
-				}
-			}
+			// A timed TryEnter that is being retried succeeded (Monitor.Wait keeps its own deadline)
+			EndTimedWait(currentThread);
 		}
+
+		return TriStateBool::True;
 	}
 
-	for (int i = 0; i < MAX_LOCKS; i++)
+	if (hd != nullptr && !hd->IsLockInflated())
 	{
-		if (_activeLocks[i].object == nullptr)
+		int owner = hd->ThinLockOwner();
+		if (owner == currentThread->threadId && hd->ThinLockCount() < THIN_LOCK_MAX_COUNT)
 		{
-			_activeLocks[i].object = object;
-			_activeLocks[i].lockCount = 1;
-			_activeLocks[i].owningThread = currentThread;
-			_activeLocks[i].endTime = -1;
-			if (timeout > 0)
-			{
-				_activeLocks[i].endTime = millis() + timeout;
-			}
-
+			hd->SetThinLock(owner, hd->ThinLockCount() + 1);
 			return TriStateBool::True;
 		}
+
+		// Another thread holds the lock (so we need a wait queue) or the recursion is too deep for the header
+		lockIndex = InflateLock(object, hd);
+	}
+	else
+	{
+		lockIndex = FindInflatedLock(object);
+		if (lockIndex < 0)
+		{
+			lockIndex = InflateLock(object, hd);
+		}
 	}
 
-	throw ClrException("No more locks", SystemException::ExecutionEngine, 0);
+	auto& lock = _activeLocks[lockIndex];
+	if (lock.owningThread == nullptr)
+	{
+		lock.lockCount = 1;
+		lock.owningThread = currentThread;
+		if (timeout != -1)
+		{
+			EndTimedWait(currentThread);
+		}
+
+		return TriStateBool::True;
+	}
+
+	if (lock.owningThread == currentThread)
+	{
+		lock.lockCount++;
+		return TriStateBool::True;
+	}
+
+	// The lock is held by another thread -> Wait
+	if (timeout == -1)
+	{
+		// Infinite timeout: Sleep until the lock is released
+		BlockThread(currentThread, ThreadWaitReason::MonitorLock, object, &lock.waiters);
+		return TriStateBool::Neither;
+	}
+	else if (timeout == 0 || TimedWaitExpired(currentThread))
+	{
+		EndTimedWait(currentThread);
+		return TriStateBool::False;
+	}
+
+	// Finite timeout that has not elapsed: Sleep until the lock is released or the deadline passes
+	StartTimedWait(currentThread, timeout);
+	BlockThread(currentThread, ThreadWaitReason::MonitorLock, object, &lock.waiters);
+	return TriStateBool::Neither;
 }
 
 bool FirmataIlExecutor::MonitorExit(ThreadState* currentThread, void* object, bool throwIfNotOwned)
 {
 	ScopeLock lk;
-	for (int i = 0; i < MAX_LOCKS; i++)
+	BlockHd* hd = _gc.HeaderOf(object);
+	if (hd != nullptr && !hd->IsLockInflated())
+	{
+		if (hd->ThinLockOwner() == currentThread->threadId)
+		{
+			int count = hd->ThinLockCount();
+			if (count == 1)
+			{
+				hd->ClearThinLock();
+				currentThread->heldThinLocks--;
+			}
+			else
+			{
+				hd->SetThinLock(currentThread->threadId, count - 1);
+			}
+
+			return true;
+		}
+	}
+	else
 	{
-		auto& lock = _activeLocks[i];
-		if (lock.object == object)
+		int lockIndex = FindInflatedLock(object);
+		if (lockIndex >= 0 && _activeLocks[lockIndex].owningThread == currentThread)
 		{
-			if (lock.owningThread == currentThread)
+			auto& lock = _activeLocks[lockIndex];
+			lock.lockCount--;
+			if (lock.lockCount == 0)
 			{
-				lock.lockCount--;
-				if (lock.lockCount == 0)
+				// The waiting threads compete for the lock again. Since the queue is now empty, the lock can go back to the header.
+				WakeWaiters(&lock.waiters);
+				_activeLocks.remove(lockIndex);
+				if (hd != nullptr)
 				{
-					lock.owningThread = nullptr;
-					lock.object = nullptr;
-					lock.endTime = -1;
+					hd->SetLockInflated(false);
 				}
-				return true;
 			}
+			return true;
 		}
 	}
-		
+
 	if (throwIfNotOwned)
 	{
 		throw ClrException("Releasing a lock that is not owned", SystemException::InvalidOperation, 0);
@@ -1686,6 +2219,7 @@ bool FirmataIlExecutor::MonitorExit(ThreadState* currentThread, void* object, bo
 
 ThreadState* FirmataIlExecutor::FindThread(Variable& threadVar) const
 {
+	ScopeLock lk;
 	for (int i = 0; i < MAX_THREADS; i++)
 	{
 		ThreadState* t = _threads[i];
@@ -1860,7 +2394,7 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 			}
 
 			// Create the initial call stack
-			ExecutionState* rootState = new ExecutionState(threadHandle, m->MaxExecutionStack(), m);
+			ExecutionState* rootState = ExecutionState::Create(&_threads[threadHandle]->frameArena, threadHandle, m);
 			if (rootState == nullptr)
 			{
 				FirmataStatusLed::FirmataStatusLedInstance->setStatus(STATUS_ERROR, 5000);
@@ -1871,6 +2405,7 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 			rootState->SetArgumentValue(0, instance);
 			// And remember this
 			_threads[threadHandle]->rootOfExecutionStack = rootState;
+			_threads[threadHandle]->innermostFrame = rootState;
 		}
 		break;
 	case NativeMethod::ThreadJoin:
@@ -1883,35 +2418,38 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 				throw ClrException("Cannot Join on own thread", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 			}
 
+			// The other core must neither end the thread nor wake its joiners until we're in its wait queue
+			ScopeLock lk;
 			for (int i = 0; i < MAX_THREADS; i++)
 			{
 				ThreadState* t = _threads[i];
 				if (t != nullptr && t->managedThreadInstance.Object == targetThread.Object)
 				{
 					// Found the thread.
-					if (args[1].Int32 == 0)
+					if (args[1].Int32 == 0 || TimedWaitExpired(currentThread))
 					{
 						// timeout elapsed -> Return false and continue
+						EndTimedWait(currentThread);
 						result.Boolean = false;
 						return true;
 					}
 					else if (args[1].Int32 == -1) // Infinite timeout
 					{
+						BlockThread(currentThread, ThreadWaitReason::Join, t, &t->joinWaiters);
 						return false;
 					}
 					else
 					{
-						// Thread found, timeout not elapsed -> Wait and retry
-						if (args[1].Int32 > 0)
-						{
-							args[1].Int32 -= 1; // TODO: Use adequate timing
-						}
+						// Thread found, timeout not elapsed -> Wait until the thread ends or the deadline passes, then retry
+						StartTimedWait(currentThread, args[1].Int32);
+						BlockThread(currentThread, ThreadWaitReason::Join, t, &t->joinWaiters);
 						return false;
 					}
 				}
 			}
 
 			// The thread object was not found -> Return true and continue (the thread we want to join on has already ended)
+			EndTimedWait(currentThread);
 			result.Boolean = true;
 		}
 		break;
@@ -1924,6 +2462,7 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 			{
 				throw ClrException(SystemException::NullReference, currentFrame->MethodToken());
 			}
+			ScopeLock lk;
 			EventWaitHandle* handle = (EventWaitHandle*)args[0].Object;
 			if (handle->signaled)
 			{
@@ -1931,6 +2470,7 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 				{
 					handle->signaled = false;
 				}
+				EndTimedWait(currentThread);
 				result.Int32 = 0;
 				
 				return true;
@@ -1938,14 +2478,40 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 
 			if (timeout == -1)
 			{
+				BlockThread(currentThread, ThreadWaitReason::Event, handle, &handle->waiters);
 				return false;
 			}
-			if (timeout == 0)
+			if (timeout == 0 || TimedWaitExpired(currentThread))
 			{
+				EndTimedWait(currentThread);
 				result.Int32 = 0x102; // WaitTimeout
+				return true;
+			}
+
+			// The deadline is kept in the thread, since multiple threads could be waiting for the same event
+			StartTimedWait(currentThread, timeout);
+			BlockThread(currentThread, ThreadWaitReason::Event, handle, &handle->waiters);
+			return false;
+		}
+	case NativeMethod::ArduinoNativeHelpersSleepMicroseconds:
+		{
+			uint32_t micro = args[0].Uint32;
+			if (micro < MIN_BLOCKING_SLEEP_MICROS)
+			{
+				delayMicroseconds(micro);
+				break;
 			}
 
-			args[1].Int32--; // No precise timing here (can't use the handle store, because multiple threads could be waiting for the same event)
+			ScopeLock lk;
+			if (TimedWaitExpired(currentThread))
+			{
+				EndTimedWait(currentThread);
+				break;
+			}
+
+			// Let the other threads run in the meantime
+			StartTimedWait(currentThread, (micro + 999) / 1000);
+			BlockThread(currentThread, ThreadWaitReason::Sleep, nullptr, nullptr);
 			return false;
 		}
 	case NativeMethod::Interop_Kernel32CreateEventEx:
@@ -2277,16 +2843,10 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 			
 			ClassDeclaration* t2 = _classes.GetClassWithToken(otherToken.Int32);
 			
-			ClassDeclaration* parent = _classes.GetClassWithToken(t1->ParentToken, false);
-			while (parent != nullptr)
+			if (_classes.IsSubclassOf(t1, t2))
 			{
-				if (parent->ClassToken == t2->ClassToken)
-				{
-					result.Boolean = true;
-					break;
-				}
-
-				parent = _classes.GetClassWithToken(parent->ParentToken, false);
+				result.Boolean = true;
+				break;
 			}
 
 			if (t1->ImplementsInterface(t2->ClassToken))
@@ -2328,16 +2888,10 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 		ClassDeclaration* t2 = _classes.GetClassWithToken(otherToken.Int32);
 
 		// Am I a base class of the other?
-		ClassDeclaration* parent = _classes.GetClassWithToken(t2->ParentToken, false);
-		while (parent != nullptr)
+		if (_classes.IsSubclassOf(t2, t1))
 		{
-			if (parent->ClassToken == t1->ClassToken)
-			{
-				result.Boolean = true;
-				break;
-			}
-
-			parent = _classes.GetClassWithToken(parent->ParentToken, false);
+			result.Boolean = true;
+			break;
 		}
 
 		// Am I an interface the other implements?
@@ -3078,7 +3632,7 @@ bool FirmataIlExecutor::ExecuteSpecialMethod(ThreadState* currentThread, Executi
 	}
 	case NativeMethod::GcCollect:
 		ASSERT(args.size() == 4); // Has 4 args, but they mostly are for optimization purposes
-		_gc.Collect(args[0].Int32, this);
+		CollectGarbage(args[0].Int32);
 		result.Type = VariableKind::Void;
 		break;
 	case NativeMethod::GcGetTotalAllocatedBytes:
@@ -3433,45 +3987,18 @@ Variable FirmataIlExecutor::GetField(ClassDeclaration* type, const Variable& ins
 }
 
 
-void FirmataIlExecutor::SetField4(ClassDeclaration* type, const Variable& data, Variable& instance, int fieldNo)
-{
-	uint32_t offset = sizeof(void*);
-	offset += Variable::datasize() * fieldNo;
-	memcpy(((byte*)instance.Object + offset), &(data.Int64), data.fieldSize());
-}
-
-ClassDeclaration* FirmataIlExecutor::GetClassDeclaration(Variable& obj)
-{
-	byte* o = (byte*)obj.Object;
-	ClassDeclaration* vtable = (ClassDeclaration*)(*(int32_t*)o);
-	return vtable;
-}
-
-/// <summary>
-/// Gets the variable description for a field (of type Variable, because it includes the token as value)
-/// </summary>
-Variable& FirmataIlExecutor::GetVariableDescription(ClassDeclaration* vtable, int32_t token)
-{
-	if (vtable->ParentToken > 1) // Token 1 is the token of System::Object, which does not have any fields, so we don't need to go there.
-	{
-		ClassDeclaration* parent = _classes.GetClassWithToken(vtable->ParentToken);
-		Variable& v = GetVariableDescription(parent, token);
-		if (v.Type != VariableKind::Void)
-		{
-			return v;
-		}
-	}
-
-	int idx = 0;
-	for (auto handle = vtable->GetFieldByIndex(idx); handle != nullptr; handle = vtable->GetFieldByIndex(++idx))
-	{
-		if (handle->Int32 == token)
-		{
-			return *handle;
-		}
-	}
+void FirmataIlExecutor::SetField4(ClassDeclaration* type, const Variable& data, Variable& instance, int fieldNo)
+{
+	uint32_t offset = sizeof(void*);
+	offset += Variable::datasize() * fieldNo;
+	memcpy(((byte*)instance.Object + offset), &(data.Int64), data.fieldSize());
+}
 
-	return _clearVariable;
+ClassDeclaration* FirmataIlExecutor::GetClassDeclaration(Variable& obj)
+{
+	byte* o = (byte*)obj.Object;
+	ClassDeclaration* vtable = (ClassDeclaration*)(*(int32_t*)o);
+	return vtable;
 }
 
 Variable* FirmataIlExecutor::CollectFields(ClassDeclaration* vtable, VariableIterator& iterator)
@@ -3533,10 +4060,13 @@ byte* FirmataIlExecutor::Ldfld(Variable& obj, int32_t token, VariableDescription
 {
 	byte* o;
 	ClassDeclaration* vtable;
+	const FieldOffsetEntry* field;
 	int offset;
 	if (obj.Type == VariableKind::AddressOfVariable)
 	{
-		vtable = ResolveClassFromFieldToken(token);
+		const FieldIndexEntry* entry = ResolveFieldToken(token);
+		vtable = entry->Class;
+		field = entry->IsStatic() ? nullptr : &entry->Field;
 		offset = 0; // No extra header
 		o = (byte*)obj.Object; // Data being pointed to
 	}
@@ -3544,8 +4074,9 @@ byte* FirmataIlExecutor::Ldfld(Variable& obj, int32_t token, VariableDescription
 	{
 		// Ldfld from a value type needs one less indirection, but we need to get the type first.
 		// The value type does not carry the type information. Lets derive it from the field token.
-		// TODO: This is slow, not what one expects from accessing a value type
-		vtable = ResolveClassFromFieldToken(token);
+		const FieldIndexEntry* entry = ResolveFieldToken(token);
+		vtable = entry->Class;
+		field = entry->IsStatic() ? nullptr : &entry->Field;
 		offset = 0; // No extra header
 		o = (byte*)&obj.Int32; // Data is right there
 	}
@@ -3558,6 +4089,7 @@ byte* FirmataIlExecutor::Ldfld(Variable& obj, int32_t token, VariableDescription
 		}
 		
 		vtable = GetClassDeclaration(obj);
+		field = _classes.FindFieldOffset(vtable, token);
 
 		// Assuming sizeof(void*) == sizeof(any pointer type)
 		// and sizeof(void*) >= sizeof(int)
@@ -3571,27 +4103,12 @@ byte* FirmataIlExecutor::Ldfld(Variable& obj, int32_t token, VariableDescription
 		throw ClrException(SystemException::NullReference, token);
 	}
 	
-	VariableIterator it;
-	Variable* handle = nullptr;
-	while ((handle = CollectFields(vtable, it)))
+	if (field != nullptr)
 	{
-		// The type of handle1 is Variable**, because we must make sure not to use copy operations above
-		// Ignore static member here
-		if ((handle->Type & VariableKind::StaticMember) != VariableKind::Void)
-		{
-			continue;
-		}
-		
-		if (handle->Int32 == token)
-		{
-			// Found the member
-			description.Marker = VARIABLE_DEFAULT_MARKER;
-			description.Type = handle->Type;
-			description.Size = handle->fieldSize();
-			return o + offset;
-		}
-
-		offset += handle->fieldSize();
+		description.Marker = VARIABLE_DEFAULT_MARKER;
+		description.Type = field->Type;
+		description.Size = field->Size;
+		return o + offset + field->Offset;
 	}
 
 	Firmata.sendStringf(F("LDFLD: Class %lx has no field %lx"), vtable->ClassToken, token);
@@ -3609,10 +4126,13 @@ Variable FirmataIlExecutor::Ldflda(Variable& obj, int32_t token)
 {
 	byte* o;
 	ClassDeclaration* vtable;
+	const FieldOffsetEntry* field;
 	int offset;
 	if (obj.Type == VariableKind::AddressOfVariable)
 	{
-		vtable = ResolveClassFromFieldToken(token);
+		const FieldIndexEntry* entry = ResolveFieldToken(token);
+		vtable = entry->Class;
+		field = entry->IsStatic() ? nullptr : &entry->Field;
 		offset = 0; // No extra header
 		o = (byte*)obj.Object; // Data being pointed to
 	}
@@ -3620,8 +4140,9 @@ Variable FirmataIlExecutor::Ldflda(Variable& obj, int32_t token)
 	{
 		// Ldfld from a value type needs one less indirection, but we need to get the type first.
 		// The value type does not carry the type information. Lets derive it from the field token.
-		// TODO: This is slow, not what one expects from accessing a value type
-		vtable = ResolveClassFromFieldToken(token);
+		const FieldIndexEntry* entry = ResolveFieldToken(token);
+		vtable = entry->Class;
+		field = entry->IsStatic() ? nullptr : &entry->Field;
 		offset = 0; // No extra header
 		o = (byte*)&obj.Int32; // Data is right there
 	}
@@ -3634,6 +4155,7 @@ Variable FirmataIlExecutor::Ldflda(Variable& obj, int32_t token)
 		}
 
 		vtable = GetClassDeclaration(obj);
+		field = _classes.FindFieldOffset(vtable, token);
 
 		// Assuming sizeof(void*) == sizeof(any pointer type)
 		// and sizeof(void*) >= sizeof(int)
@@ -3647,34 +4169,31 @@ Variable FirmataIlExecutor::Ldflda(Variable& obj, int32_t token)
 		throw ClrException(SystemException::NullReference, token);
 	}
 
-	VariableIterator it;
-	Variable* handle = nullptr;
-	while ((handle = CollectFields(vtable, it)))
+	if (field != nullptr)
 	{
-		// Ignore static member here
-		if ((handle->Type & VariableKind::StaticMember) != VariableKind::Void)
-		{
-			continue;
-		}
-
-		if (handle->Int32 == token)
-		{
-			// Found the member
-			Variable ret;
-			ret.Marker = VARIABLE_DEFAULT_MARKER;
-			ret.Type = VariableKind::AddressOfVariable;
-			ret.setSize(4);
-			ret.Object = o + offset;
-			return ret;
-		}
-
-		offset += handle->fieldSize();
+		Variable ret;
+		ret.Marker = VARIABLE_DEFAULT_MARKER;
+		ret.Type = VariableKind::AddressOfVariable;
+		ret.setSize(4);
+		ret.Object = o + offset + field->Offset;
+		return ret;
 	}
 
 	Firmata.sendStringf(F("LDFLDA: Class %lx has no field %lx"), vtable->ClassToken, token);
 	throw ClrException(SystemException::FieldAccess, token);
 }
 
+static int CompareStaticFieldSlots(const void* a, const void* b)
+{
+	int32_t tokenA = ((const StaticFieldSlot*)a)->Token;
+	int32_t tokenB = ((const StaticFieldSlot*)b)->Token;
+	if (tokenA == tokenB)
+	{
+		return 0;
+	}
+	return tokenA < tokenB ? -1 : 1;
+}
+
 void FirmataIlExecutor::InitStaticVector()
 {
 	if (_staticVectorMemorySize == 0 || _staticVector != nullptr)
@@ -3713,6 +4232,10 @@ void FirmataIlExecutor::InitStaticVector()
 			int* token = (int*)currentPtr;
 			*token = field->Int32;
 			Variable* var = AddBytes((Variable*)currentPtr, 4);
+			StaticFieldSlot slot;
+			slot.Token = field->Int32;
+			slot.Offset = (uint32_t)((byte*)var - _staticVector);
+			_staticFieldSlots.push_back(slot);
 			var->Type = field->Type & ~VariableKind::StaticMember; // Keep the "thread static" bit
 			size_t sizeToUse = MAX(field->fieldSize(), 4);
 			var->Marker = VARIABLE_DEFAULT_MARKER;
@@ -3729,6 +4252,12 @@ void FirmataIlExecutor::InitStaticVector()
 			ASSERT(currentPtr <= _staticVector + _staticVectorMemorySize);
 		}
 	}
+
+	// The classes are sorted by token, but their fields need not be
+	if (_staticFieldSlots.size() > 1)
+	{
+		qsort(&_staticFieldSlots.at(0), _staticFieldSlots.size(), sizeof(StaticFieldSlot), CompareStaticFieldSlots);
+	}
 }
 
 /// <summary>
@@ -3791,17 +4320,10 @@ byte* FirmataIlExecutor::Ldsfld(ThreadState* thread, int token, VariableDescript
 
 Variable* FirmataIlExecutor::FindStaticField(int32_t token) const
 {
-	size_t offset = 0;
-	while (offset < _staticVectorMemorySize)
+	const StaticFieldSlot* slot = stdSimple::BinarySearch(_staticFieldSlots.begin(), _staticFieldSlots.size(), token);
+	if (slot != nullptr)
 	{
-		int currentToken = *AddBytes((int*)_staticVector, offset);
-		Variable* ptr = (Variable*)AddBytes(_staticVector, offset + sizeof(int32_t));
-		if (token == currentToken)
-		{
-			return ptr;
-		}
-
-		offset += sizeof(int32_t) + 4 + ptr->fieldSize();
+		return (Variable*)AddBytes(_staticVector, slot->Offset);
 	}
 
 	throw ClrException(SystemException::FieldAccess, token);
@@ -3888,10 +4410,13 @@ void* FirmataIlExecutor::Stfld(MethodBody* currentMethod, Variable& obj, int32_t
 {
 	ClassDeclaration* cls;
 	byte* o;
+	const FieldOffsetEntry* field;
 	int offset;
 	if (obj.Type == VariableKind::AddressOfVariable)
 	{
-		cls = ResolveClassFromFieldToken(token);
+		const FieldIndexEntry* entry = ResolveFieldToken(token);
+		cls = entry->Class;
+		field = entry->IsStatic() ? nullptr : &entry->Field;
 		offset = 0; // No extra header
 		o = (byte*)obj.Object; // Data being pointed to
 	}
@@ -3899,9 +4424,9 @@ void* FirmataIlExecutor::Stfld(MethodBody* currentMethod, Variable& obj, int32_t
 	{
 		// Stfld to a value type needs one less indirection, but we need to get the type first.
 		// The value type does not carry the type information. Lets derive it from the field token.
-		// TODO: This is slow, not what one expects from accessing a value type
-
-		cls = ResolveClassFromFieldToken(token);
+		const FieldIndexEntry* entry = ResolveFieldToken(token);
+		cls = entry->Class;
+		field = entry->IsStatic() ? nullptr : &entry->Field;
 		offset = 0; // No extra header
 		o = (byte*)&obj.Int32; // Data is right there
 	}
@@ -3911,6 +4436,7 @@ void* FirmataIlExecutor::Stfld(MethodBody* currentMethod, Variable& obj, int32_t
 		o = (byte*)obj.Object;
 		// Get the first data element of where the object points to
 		cls = ((ClassDeclaration*)(*(int32_t*)o));
+		field = _classes.FindFieldOffset(cls, token);
 		// Assuming sizeof(void*) == sizeof(any pointer type)
 		// Our members start here
 		offset = sizeof(void*);
@@ -3922,31 +4448,10 @@ void* FirmataIlExecutor::Stfld(MethodBody* currentMethod, Variable& obj, int32_t
 		return nullptr;
 	}
 	
-	VariableIterator it;
-	Variable* handle = nullptr;
-	while ((handle = CollectFields(cls, it)))
+	if (field != nullptr)
 	{
-		// Ignore static member here
-		if ((handle->Type & VariableKind::StaticMember) != VariableKind::Void)
-		{
-			continue;
-		}
-		
-		if (handle->Int32 == token)
-		{
-			// Found the member
-			memcpy(o + offset, &var.Object, handle->fieldSize());
-			return (o + offset);
-		}
-
-		if ((uint16_t)offset >= SizeOfClass(cls))
-		{
-			// Something is wrong.
-			Firmata.sendString(F("Member offset exceeds class size"));
-			break;
-		}
-		
-		offset += handle->fieldSize();
+		memcpy(o + offset + field->Offset, &var.Object, field->Size);
+		return (o + offset + field->Offset);
 	}
 
 	throw ClrException("Could not resolve field token ", SystemException::FieldAccess, token);
@@ -4118,7 +4623,7 @@ void* GetRealTargetAddress(const Variable& value)
 	throw ExecutionEngineException("Unsupported source type for indirect memory addressing");
 }
 
-void FirmataIlExecutor::ClearExecutionStack(VariableDynamicStack* stack)
+void FirmataIlExecutor::ClearExecutionStack(EvaluationStack* stack)
 {
 	while (!stack->empty())
 	{
@@ -4126,7 +4631,7 @@ void FirmataIlExecutor::ClearExecutionStack(VariableDynamicStack* stack)
 	}
 }
 
-MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFrame, uint16_t PC, VariableDynamicStack* stack, VariableVector* locals, VariableVector* arguments,
+MethodState FirmataIlExecutor::BasicStackInstructions(ThreadState* threadState, ExecutionState* currentFrame, uint16_t PC, EvaluationStack* stack, VariableVector* locals, VariableVector* arguments,
                                                       OPCODE instr, Variable& value1, Variable& value2, Variable& value3)
 {
 	Variable intermediate;
@@ -4137,12 +4642,16 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		// Throw empties the execution stack
 		ClearExecutionStack(stack);
 		ClassDeclaration* exceptionType = GetClassDeclaration(value1);
-		Variable messageField = GetField(exceptionType, value1, 0); // Message pointer
-		char* cstr = GetAsUtf8String(messageField);
 		currentFrame->UpdatePc(PC);
-		Firmata.sendStringf(F("Exception thrown at 0x%x in 0x%x: %s"), PC, currentFrame->_executingMethod->methodToken, cstr);
-		free(cstr);
-		throw CustomClrException(value1, exceptionType->ClassToken);
+		if (_debuggerEnabled)
+		{
+			// Code that uses exceptions for flow control would be slowed down a lot by always sending this
+			Variable messageField = GetField(exceptionType, value1, 0); // Message pointer
+			char* cstr = GetAsUtf8String(messageField);
+			Firmata.sendStringf(F("Exception thrown at 0x%x in 0x%x: %s"), PC, currentFrame->_executingMethod->methodToken, cstr);
+			free(cstr);
+		}
+		return RaiseException(threadState, value1, exceptionType->ClassToken);
 	}
 	case CEE_NOP:
 		break;
@@ -4217,11 +4726,11 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 
 		default:
 			Firmata.sendStringf(F("Comparing value of type %d, Value %d"), value1.Type, value1.Int32);
-			throw ClrException("Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		}
 		if (fail)
 		{
-			throw ClrException("Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		stack->push(intermediate);
 		break;
@@ -4247,11 +4756,11 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 
 		default:
 			Firmata.sendStringf(F("Comparing value of type %d, Value %d"), value1.Type, value1.Int32); 
-			throw ClrException("Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken); 
+			return RaiseException(threadState, "Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken); 
 		}
 		if (fail)
 		{
-			throw ClrException("Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		stack->push(intermediate);
 		break;
@@ -4282,11 +4791,11 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 
 		default:
 			Firmata.sendStringf(F("Comparing value of type %d, Value %d"), value1.Type, value1.Int32);
-			throw ClrException("Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		}
 		if (fail)
 		{
-			throw ClrException("Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		stack->push(intermediate);
 		break;
@@ -4312,11 +4821,11 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 
 		default:
 			Firmata.sendStringf(F("Comparing value of type %d, Value %d"), value1.Type, value1.Int32);
-			throw ClrException("Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		}
 		if (fail)
 		{
-			throw ClrException("Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer addition overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		stack->push(intermediate);
 		break;
@@ -4346,11 +4855,11 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 
 		default:
 			Firmata.sendStringf(F("Comparing value of type %d, Value %d"), value1.Type, value1.Int32);
-			throw ClrException("Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		}
 		if (fail)
 		{
-			throw ClrException("Integer multiplication overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer multiplication overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		stack->push(intermediate);
 		break;
@@ -4376,11 +4885,11 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 
 		default:
 			Firmata.sendStringf(F("Comparing value of type %d, Value %d"), value1.Type, value1.Int32);
-			throw ClrException("Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in binary operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		}
 		if (fail)
 		{
-			throw ClrException("Integer multiplication overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer multiplication overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		stack->push(intermediate);
 		break;
@@ -4392,21 +4901,21 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	case CEE_DIV:
 		if (value2.Uint64 == 0)
 		{
-			throw ClrException(SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
 		}
 
 		if (value1.Type == VariableKind::Int32)
 		{
 			if (value1.Int32 == 0x7FFFFFFF && value2.Int32 == -1)
 			{
-				throw ClrException(SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
 			}
 		}
 		else if (value1.Type == VariableKind::Int64)
 		{
 			if (value1.Int64 == 0x7FFFFFFFFFFFFFFF && value2.Int64 == -1)
 			{
-				throw ClrException(SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
 			}
 		}
 		BinaryOperation(/ );
@@ -4415,14 +4924,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	case CEE_REM:
 		if (value2.Uint64 == 0)
 		{
-			throw ClrException(SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
 		}
 		switch (value1.Type)
 		{
 		case VariableKind::Int32:
 			if (value1.Int32 == 0x7FFFFFFF && value2.Int32 == -1)
 			{
-				throw ClrException(SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
 			}
 			intermediate.Int32 = value1.Int32 % value2.Int32;
 			intermediate.Type = value1.Type;
@@ -4438,7 +4947,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		case VariableKind::Int64:
 			if (value1.Int64 == 0x7FFFFFFFFFFFFFFF && value2.Int64 == -1)
 			{
-				throw ClrException(SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::Arithmetic, currentFrame->_executingMethod->methodToken);
 			}
 			intermediate.Int64 = value1.Int64 % value2.Int64;
 			intermediate.Type = VariableKind::Int64;
@@ -4452,14 +4961,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			intermediate.Type = VariableKind::Double;
 			break;
 		default:
-			throw ClrException("Unsupported case in modulo operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken); \
+			return RaiseException(threadState, "Unsupported case in modulo operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken); \
 		}
 		stack->push(intermediate);
 		break;
 	case CEE_DIV_UN:
 		if (value2.Uint64 == 0)
 		{
-			throw ClrException(SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
 		}
 		if (value1.fieldSize() <= 4)
 		{
@@ -4476,7 +4985,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	case CEE_REM_UN:
 		if (value2.Uint64 == 0)
 		{
-			throw ClrException(SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::DivideByZero, currentFrame->_executingMethod->methodToken);
 		}
 		// Operation is not directly allowed on floating point variables by the CLR
 		if (value1.Type == VariableKind::Int32 || value1.Type == VariableKind::Uint32)
@@ -4523,7 +5032,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			intermediate.Boolean = value1.Object > value2.Object;
 			break;
 		default:
-			throw ClrException("Unsupported case in comparison operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in comparison operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		};
 		stack->push(intermediate);
 		break;
@@ -4609,7 +5118,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			intermediate.Boolean = value1.Object < value2.Object;
 			break;
 		default:
-			throw ClrException("Unsupported case in comparison operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported case in comparison operation", SystemException::InvalidOperation, currentFrame->_executingMethod->methodToken);
 		};
 		stack->push(intermediate);
 		break;
@@ -4820,7 +5329,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			uint32_t* pTarget = (uint32_t*)value1.Object;
 			if (pTarget == nullptr)
 			{
-				throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 			}
 			*pTarget = value2.Uint32;
 		}
@@ -4830,7 +5339,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			// Get the address of the array and push the array size (at index 0)
 			if (value1.Object == nullptr)
 			{
-				throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 			}
 			uint32_t* data = (uint32_t*)value1.Object;
 			intermediate.Uint32 = *(data + 1);
@@ -4844,7 +5353,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	{
 		if (value1.Object == nullptr)
 		{
-			throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 		}
 		// The instruction suffix (here .i2) indicates the element size
 		uint32_t* data = (uint32_t*)value1.Object;
@@ -4852,7 +5361,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		int32_t index = value2.Int32;
 		if (index < 0 || index >= size)
 		{
-			throw ClrException("Array Index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Array Index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 		}
 
 		// This can only be a value type (of type short or ushort)
@@ -4876,7 +5385,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	{
 		if (value1.Object == nullptr)
 		{
-			throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 		}
 		// The instruction suffix (here .i2) indicates the element size
 		uint32_t* data = (uint32_t*)value1.Object;
@@ -4884,8 +5393,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		int32_t index = value2.Int32;
 		if (index < 0 || index >= size)
 		{
-			throw ClrException("Index out of range in STELEM.I2 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
-			return MethodState::Aborted;
+			return RaiseException(threadState, "Index out of range in STELEM.I2 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 		}
 
 		// This can only be a value type (of type short or ushort)
@@ -4899,7 +5407,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	{
 		if (value1.Object == nullptr)
 		{
-			throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 		}
 		// The instruction suffix (here .i1) indicates the element size
 		uint32_t* data = (uint32_t*)value1.Object;
@@ -4907,8 +5415,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		int32_t index = value2.Int32;
 		if (index < 0 || index >= size)
 		{
-			throw ClrException("Index out of range in LDELEM.I1 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
-			return MethodState::Aborted;
+			return RaiseException(threadState, "Index out of range in LDELEM.I1 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 		}
 
 		// This can only be a value type (of type byte or sbyte)
@@ -4932,7 +5439,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	{
 		if (value1.Object == nullptr)
 		{
-			throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 		}
 		// The instruction suffix (here .i4) indicates the element size
 		uint32_t* data = (uint32_t*)value1.Object;
@@ -4940,7 +5447,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		int32_t index = value2.Int32;
 		if (index < 0 || index >= size)
 		{
-			throw ClrException("Index out of range in STELEM.I1 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Index out of range in STELEM.I1 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 		}
 
 		// This can only be a value type (of type byte or sbyte)
@@ -4954,7 +5461,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		{
 			if (value1.Object == nullptr)
 			{
-				throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 			}
 			// The instruction suffix (here .i4) indicates the element size
 			uint32_t* data = (uint32_t*)value1.Object;
@@ -4962,7 +5469,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			int32_t index = value2.Int32;
 			if (index < 0 || index >= size)
 			{
-				throw ClrException("Index out of range in LDELEM.I4 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, "Index out of range in LDELEM.I4 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 			}
 
 			// Note: Here, size of Variable is equal size of pointer, but this doesn't hold for the other LDELEM variants
@@ -4993,7 +5500,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	{
 		if (value1.Object == nullptr)
 		{
-			throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 		}
 		// The instruction suffix (here .i4) indicates the element size
 		uint32_t* data = (uint32_t*)value1.Object;
@@ -5001,7 +5508,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		int32_t index = value2.Int32;
 		if (index < 0 || index >= size)
 		{
-			throw ClrException("Index out of range in LDELEM.I8 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Index out of range in LDELEM.I8 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 		}
 
 		if (value1.Type == VariableKind::ValueArray)
@@ -5013,7 +5520,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		}
 		else
 		{
-			throw ClrException("Unsupported operation: LDELEM.i8 with a reference array", SystemException::NotSupported, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Unsupported operation: LDELEM.i8 with a reference array", SystemException::NotSupported, currentFrame->_executingMethod->methodToken);
 		}
 	}
 	break;
@@ -5022,7 +5529,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 	{
 		if (value1.Object == nullptr)
 		{
-			throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 		}
 		// The instruction suffix (here .i4) indicates the element size
 		uint32_t* data = (uint32_t*)value1.Object;
@@ -5030,7 +5537,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		int32_t index = value2.Int32;
 		if (index < 0 || index >= size)
 		{
-			throw ClrException("Index out of range in STELEM.I4 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Index out of range in STELEM.I4 operation", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 		}
 
 		if (value1.Type == VariableKind::ValueArray)
@@ -5043,7 +5550,7 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 			{
 				// STELEM.ref shall throw if the value type doesn't match the array type. We don't test the dynamic type, but
 				// at least it should be a reference
-				throw ClrException("Array type mismatch", SystemException::ArrayTypeMismatch, currentFrame->_executingMethod->methodToken);
+				return RaiseException(threadState, "Array type mismatch", SystemException::ArrayTypeMismatch, currentFrame->_executingMethod->methodToken);
 			}
 			// can only be an object now
 			*(data + ARRAY_DATA_START/4 + index) = (uint32_t)value3.Object;
@@ -5054,14 +5561,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<int8_t, true, 0, 127>(intermediate))
 		{
-			throw ClrException("Integer overflow converting to signed byte", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow converting to signed byte", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_I1_LABEL;
 
 	case CEE_CONV_OVF_I1:
 		if (!FitsIn<int8_t, true, -128, 127>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5108,13 +5615,13 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<uint8_t, false, 0, 255>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_U1_LABEL;
 	case CEE_CONV_OVF_U1:
 		if (!FitsIn<uint8_t, false, 0, 255>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5157,14 +5664,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<int16_t, true, 0, 32767>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_I2_LABEL;
 		// Fall trough
 	case CEE_CONV_OVF_I2:
 		if (!FitsIn<int16_t, true, -32768, 32767>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5211,14 +5718,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<uint16_t, false, 0, 0xFFFF>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_U2_LABEL;
 		// Fall trough
 	case CEE_CONV_OVF_U2:
 		if (!FitsIn<uint16_t, false, 0, 0xFFFF>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5262,14 +5769,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<int32_t, true, 0, 0x7FFFFFFF>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_I4_LABEL;
 		// Fall trough
 	case CEE_CONV_OVF_I4:
 		if (!FitsIn<int32_t, true, -2147483648, 2147483647>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5312,14 +5819,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<uint32_t, false, 0, 0xFFFFFFFF>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_U4_LABEL;
 		// Fall trough
 	case CEE_CONV_OVF_U4:
 		if (!FitsIn<uint32_t, false, 0, 0xFFFFFFFF>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5359,14 +5866,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<int64_t, true, 0, 9223372036854775807>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_I8_LABEL;
 		// Fall trough
 	case CEE_CONV_OVF_I8:
 		if (!FitsIn<int64_t, true, -9223372036854775807, 9223372036854775807>(value1)) // There appears to be a problem with assigning the largest negative int64 value to a constant
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5400,14 +5907,14 @@ MethodState FirmataIlExecutor::BasicStackInstructions(ExecutionState* currentFra
 		intermediate = MakeUnsigned(value1);
 		if (!FitsIn<uint64_t, true, 0, 0xFFFFFFFFFFFFFFFF>(intermediate))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		goto CEE_CONV_U8_LABEL;
 		// Fall trough
 	case CEE_CONV_OVF_U8:
 		if (!FitsIn<int64_t, true, 0, 0x7FFFFFFFFFFFFFFF>(value1))
 		{
-			throw ClrException("Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
+			return RaiseException(threadState, "Integer overflow", SystemException::Overflow, currentFrame->_executingMethod->methodToken);
 		}
 		[[fallthrough]];
 		// Fall trough
@@ -5640,6 +6147,12 @@ Variable FirmataIlExecutor::Box(Variable& value, ClassDeclaration* ty)
 /// </summary>
 bool ImplementsMethodDirectly(ClassDeclaration* cls, int32_t methodToken)
 {
+	if (cls->HasDispatchTable())
+	{
+		const DispatchEntry* entry = cls->FindDispatchEntry(methodToken);
+		return entry != nullptr && entry->Direct;
+	}
+
 	int idx = 0;
 	for (auto handle = cls->GetMethodByIndex(idx); handle != nullptr; handle = cls->GetMethodByIndex(++idx))
 	{
@@ -5764,6 +6277,637 @@ Variable FirmataIlExecutor::CreateStringInstance(size_t length, const char* stri
 	return stringVariable;
 }
 
+/// <summary>
+/// Returns the string instance for a string literal. The instance is created on first use and then reused, so that
+/// ldstr in a loop does neither allocate nor transcode.
+/// </summary>
+Variable FirmataIlExecutor::GetStringLiteral(int32_t stringToken)
+{
+	Variable stringVariable;
+	{
+		ScopeLock lk;
+		const StringLiteral* literal = stdSimple::BinarySearch(_stringLiterals.begin(), _stringLiterals.size(), stringToken);
+		if (literal != nullptr)
+		{
+			stringVariable.Type = VariableKind::Object;
+			stringVariable.Object = literal->Instance;
+			return stringVariable;
+		}
+	}
+
+	bool emptyString = (stringToken & 0xFFFF) == 0;
+	int length = 0;
+	char* string = nullptr;
+	if (!emptyString)
+	{
+		string = GetString(stringToken, length);
+	}
+
+	// This creates an unicode string (16 bits per letter) from the UTF-8 encoded constant retrieved above
+	stringVariable = CreateStringInstance(length, string);
+
+	ScopeLock lk;
+	size_t index = stdSimple::LowerBound(_stringLiterals.begin(), _stringLiterals.size(), stringToken);
+	if (index < _stringLiterals.size() && _stringLiterals[index].Token == stringToken)
+	{
+		// Another core created the literal in the meantime. Use its instance, so that there stays only one.
+		stringVariable.Object = _stringLiterals[index].Instance;
+		return stringVariable;
+	}
+
+	StringLiteral entry;
+	entry.Token = stringToken;
+	entry.Instance = stringVariable.Object;
+	_stringLiterals.insert(index, entry);
+	return stringVariable;
+}
+
+DecodedMethod* FirmataIlExecutor::GetDecodedCode(ThreadState* thread, MethodBody* method)
+{
+	if (_executionEngine != ExecutionEngineMode::PreDecoded || (method->MethodFlags() & (byte)MethodFlags::SpecialMethod))
+	{
+		return nullptr;
+	}
+
+	if (CoreOfThread(thread->threadId) != 0)
+	{
+		// The decoded methods and their inline caches are updated while they execute, therefore they're only used by the main loop
+		return nullptr;
+	}
+
+	return _decodedMethods.GetDecodedMethod(method, _methods);
+}
+
+/// <summary>
+/// Checks whether the frame of the current method can be handed over to the called method. That's not possible if the frame
+/// must do something when the method returns (release a lock or run a finally block), if any argument of the call may refer to
+/// the frame (its variables, objects allocated in it or localloc memory) or if the callee is not executed from IL code.
+/// The debugger shall see all frames, therefore tail calls are disabled while it is attached.
+/// </summary>
+bool FirmataIlExecutor::CanTailCall(ThreadState* threadState, ExecutionState* currentFrame, MethodBody* newMethod, EvaluationStack* stack)
+{
+	if (_debuggerEnabled || currentFrame == threadState->rootOfExecutionStack || currentFrame->_exceptionFrame != nullptr ||
+		currentFrame->_stackObjects != nullptr || currentFrame->_localStorage.first() != nullptr)
+	{
+		return false;
+	}
+
+	if ((currentFrame->_executingMethod->MethodFlags() & (byte)MethodFlags::Synchronized) ||
+		newMethod->_methodIl == nullptr || (newMethod->MethodFlags() & (byte)MethodFlags::SpecialMethod))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < newMethod->NumberOfArguments(); i++)
+	{
+		Variable& argument = stack->nth(i);
+		if (argument.Type == VariableKind::AddressOfVariable && currentFrame->OwnsAddress(argument.Object))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Returns the location of the field of a ldfld or stfld instruction for the given instance, or null if the access
+/// should be done by the interpreter (value types, null references and fields larger than 8 bytes)
+/// </summary>
+const FieldOffsetEntry* FirmataIlExecutor::ResolveFieldSite(FieldSite* site, Variable& obj)
+{
+	if (obj.Type != VariableKind::Object || obj.Object == nullptr)
+	{
+		return nullptr;
+	}
+
+	ClassDeclaration* cls = GetClassDeclaration(obj);
+	if (cls != site->Class)
+	{
+		const FieldOffsetEntry* field = _classes.FindFieldOffset(cls, site->Token);
+		if (field == nullptr || field->Size > sizeof(uint64_t))
+		{
+			return nullptr;
+		}
+
+		site->Class = cls;
+		site->Field = field;
+	}
+
+	return site->Field;
+}
+
+#ifdef __GNUC__
+// Use computed gotos (a gcc extension) to dispatch the pre-decoded instructions. Each handler ends with its own indirect jump
+// to the next handler, which is much easier on the branch prediction than the single jump of a switch statement.
+#define DECODED_THREADED_DISPATCH 1
+#else
+#define DECODED_THREADED_DISPATCH 0
+#endif
+
+#if DECODED_THREADED_DISPATCH
+#define DECODED_HANDLER(name) Handler_##name:
+#define DECODED_DISPATCH() goto *dispatchTable[(int)ip->Handler]
+#else
+#define DECODED_HANDLER(name) case DecodedHandler::name:
+#define DECODED_DISPATCH() goto dispatch
+#endif
+
+// Continue with the instruction ip points to, unless we've used up our budget
+#define DECODED_NEXT() \
+	if (++executed >= budget) \
+	{ \
+		goto leave; \
+	} \
+	DECODED_DISPATCH()
+
+// Fetch the two topmost stack elements. Falls back to the interpreter if value1 is not of the given type.
+#define DECODED_BINARY_OPERANDS(condition) \
+	Variable& value2 = stack->top(); \
+	Variable& value1 = stack->nth(1); \
+	if (!(condition)) \
+	{ \
+		goto leave; \
+	} \
+	stack->pop(); \
+	stack->pop();
+
+#define DECODED_INT32_OPERATION(op) \
+	{ \
+		DECODED_BINARY_OPERANDS(value1.Type == VariableKind::Int32); \
+		Variable intermediate(VariableKind::Int32); \
+		intermediate.Int32 = value1.Int32 op value2.Int32; \
+		stack->push(intermediate); \
+		ip++; \
+		DECODED_NEXT(); \
+	}
+
+#define DECODED_INT32_COMPARISON(op, field) \
+	{ \
+		DECODED_BINARY_OPERANDS(value1.Type == VariableKind::Int32); \
+		Variable intermediate(VariableKind::Boolean); \
+		intermediate.Boolean = value1.field op value2.field; \
+		stack->push(intermediate); \
+		ip++; \
+		DECODED_NEXT(); \
+	}
+
+// Conditional branches. The signed and the unsigned variants behave the same for Int32 and Uint32 operands, only the comparison differs
+#define DECODED_INT32_BRANCH(op, field) \
+	{ \
+		DECODED_BINARY_OPERANDS(value1.Type == VariableKind::Int32 || value1.Type == VariableKind::Uint32); \
+		ip = (value1.field op value2.field) ? code + ip->Operand.Int32 : ip + 1; \
+		DECODED_NEXT(); \
+	}
+
+// Replaces a generic arithmetic or comparison handler with the variant for the type of its first operand and executes that.
+// Types without a specialised variant are handled by the interpreter.
+#define DECODED_QUICKEN(generic) \
+	{ \
+		DecodedHandler specialised = DecodedMethod::Quicken(DecodedHandler::generic, stack->nth(1).Type); \
+		if (specialised == DecodedHandler::Fallback) \
+		{ \
+			goto leave; \
+		} \
+		ip->Handler = specialised; \
+		_instructionsQuickened++; \
+		DECODED_DISPATCH(); \
+	}
+
+// The guard of a specialised handler. If the operand type changed, the instruction goes back to its generic handler.
+#define DECODED_SPECIALISED_OPERANDS(generic, kind) \
+	Variable& value2 = stack->top(); \
+	Variable& value1 = stack->nth(1); \
+	if (value1.Type != VariableKind::kind) \
+	{ \
+		ip->Handler = DecodedHandler::generic; \
+		_quickeningGuardFailures++; \
+		DECODED_DISPATCH(); \
+	} \
+	stack->pop(); \
+	stack->pop();
+
+#define DECODED_SPECIALISED_OPERATION(generic, kind, field, op) \
+	{ \
+		DECODED_SPECIALISED_OPERANDS(generic, kind); \
+		Variable intermediate(VariableKind::kind); \
+		intermediate.field = value1.field op value2.field; \
+		stack->push(intermediate); \
+		ip++; \
+		DECODED_NEXT(); \
+	}
+
+#define DECODED_SPECIALISED_COMPARISON(generic, kind, field, op) \
+	{ \
+		DECODED_SPECIALISED_OPERANDS(generic, kind); \
+		Variable intermediate(VariableKind::Boolean); \
+		intermediate.Boolean = value1.field op value2.field; \
+		stack->push(intermediate); \
+		ip++; \
+		DECODED_NEXT(); \
+	}
+
+// Counts a superinstruction that replaces the given number of instructions. Must be used before ip is advanced.
+#define DECODED_COUNT_FUSED(length) \
+	_superinstructionsExecuted[(int)ip->Handler - (int)DecodedHandler::FirstFused]++; \
+	executed += (length) - 1;
+
+// ldloc a; ldloc b; branch. The operands are read directly from the locals, the branch target from the third instruction.
+#define DECODED_FUSED_LOCAL_BRANCH(op) \
+	{ \
+		Variable& value1 = locals->at(ip->Operand.Int32); \
+		Variable& value2 = locals->at(ip[1].Operand.Int32); \
+		if (value1.Type != VariableKind::Int32 && value1.Type != VariableKind::Uint32) \
+		{ \
+			goto leave; \
+		} \
+		DECODED_COUNT_FUSED(3); \
+		ip = (value1.Int32 op value2.Int32) ? code + ip[2].Operand.Int32 : ip + 3; \
+		DECODED_NEXT(); \
+	}
+
+/// <summary>
+/// Executes code from the pre-decoded instruction stream of the current method, starting at PC. Returns when an instruction is
+/// reached that must be executed by the interpreter (calls, returns, anything that may throw, operands of unexpected types) or when
+/// the budget is used up. On return, PC points to the next instruction to execute and stoppedAt to its decoded form
+/// (or null if there is none), so that the interpreter can use the pre-linked operands.
+/// </summary>
+/// <returns>The number of instructions executed</returns>
+int FirmataIlExecutor::ExecuteDecodedCode(DecodedMethod* decodedMethod, uint16_t& PC, EvaluationStack* stack, VariableVector* locals, VariableVector* arguments, int budget, DecodedInstruction*& stoppedAt)
+{
+	DecodedInstruction* ip = decodedMethod->InstructionAt(PC);
+	stoppedAt = ip;
+	if (ip == nullptr || budget <= 0)
+	{
+		return 0;
+	}
+
+	DecodedInstruction* code = decodedMethod->Code;
+	int executed = 0;
+
+#if DECODED_THREADED_DISPATCH
+	static void* const dispatchTable[] =
+	{
+#define DECODED_HANDLER_ADDRESS(name) &&Handler_##name,
+		DECODED_HANDLER_LIST(DECODED_HANDLER_ADDRESS)
+#undef DECODED_HANDLER_ADDRESS
+	};
+#endif
+
+	try
+	{
+	DECODED_DISPATCH();
+
+#if !DECODED_THREADED_DISPATCH
+	dispatch:
+	switch (ip->Handler)
+	{
+#endif
+	DECODED_HANDLER(Fallback)
+	DECODED_HANDLER(Call) // Executed by the interpreter, using the linked target method
+	DECODED_HANDLER(CallVirt)
+		goto leave;
+	DECODED_HANDLER(LdFld)
+		{
+			Variable& obj = stack->top();
+			const FieldOffsetEntry* field = ResolveFieldSite((FieldSite*)ip->Operand.Ptr, obj);
+			if (field == nullptr)
+			{
+				goto leave;
+			}
+			Variable value;
+			value.setSize(field->Size);
+			value.Type = field->Type;
+			memcpy(&value.Int32, AddBytes(obj.Object, sizeof(void*) + field->Offset), field->Size);
+			SignExtend(value, field->Size);
+			stack->pop();
+			stack->push(value);
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(StFld)
+		{
+			Variable& var = stack->top();
+			Variable& obj = stack->nth(1);
+			const FieldOffsetEntry* field = ResolveFieldSite((FieldSite*)ip->Operand.Ptr, obj);
+			if (field == nullptr)
+			{
+				goto leave;
+			}
+			memcpy(AddBytes(obj.Object, sizeof(void*) + field->Offset), &var.Object, field->Size);
+			stack->pop();
+			stack->pop();
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(Nop)
+		ip++;
+		DECODED_NEXT();
+	DECODED_HANDLER(LdArg)
+		stack->push(arguments->at(ip->Operand.Int32));
+		ip++;
+		DECODED_NEXT();
+	DECODED_HANDLER(StArg)
+		arguments->at(ip->Operand.Int32) = stack->top();
+		stack->pop();
+		ip++;
+		DECODED_NEXT();
+	DECODED_HANDLER(LdLoc)
+		stack->push(locals->at(ip->Operand.Int32));
+		ip++;
+		DECODED_NEXT();
+	DECODED_HANDLER(StLoc)
+		locals->at(ip->Operand.Int32) = stack->top();
+		stack->pop();
+		ip++;
+		DECODED_NEXT();
+	DECODED_HANDLER(LdcI4)
+		{
+			Variable intermediate(VariableKind::Int32);
+			intermediate.Int32 = ip->Operand.Int32;
+			stack->push(intermediate);
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(LdcR4)
+		{
+			Variable intermediate(VariableKind::Float);
+			intermediate.Float = ip->Operand.Float;
+			stack->push(intermediate);
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(LdNull)
+		{
+			Variable intermediate(VariableKind::Object);
+			intermediate.Object = nullptr;
+			stack->push(intermediate);
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(Dup)
+		{
+			Variable& value1 = stack->top();
+			if (value1.fieldSize() > sizeof(uint64_t))
+			{
+				// Large value types are handled by the interpreter
+				goto leave;
+			}
+			Variable copy = value1;
+			stack->push(copy);
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(Pop)
+		stack->pop();
+		ip++;
+		DECODED_NEXT();
+	DECODED_HANDLER(Add)
+		DECODED_QUICKEN(Add);
+	DECODED_HANDLER(Sub)
+		DECODED_QUICKEN(Sub);
+	DECODED_HANDLER(Mul)
+		DECODED_QUICKEN(Mul);
+	DECODED_HANDLER(And)
+		DECODED_INT32_OPERATION(&);
+	DECODED_HANDLER(Or)
+		DECODED_INT32_OPERATION(|);
+	DECODED_HANDLER(Xor)
+		DECODED_INT32_OPERATION(^);
+	DECODED_HANDLER(Shl)
+		DECODED_INT32_OPERATION(<<);
+	DECODED_HANDLER(Shr)
+		DECODED_INT32_OPERATION(>>);
+	DECODED_HANDLER(ShrUn)
+		{
+			DECODED_BINARY_OPERANDS(value1.Type == VariableKind::Int32 || value1.Type == VariableKind::Uint32);
+			Variable intermediate(VariableKind::Uint32);
+			intermediate.Uint32 = value1.Uint32 >> value2.Int32;
+			stack->push(intermediate);
+			ip++;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(Ceq)
+		DECODED_QUICKEN(Ceq);
+	DECODED_HANDLER(Cgt)
+		DECODED_QUICKEN(Cgt);
+	DECODED_HANDLER(CgtUn)
+		DECODED_INT32_COMPARISON(>, Uint32);
+	DECODED_HANDLER(Clt)
+		DECODED_QUICKEN(Clt);
+	DECODED_HANDLER(CltUn)
+		DECODED_INT32_COMPARISON(<, Uint32);
+	DECODED_HANDLER(Br)
+		ip = code + ip->Operand.Int32;
+		DECODED_NEXT();
+	DECODED_HANDLER(BrTrue)
+	DECODED_HANDLER(BrFalse)
+		{
+			Variable& value1 = stack->top();
+			bool isTrue;
+			if (value1.Type == VariableKind::Int32 || value1.Type == VariableKind::Uint32 || value1.Type == VariableKind::Boolean)
+			{
+				isTrue = value1.Uint32 != 0;
+			}
+			else if (value1.Type == VariableKind::Object || value1.Type == VariableKind::ReferenceArray || value1.Type == VariableKind::ValueArray)
+			{
+				isTrue = value1.Object != nullptr;
+			}
+			else
+			{
+				goto leave;
+			}
+			stack->pop();
+			if (ip->Handler == DecodedHandler::BrFalse)
+			{
+				isTrue = !isTrue;
+			}
+			ip = isTrue ? code + ip->Operand.Int32 : ip + 1;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(Beq)
+		DECODED_INT32_BRANCH(==, Uint32);
+	DECODED_HANDLER(BneUn)
+		DECODED_INT32_BRANCH(!=, Uint32);
+	DECODED_HANDLER(Bge)
+		DECODED_INT32_BRANCH(>=, Int32);
+	DECODED_HANDLER(BgeUn)
+		DECODED_INT32_BRANCH(>=, Uint32);
+	DECODED_HANDLER(Bgt)
+		DECODED_INT32_BRANCH(>, Int32);
+	DECODED_HANDLER(BgtUn)
+		DECODED_INT32_BRANCH(>, Uint32);
+	DECODED_HANDLER(Ble)
+		DECODED_INT32_BRANCH(<=, Int32);
+	DECODED_HANDLER(BleUn)
+		DECODED_INT32_BRANCH(<=, Uint32);
+	DECODED_HANDLER(Blt)
+		DECODED_INT32_BRANCH(<, Int32);
+	DECODED_HANDLER(BltUn)
+		DECODED_INT32_BRANCH(<, Uint32);
+	DECODED_HANDLER(LdArgLdFld)
+		{
+			Variable& obj = arguments->at(ip->Operand.Int32);
+			const FieldOffsetEntry* field = ResolveFieldSite((FieldSite*)ip[1].Operand.Ptr, obj);
+			if (field == nullptr)
+			{
+				goto leave;
+			}
+			Variable value;
+			value.setSize(field->Size);
+			value.Type = field->Type;
+			memcpy(&value.Int32, AddBytes(obj.Object, sizeof(void*) + field->Offset), field->Size);
+			SignExtend(value, field->Size);
+			stack->push(value);
+			DECODED_COUNT_FUSED(2);
+			ip += 2;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(LdArgLdArgStFld)
+		{
+			Variable& obj = arguments->at(ip->Operand.Int32);
+			Variable& var = arguments->at(ip[1].Operand.Int32);
+			const FieldOffsetEntry* field = ResolveFieldSite((FieldSite*)ip[2].Operand.Ptr, obj);
+			if (field == nullptr)
+			{
+				goto leave;
+			}
+			memcpy(AddBytes(obj.Object, sizeof(void*) + field->Offset), &var.Object, field->Size);
+			DECODED_COUNT_FUSED(3);
+			ip += 3;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(IncLoc)
+		{
+			Variable& local = locals->at(ip->Operand.Int32);
+			if (local.Type != VariableKind::Int32)
+			{
+				goto leave;
+			}
+			local.Int32 += ip[1].Operand.Int32;
+			DECODED_COUNT_FUSED(4);
+			ip += 4;
+			DECODED_NEXT();
+		}
+	DECODED_HANDLER(LdLocLdLocBlt)
+		DECODED_FUSED_LOCAL_BRANCH(<);
+	DECODED_HANDLER(LdLocLdLocBle)
+		DECODED_FUSED_LOCAL_BRANCH(<=);
+	DECODED_HANDLER(LdLocLdLocBgt)
+		DECODED_FUSED_LOCAL_BRANCH(>);
+	DECODED_HANDLER(LdLocLdLocBge)
+		DECODED_FUSED_LOCAL_BRANCH(>=);
+	DECODED_HANDLER(AddI4)
+		DECODED_SPECIALISED_OPERATION(Add, Int32, Int32, +);
+	DECODED_HANDLER(AddI8)
+		DECODED_SPECIALISED_OPERATION(Add, Int64, Int64, +);
+	DECODED_HANDLER(AddR4)
+		DECODED_SPECIALISED_OPERATION(Add, Float, Float, +);
+	DECODED_HANDLER(AddR8)
+		DECODED_SPECIALISED_OPERATION(Add, Double, Double, +);
+	DECODED_HANDLER(SubI4)
+		DECODED_SPECIALISED_OPERATION(Sub, Int32, Int32, -);
+	DECODED_HANDLER(SubI8)
+		DECODED_SPECIALISED_OPERATION(Sub, Int64, Int64, -);
+	DECODED_HANDLER(SubR4)
+		DECODED_SPECIALISED_OPERATION(Sub, Float, Float, -);
+	DECODED_HANDLER(SubR8)
+		DECODED_SPECIALISED_OPERATION(Sub, Double, Double, -);
+	DECODED_HANDLER(MulI4)
+		DECODED_SPECIALISED_OPERATION(Mul, Int32, Int32, *);
+	DECODED_HANDLER(MulI8)
+		DECODED_SPECIALISED_OPERATION(Mul, Int64, Int64, *);
+	DECODED_HANDLER(MulR4)
+		DECODED_SPECIALISED_OPERATION(Mul, Float, Float, *);
+	DECODED_HANDLER(MulR8)
+		DECODED_SPECIALISED_OPERATION(Mul, Double, Double, *);
+	DECODED_HANDLER(CeqI4)
+		DECODED_SPECIALISED_COMPARISON(Ceq, Int32, Int32, ==);
+	DECODED_HANDLER(CeqI8)
+		DECODED_SPECIALISED_COMPARISON(Ceq, Int64, Int64, ==);
+	DECODED_HANDLER(CeqR4)
+		DECODED_SPECIALISED_COMPARISON(Ceq, Float, Float, ==);
+	DECODED_HANDLER(CeqR8)
+		DECODED_SPECIALISED_COMPARISON(Ceq, Double, Double, ==);
+	DECODED_HANDLER(CgtI4)
+		DECODED_SPECIALISED_COMPARISON(Cgt, Int32, Int32, >);
+	DECODED_HANDLER(CgtI8)
+		DECODED_SPECIALISED_COMPARISON(Cgt, Int64, Int64, >);
+	DECODED_HANDLER(CgtR4)
+		DECODED_SPECIALISED_COMPARISON(Cgt, Float, Float, >);
+	DECODED_HANDLER(CgtR8)
+		DECODED_SPECIALISED_COMPARISON(Cgt, Double, Double, >);
+	DECODED_HANDLER(CltI4)
+		DECODED_SPECIALISED_COMPARISON(Clt, Int32, Int32, <);
+	DECODED_HANDLER(CltI8)
+		DECODED_SPECIALISED_COMPARISON(Clt, Int64, Int64, <);
+	DECODED_HANDLER(CltR4)
+		DECODED_SPECIALISED_COMPARISON(Clt, Float, Float, <);
+	DECODED_HANDLER(CltR8)
+		DECODED_SPECIALISED_COMPARISON(Clt, Double, Double, <);
+#if !DECODED_THREADED_DISPATCH
+	default:
+		goto leave;
+	}
+#endif
+	}
+	catch (...)
+	{
+		// Let the interpreter report the error at the right place
+		PC = ip->Pc;
+		_decodedInstructionsExecuted += executed;
+		throw;
+	}
+
+leave:
+	PC = ip->Pc;
+	stoppedAt = ip;
+	_decodedInstructionsExecuted += executed;
+	return executed;
+}
+
+#undef DECODED_THREADED_DISPATCH
+#undef DECODED_HANDLER
+#undef DECODED_DISPATCH
+#undef DECODED_NEXT
+#undef DECODED_BINARY_OPERANDS
+#undef DECODED_INT32_OPERATION
+#undef DECODED_INT32_COMPARISON
+#undef DECODED_INT32_BRANCH
+#undef DECODED_COUNT_FUSED
+#undef DECODED_QUICKEN
+#undef DECODED_SPECIALISED_OPERANDS
+#undef DECODED_SPECIALISED_OPERATION
+#undef DECODED_SPECIALISED_COMPARISON
+#undef DECODED_FUSED_LOCAL_BRANCH
+
+// Continues at the handler of the pending managed exception of the thread, or aborts the thread if there is none.
+// Only for use directly inside the instruction switch of ExecuteIlCode (not within nested loops).
+#define DISPATCH_PENDING_EXCEPTION() \
+	{ \
+		if (!DispatchPendingException(threadState, currentFrame, PC)) \
+		{ \
+			_instructionsExecuted += instructionsExecutedThisLoop; \
+			return MethodState::Aborted; \
+		} \
+		currentFrame->ActivateState(&PC, &stack, &locals, &arguments); \
+		currentMethod = currentFrame->_executingMethod; \
+		pCode = currentMethod->_methodIl; \
+		decodedCode = GetDecodedCode(threadState, currentMethod); \
+		/* The prefixes of the faulting instruction must not apply to the handler */ \
+		constrainedTypeToken = 0; \
+		tailCallPending = false; \
+		target = nullptr; \
+		continue; \
+	}
+
+// Raises a system exception without a C++ throw. Same restrictions as above.
+#define RAISE_EXCEPTION(...) \
+	{ \
+		RaiseException(threadState, __VA_ARGS__); \
+		DISPATCH_PENDING_EXCEPTION(); \
+	}
+
 // Preconditions for save execution: 
 // - codeLength is correct
 // - argc matches argList
@@ -5776,36 +6920,49 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 		return MethodState::Running;
 	}
 	
-	ExecutionState* currentFrame = threadState->rootOfExecutionStack;
-	while (currentFrame->_next != NULL)
+	ExecutionState* currentFrame = threadState->innermostFrame;
+
+	int instructionsExecutedThisLoop = 0;
+	int instructionLimit = NUM_INSTRUCTIONS_AT_ONCE;
+	// Only used in SchedulerMode::TimeBudget
+	uint32_t sliceStart = 0;
+	uint32_t sliceLength = 0;
+	if (_schedulerMode == SchedulerMode::TimeBudget)
 	{
-		currentFrame = currentFrame->_next;
+		instructionLimit = MAX_INSTRUCTIONS_PER_TIME_SLICE;
+		sliceStart = micros();
+		sliceLength = CurrentTimeSlice(CoreOfThread(threadState->threadId));
 	}
 
-	int instructionsExecutedThisLoop = 0;
 	int constrainedTypeToken = 0; // Only used for the CONSTRAINED. prefix
+	bool tailCallPending = false; // Set by the TAIL. prefix
 	MethodBody* target = nullptr; // Used for the calli instruction
 	uint16_t PC = 0;
-	VariableDynamicStack* stack;
+	EvaluationStack* stack;
 	VariableVector* locals;
 	VariableVector* arguments;
 	
 	// Temporary location for a stack variable of arbitrary size. The memory is allocated using alloca() when needed
 	Variable* tempVariable = nullptr;
 	size_t sizeOfTemp = 0;
+	// Holds the arguments of a tail call while the frame of the caller is replaced. Also allocated using alloca()
+	byte* tailCallArguments = nullptr;
+	size_t sizeOfTailCallArguments = 0;
 	
 	currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
 
 	MethodBody* currentMethod = currentFrame->_executingMethod;
 
 	byte* pCode = currentMethod->_methodIl;
+	DecodedMethod* decodedCode = GetDecodedCode(threadState, currentMethod);
+	DecodedInstruction* decodedInstruction = nullptr; // The decoded form of the next instruction, if available
 	TRACE(u32 startTime = micros());
 	try
 	{
 	// The compiler always inserts a return statement, so we can never run past the end of a method,
 	// however we use this counter to interrupt code execution every now and then to go back to the main loop
 	// and check for other tasks (i.e. serial input data)
-    while (instructionsExecutedThisLoop < NUM_INSTRUCTIONS_AT_ONCE && !_gc.GcRecommended())
+    while (instructionsExecutedThisLoop < instructionLimit && !_gc.GcRecommended())
     {
 #if DEBUGGER
 
@@ -5818,6 +6975,26 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 		}
 
 #endif
+		decodedInstruction = nullptr;
+		if (decodedCode != nullptr && !_debuggerEnabled)
+		{
+			// Execute as much as possible from the pre-decoded instruction stream. This returns when an instruction
+			// is reached that needs the interpreter below.
+			// In time budget mode, the decoded code returns at least every NUM_INSTRUCTIONS_AT_ONCE instructions, so the time gets checked
+			// even in loops that never leave the decoded code.
+			int budget = MIN(instructionLimit - instructionsExecutedThisLoop, NUM_INSTRUCTIONS_AT_ONCE);
+			instructionsExecutedThisLoop += ExecuteDecodedCode(decodedCode, PC, stack, locals, arguments, budget, decodedInstruction);
+			if (sliceLength != 0 && (uint32_t)(micros() - sliceStart) >= sliceLength)
+			{
+				instructionsExecutedThisLoop = instructionLimit;
+			}
+
+			if (instructionsExecutedThisLoop >= instructionLimit)
+			{
+				break;
+			}
+		}
+
     	immediatellyContinue: // Label used by prefix codes, to prevent interruption
 		instructionsExecutedThisLoop++;
 		
@@ -5866,7 +7043,9 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					if ((declaration->MethodFlags() & (int)MethodFlags::Ctor) != 0 && MethodMatchesArgumentTypes(declaration, argsArray)) // +1, because a ctor has an implicit this argument
 					{
 						newInstance = CreateInstanceOfClass(typeToken, 0);
-						newState = new ExecutionState(currentFrame->TaskId(), declaration->MaxExecutionStack(), declaration);
+						// The frame of the ctor replaces the frame of this method, which is released below. Releasing a frame in the arena
+						// also releases everything allocated after it, so the ctor frame must not be in the arena.
+						newState = ExecutionState::Create(nullptr, currentFrame->TaskId(), declaration);
 						newState->ActivateState(&PC, &stack, &locals, &arguments);
 						int argNum = 0;
 						for (; argNum < argsLen; argNum++)
@@ -5896,10 +7075,10 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					throw ClrException(SystemException::ClassNotFound, typeToken);
 				}
 
-				ExecutionState* frame = PreviousStackFrame(threadState, currentFrame);
-
 				// Remove the last frame and set the PC for the new current frame. This will make it look like the ctor was called normally using a newobj instruction.
-				frame->_next = newState;
+				threadState->PopFrame();
+				ExecutionState* frame = threadState->innermostFrame;
+				threadState->PushFrame(newState);
     			// This is a bit ugly, but we have to get at the stack of our caller to push the new instance (we had already activated the new frame above)
 				frame->ActivateState(&PC, &stack, &locals, &arguments);
 				Variable v;
@@ -5911,7 +7090,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 				currentFrame = newState;
     			
 				newState->ActivateState(&PC, &stack, &locals, &arguments);
-				delete exitingFrame;
+				ExecutionState::Destroy(exitingFrame);
     		}
 			else if (specialMethod == NativeMethod::MiniTimerQueueFireCallback)
 			{
@@ -5926,25 +7105,20 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 				if (specialMethod == NativeMethod::ThreadYield)
 				{
 					// Give up our time slice, but do not enter wait state (breaking here would not remove the call from the stack)
-					instructionsExecutedThisLoop = NUM_INSTRUCTIONS_AT_ONCE + 1;
+					instructionsExecutedThisLoop = instructionLimit + 1;
 				}
 				else if (!ExecuteSpecialMethod(threadState, currentFrame, specialMethod, *arguments, retVal))
 				{
 					// If this returns false, we exit the execution loop for this thread and execute the method again next time
 					// That's how we (busy-)wait inside native methods
-					instructionsExecutedThisLoop = NUM_INSTRUCTIONS_AT_ONCE + 1;
+					instructionsExecutedThisLoop = instructionLimit + 1;
 					break;
 				}
 
 				// We're called into a "special" (built-in) method. 
-				// Perform a method return
-				ExecutionState* frame = PreviousStackFrame(threadState, currentFrame); // start at root
-
-				// Remove the last frame and set the PC for the new current frame
-				frame->_next = nullptr;
-
-				ExecutionState* exitingFrame = currentFrame; // Need to keep it until we have saved the return value
-				currentFrame = frame;
+				// Perform a method return: Remove the last frame and set the PC for the new current frame
+				ExecutionState* exitingFrame = threadState->PopFrame(); // Need to keep it until we have saved the return value
+				currentFrame = threadState->innermostFrame;
 
 				// If the method we just terminated is not of type void, we push the result to the 
 				// stack of the calling method.
@@ -5958,12 +7132,13 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
 				}
 
-				delete exitingFrame;
+				ExecutionState::Destroy(exitingFrame);
 			}
     		
 			currentMethod = currentFrame->_executingMethod;
 
 			pCode = currentMethod->_methodIl;
+			decodedCode = GetDecodedCode(threadState, currentMethod);
 			continue;
 		}
 		
@@ -6020,14 +7195,9 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						var = nullptr;
 					}
 
-					// Find the frame which has the current frame as next (should be the second-last on the stack now)
-					frame = PreviousStackFrame(threadState, currentFrame);
 					// Remove the last frame and set the PC for the new current frame
-
-					frame->_next = nullptr;
-					
-					ExecutionState* exitingFrame = currentFrame; // Need to keep it until we have saved the return value
-					currentFrame = frame;
+					ExecutionState* exitingFrame = threadState->PopFrame(); // Need to keep it until we have saved the return value
+					currentFrame = threadState->innermostFrame;
 
 					if (exitingFrame->_executingMethod->MethodFlags() & (byte)MethodFlags::Synchronized)
 					{
@@ -6048,10 +7218,11 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
 					}
 
-					delete exitingFrame;
+					ExecutionState::Destroy(exitingFrame);
 
 					currentMethod = currentFrame->_executingMethod;
 					pCode = currentMethod->_methodIl;
+					decodedCode = GetDecodedCode(threadState, currentMethod);
 					TRACE(Firmata.sendStringf(F("Popped stack back to method 0x%x"), currentMethod->methodToken));
 					break;
 				}
@@ -6060,6 +7231,12 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					// We can ignore this, I think.
 					goto immediatellyContinue;
 				}
+				else if (instr == CEE_TAIL_)
+				{
+					// The next instruction is a call that may replace the frame of this method
+					tailCallPending = true;
+					goto immediatellyContinue;
+				}
 				else if (instr == CEE_ENDFINALLY)
 				{
 					// Can we try to find another handler around the current block?
@@ -6092,7 +7269,8 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 							// Rethrow
 							currentFrame->UpdatePc(PC); // Save current PC, to make sure we don't enter the same handler again
 							auto cl = GetClassDeclaration(exception);
-							throw CustomClrException(exception, cl->ClassToken);
+							RaiseException(threadState, exception, cl->ClassToken);
+							DISPATCH_PENDING_EXCEPTION();
 						}
 						else if (nextPc == 0)
 						{
@@ -6115,14 +7293,14 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 				if (numArgumentsToPop == 0)
 				{
 					Variable unused;
-					errorState = BasicStackInstructions(currentFrame, PC, stack, locals, arguments, instr, unused, unused, unused);
+					errorState = BasicStackInstructions(threadState, currentFrame, PC, stack, locals, arguments, instr, unused, unused, unused);
 				}
 				else if (numArgumentsToPop == 1)
 				{
 					Variable& value1 = stack->top();
 					stack->pop();
 					// The last two args are unused in this case, so we can provide what we want
-					errorState = BasicStackInstructions(currentFrame, PC, stack, locals, arguments, instr, value1, value1, value1);
+					errorState = BasicStackInstructions(threadState, currentFrame, PC, stack, locals, arguments, instr, value1, value1, value1);
 				}
 				else if (numArgumentsToPop == 2)
 				{
@@ -6130,7 +7308,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->pop();
 					Variable& value1 = stack->top();
 					stack->pop();
-					errorState = BasicStackInstructions(currentFrame, PC, stack, locals, arguments, instr, value1, value2, value2);
+					errorState = BasicStackInstructions(threadState, currentFrame, PC, stack, locals, arguments, instr, value1, value2, value2);
 				}
 				else if (numArgumentsToPop == 3)
 				{
@@ -6140,7 +7318,12 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->pop();
 					Variable& value1 = stack->top();
 					stack->pop();
-					errorState = BasicStackInstructions(currentFrame, PC, stack, locals, arguments, instr, value1, value2, value3);
+					errorState = BasicStackInstructions(threadState, currentFrame, PC, stack, locals, arguments, instr, value1, value2, value3);
+				}
+
+				if (errorState == MethodState::Exception)
+				{
+					DISPATCH_PENDING_EXCEPTION();
 				}
 
 				if (errorState != MethodState::Running)
@@ -6277,6 +7460,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
             case ShortInlineBrTarget:
 			case InlineBrTarget:
             {
+				uint16_t branchFrom = PC;
 				byte numArgumensToPop = pgm_read_byte(OpcodePops + instr);
 				Variable value1;
 				Variable value2;
@@ -6407,6 +7591,12 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					PC += 4;
 				}
 
+				if (PC < branchFrom && sliceLength != 0 && (uint32_t)(micros() - sliceStart) >= sliceLength)
+				{
+					// Backward branch and the time slice is used up. Finish the slice after this instruction.
+					instructionsExecutedThisLoop = instructionLimit;
+				}
+
             	if (leaveSource >= 0)
             	{
             		// We're executing a leave command. Instead of continuing at the new PC, first locate a finally clause and go there.
@@ -6457,7 +7647,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						void* ptr = Stfld(currentMethod, obj, token, var);
 						if (ptr == nullptr)
 						{
-							throw ClrException("Null reference exception in STFLD instruction", SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+							RAISE_EXCEPTION("Null reference exception in STFLD instruction", SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 						}
 						break;
 					}
@@ -6486,13 +7676,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					{
 						Variable& obj = stack->top();
 						stack->pop();
-						ClassDeclaration* ty = ResolveClassFromFieldToken(token);
-						Variable& desc = GetVariableDescription(ty, token);
-						if (desc.Type == VariableKind::Void)
-						{
-							throw ClrException(SystemException::FieldAccess, token);
-						}
-						if ((int)(desc.Type & VariableKind::StaticMember) != 0)
+						if (ResolveFieldToken(token)->IsStatic())
 						{
 							// Obj can be ignored in this case (but needs popping nevertheless)
 							stack->push(Ldsflda(threadState, token));
@@ -6538,10 +7722,27 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 				// Save return PC
 				currentFrame->UpdatePc(PC);
 
+				if (sliceLength != 0 && (uint32_t)(micros() - sliceStart) >= sliceLength)
+				{
+					// The call is still executed, but the slice ends afterwards
+					instructionsExecutedThisLoop = instructionLimit;
+				}
+
 				MethodBody* newMethod = nullptr;
+				CallSite* callSite = nullptr;
 				if (instr == CEE_CALLI)
 				{
-					newMethod = target;
+					newMethod = target;
+				}
+				else if (decodedInstruction != nullptr && decodedInstruction->Handler == DecodedHandler::Call)
+				{
+					// The call was linked when the method was decoded
+					newMethod = (MethodBody*)decodedInstruction->Operand.Ptr;
+				}
+				else if (decodedInstruction != nullptr && decodedInstruction->Handler == DecodedHandler::CallVirt)
+				{
+					callSite = (CallSite*)decodedInstruction->Operand.Ptr;
+					newMethod = callSite->Method;
 				}
 				else
 				{
@@ -6554,6 +7755,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 				}
 
 				ClassDeclaration* cls = nullptr;
+				ClassDeclaration* receiverClass = nullptr; // Set if the resolved target shall be added to the call site cache
 				if (instr == CEE_CALLVIRT || instr == CEE_LDVIRTFTN || (instr == CEE_CALLI && (newMethod->MethodFlags() & (int)MethodFlags::Virtual)))
 				{
 					// For a virtual call, we need to grab the instance we operate on from the stack.
@@ -6617,7 +7819,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					
 					if (instance.Object == nullptr)
 					{
-						throw ClrException("Null reference exception calling virtual method", SystemException::NullReference, tk);
+						RAISE_EXCEPTION("Null reference exception calling virtual method", SystemException::NullReference, tk);
 					}
 
 					if (cls == nullptr)
@@ -6633,7 +7835,39 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					if (instance.Type != VariableKind::Object && instance.Type != VariableKind::ValueArray &&
 						instance.Type != VariableKind::ReferenceArray && instance.Type != VariableKind::AddressOfVariable)
 					{
-						throw ClrException("Virtual function call on something that is not an object", SystemException::InvalidCast, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION("Virtual function call on something that is not an object", SystemException::InvalidCast, currentFrame->_executingMethod->methodToken);
+					}
+
+					if (callSite != nullptr)
+					{
+						MethodBody* cachedTarget = callSite->Lookup(cls);
+						if (cachedTarget != nullptr)
+						{
+							_callSiteCacheHits++;
+							newMethod = cachedTarget;
+							goto outer;
+						}
+
+						_callSiteCacheMisses++;
+						receiverClass = cls;
+					}
+
+					if (cls->ParentToken != 0 && cls->HasDispatchTable())
+					{
+						const DispatchEntry* entry = cls->FindDispatchEntry(newMethod->methodToken);
+						if (entry != nullptr && entry->ImplementationToken != newMethod->methodToken)
+						{
+							newMethod = entry->Implementation;
+							if (newMethod == nullptr)
+							{
+								newMethod = GetMethodByToken(entry->ImplementationToken);
+							}
+							if (newMethod == nullptr)
+							{
+								throw ClrException("Implementation for token not found", SystemException::MissingMethod, entry->ImplementationToken);
+							}
+						}
+						goto outer;
 					}
 
 					// Do not continue if parent is 0 (System.Object does not inherit methods from anywhere).
@@ -6669,6 +7903,11 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 				} // End of if (method is virtual)
 
 				outer:
+				if (receiverClass != nullptr)
+				{
+					callSite->Add(receiverClass, newMethod);
+				}
+
 				// Call to an abstract base class or an interface method - if this happens,
 				// we've probably not done the virtual function resolution correctly
 				if ((int)newMethod->MethodFlags() & (int)MethodFlags::Abstract)
@@ -6684,7 +7923,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					if (lockTaken == TriStateBool::Neither)
 					{
 						PC -= 5; // Retry the "CALL" or "CALLVIRT" instruction (can't possibly be anything else, can it?)
-						instructionsExecutedThisLoop = NUM_INSTRUCTIONS_AT_ONCE + 1;
+						instructionsExecutedThisLoop = instructionLimit + 1;
 						break;
 					}
 
@@ -6747,7 +7986,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 							int sourceLen = *AddBytes((int*)value, 4);
 							if (sourceLen < length + startIndex)
 							{
-								throw ClrException("Array size out of bounds", SystemException::IndexOutOfRange, newMethod->methodToken);
+								RAISE_EXCEPTION("Array size out of bounds", SystemException::IndexOutOfRange, newMethod->methodToken);
 							}
 							
 							value = AddBytes(value, ARRAY_DATA_START);
@@ -6790,7 +8029,38 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					}
 					else
 					{
-						newObjInstance = CreateInstance(cls);
+						// The object can live in our frame if it never leaves this method
+						uint16_t sizeOfClass = SizeOfClass(cls);
+						if (sizeOfClass <= MAX_STACK_OBJECT_SIZE)
+						{
+							const MethodEscapeInfo* escapeInfo;
+							{
+								ScopeLock lock;
+								escapeInfo = _escapeAnalysis.FindEscapeInfo(currentMethod->methodToken);
+							}
+
+							if (escapeInfo == nullptr)
+							{
+								MethodEscapeInfo* newInfo = EscapeAnalysis::Analyze(currentMethod, _methods);
+								ScopeLock lock;
+								escapeInfo = _escapeAnalysis.AddEscapeInfo(newInfo);
+							}
+
+							if (escapeInfo->IsStackAllocatable(PC - 5))
+							{
+								newObjInstance = currentFrame->AllocateStackObject(sizeOfClass);
+							}
+						}
+
+						if (newObjInstance != nullptr)
+						{
+							*(ClassDeclaration**)newObjInstance = cls;
+							_stackAllocations++;
+						}
+						else
+						{
+							newObjInstance = CreateInstance(cls);
+						}
 					}
 				}
 
@@ -6817,19 +8087,97 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->push(ftptr);
 					break;
 				}
+
+				// A call with the tail. prefix, or a recursive call that is immediately followed by a ret (what the C# compiler
+				// emits for tail recursion): The callee gets the frame of the current method and returns directly to our caller.
+				uint16_t retLength;
+				if ((tailCallPending || (instr == CEE_CALL && newMethod == currentMethod && PC < currentMethod->MethodLength() && DecodeOpcode(pCode + PC, &retLength) == CEE_RET)) &&
+					instr != CEE_NEWOBJ && instr != CEE_CALLI)
+				{
+					if (CanTailCall(threadState, currentFrame, newMethod, stack))
+					{
+						int argumentCount = newMethod->NumberOfArguments();
+						if (newMethod == currentMethod)
+						{
+							// Same method: Overwrite the arguments and start again
+							while (argumentCount > 0)
+							{
+								argumentCount--;
+								arguments->at(argumentCount) = stack->top();
+								stack->pop();
+							}
+
+							currentFrame->RestartMethod();
+							currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
+						}
+						else
+						{
+							// Keep the arguments while the frame is released, then create the frame of the callee at the same place
+							size_t bytesRequired = 0;
+							for (int i = 0; i < argumentCount; i++)
+							{
+								bytesRequired += Variable::headersize() + MAX(stack->nth(i).fieldSize(), sizeof(uint64_t));
+							}
+
+							if (sizeOfTailCallArguments < bytesRequired)
+							{
+								tailCallArguments = (byte*)alloca(bytesRequired);
+								sizeOfTailCallArguments = bytesRequired;
+							}
+
+							byte* argumentPtr = tailCallArguments;
+							for (int i = 0; i < argumentCount; i++)
+							{
+								Variable& v = stack->nth(argumentCount - 1 - i);
+								size_t size = Variable::headersize() + MAX(v.fieldSize(), sizeof(uint64_t));
+								memcpy(argumentPtr, &v, size);
+								argumentPtr += size;
+							}
+
+							int taskId = currentFrame->TaskId();
+							ExecutionState::Destroy(threadState->PopFrame());
+							ExecutionState* newState = ExecutionState::Create(&threadState->frameArena, taskId, newMethod);
+							if (newState == nullptr)
+							{
+								OutOfMemoryException::Throw("Out of memory to create stack frame");
+							}
+							threadState->PushFrame(newState);
+							currentFrame = newState;
+							currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
+
+							argumentPtr = tailCallArguments;
+							for (int i = 0; i < argumentCount; i++)
+							{
+								Variable* v = (Variable*)argumentPtr;
+								arguments->at(i) = *v;
+								argumentPtr += Variable::headersize() + MAX(v->fieldSize(), sizeof(uint64_t));
+							}
+						}
+
+						_tailCalls++;
+						currentMethod = newMethod;
+						pCode = newMethod->_methodIl;
+						decodedCode = GetDecodedCode(threadState, currentMethod);
+						target = nullptr;
+						constrainedTypeToken = 0;
+						tailCallPending = false;
+						TRACE(Firmata.sendStringf(F("Tail call to method 0x%x"), currentMethod->methodToken));
+						break;
+					}
+				}
 								
 				uint16_t argumentCount = newMethod->NumberOfArguments();
 				// While generating locals, assign their types (or a value used as out parameter will never be correctly typed, causing attempts
 				// to calculate on void types)
-				ExecutionState* newState = new ExecutionState(currentFrame->TaskId(), newMethod->MaxExecutionStack(), newMethod);
+				ExecutionState* newState = ExecutionState::Create(&threadState->frameArena, currentFrame->TaskId(), newMethod);
 				if (newState == nullptr)
 				{
 					// Could also send a stack overflow exception here, but the reason is the same
 					OutOfMemoryException::Throw("Out of memory to create stack frame");
 				}
-				currentFrame->_next = newState;
+				threadState->PushFrame(newState);
 				
-				VariableDynamicStack* oldStack = stack;
+				EvaluationStack* oldStack = stack;
 				// Start of the called method
 				currentFrame = newState;
 				currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
@@ -6837,6 +8185,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
             	// Load data pointer for the new method
 				currentMethod = newMethod;
 				pCode = newMethod->_methodIl;
+				decodedCode = GetDecodedCode(threadState, currentMethod);
 
 				// Provide arguments to the new method
 				if (newObjInstance != nullptr)
@@ -6917,6 +8266,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 
 				target = nullptr;
 				constrainedTypeToken = 0;
+				tailCallPending = false;
 				TRACE(Firmata.sendStringf(F("Pushed stack to method 0x%x"), currentMethod->methodToken));
 				break;
             }
@@ -6951,7 +8301,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						stack->pop();
 						if (value1.Object == nullptr)
 						{
-							throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+							RAISE_EXCEPTION(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 						}
 
 						uint32_t* data = (uint32_t*)value1.Object;
@@ -6966,7 +8316,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						int32_t index = value2.Int32;
 						if (index < 0 || index >= arraysize)
 						{
-							throw ClrException("Array index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+							RAISE_EXCEPTION("Array index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 						}
 
 						int sizeOfElement = elemTy->ClassDynamicSize;
@@ -7025,7 +8375,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->pop();
 					if (value1.Object == nullptr)
 					{
-						throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 					}
 
 					uint32_t* data = (uint32_t*)value1.Object;
@@ -7034,7 +8384,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					int32_t index = value2.Int32;
 					if (index < 0 || index >= arraysize)
 					{
-						throw ClrException("Array index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION("Array index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 					}
 
 					// This should always exist
@@ -7128,7 +8478,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->pop();
 					if (value1.Object == nullptr)
 					{
-						throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 					}
 
 					uint32_t* data = (uint32_t*)value1.Object;
@@ -7141,7 +8491,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					int32_t index = value2.Int32;
 					if (index < 0 || index >= arraysize)
 					{
-						throw ClrException("Array index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION("Array index out of range", SystemException::IndexOutOfRange, currentFrame->_executingMethod->methodToken);
 					}
 
 					Variable v1;
@@ -7258,7 +8608,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						// According to docs, this shouldn't happen, but better be safe
 					if (value1.Object == nullptr)
 					{
-						throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 					}
 					ClassDeclaration* ty = _classes.GetClassWithToken(token);
 					if (ty->IsValueType())
@@ -7325,7 +8675,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 						break;
 					}
 					// The cast fails. Throw a InvalidCastException
-					throw ClrException("Invalid cast", SystemException::InvalidCast, ty->ClassToken);
+					RAISE_EXCEPTION("Invalid cast", SystemException::InvalidCast, ty->ClassToken);
 				}
 				case CEE_CONSTRAINED_:
 					constrainedTypeToken = token; // This is always immediately followed by a callvirt
@@ -7337,7 +8687,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->pop();
 					if (value1.Object == nullptr)
 					{
-						throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 					}
 					if (value1.Type != VariableKind::AddressOfVariable)
 					{
@@ -7398,7 +8748,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					stack->pop();
 					if (dest.Object == nullptr)
 					{
-						throw ClrException(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
+						RAISE_EXCEPTION(SystemException::NullReference, currentFrame->_executingMethod->methodToken);
 					}
 					if (dest.Type != VariableKind::AddressOfVariable)
 					{
@@ -7483,17 +8833,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 					// opcode must be CEE_LDSTR
 					int token = static_cast<int32_t>(((uint32_t)pCode[PC]) + (((uint32_t)pCode[PC + 1]) << 8) + (((uint32_t)pCode[PC + 2]) << 16) + (((uint32_t)pCode[PC + 3]) << 24));
 					PC += 4;
-					bool emptyString = (token & 0xFFFF) == 0;
-					int length = 0;
-					char* string = nullptr;
-					if (!emptyString)
-					{
-						string = GetString(token, length);
-					}
-
-					// This creates an unicode string (16 bits per letter) from the UTF-8 encoded constant retrieved above
-					Variable stringVariable = CreateStringInstance(length, string);
-					stack->push(stringVariable);
+					stack->push(GetStringLiteral(token));
 				}
 				break;
 			case InlineSwitch:
@@ -7530,71 +8870,14 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 	}
 	catch(ClrException& cx)
 	{
-		if (_breakOnException)
-		{
-			_nextStepBehavior.Kind = BreakpointType::Once;
-			_commandsToSkip = 0;
-			_debuggingThread = threadState->threadId;
-		}
-
-		// On an exception, send the state prior to the stack unwinding once
-		if (_debuggerEnabled)
-		{
-			Firmata.sendString(F("Exception caught. First follows the state before stack unwinding, then after: "));
-			SendDebugState(threadState->rootOfExecutionStack);
-		}
-
+		// Managed exceptions raised by helper functions and native methods still arrive here
 		_instructionsExecuted += instructionsExecutedThisLoop;
-		currentFrame->UpdatePc(PC);
-		Variable v(VariableKind::Object);
-		v.Object = cx.ExceptionObject(this);
-		ExceptionClause* c = nullptr;
-
-		// v.Object is only null if we were unable to convert a system exception into a managed exception.
-		if (v.Object != nullptr && LocateCatchHandler(threadState, currentFrame, PC, v, &c))
-		{
-			currentFrame->UpdatePc(CreateExceptionFrame(currentFrame, 0, c, v));
-			currentFrame->ActivateState(&PC, &stack, &locals, &arguments);
-			// When entering a catch frame, the execution stack is cleared and the exception pushed to it (for a catch handler)
-			ClearExecutionStack(stack);
-			if (c->ClauseType == ExceptionHandlingClauseOptions::Clause)
-			{
-				stack->push(v);
-			}
-
-			if (c->ClauseType == ExceptionHandlingClauseOptions::Clause)
-			{
-				// Drop the top element of the exception stack. We can't throw it away entirely, because we might be inside an outer finally clause
-				ExceptionFrame* frame = currentFrame->_exceptionFrame;
-				ExceptionFrame* previous = nullptr;
-				// This chain is only required for the rare case where another exception (including handler) sits inside a finally clause.
-				while (frame->Next != nullptr)
-				{
-					previous = frame;
-					frame = frame->Next;
-				}
-
-				if (previous)
-				{
-					delete previous->Next;
-					previous->Next = nullptr;
-				}
-				else
-				{
-					delete currentFrame->_exceptionFrame;
-					currentFrame->_exceptionFrame = nullptr;
-				}
-			}
-
-			return MethodState::Running; // And go to start
-		}
-		else
-		{
-			// No suitable handler found
-			SendDebugState(threadState->rootOfExecutionStack);
-			CreateFatalException(threadState, cx.ExceptionType(), v, cx.ExceptionToken());
-			return MethodState::Aborted;
-		}
+		PendingException& pending = threadState->pendingException;
+		pending.ExceptionObject = cx.ExceptionObject(this);
+		pending.ExceptionType = cx.ExceptionType();
+		pending.ExceptionToken = cx.ExceptionToken();
+		pending.Message = cx.Message();
+		return DispatchPendingException(threadState, currentFrame, PC) ? MethodState::Running : MethodState::Aborted;
 	}
 	catch(ExecutionEngineException& ee)
 	{
@@ -7612,7 +8895,7 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 
 	// This performs a GC every 50'th instruction. We should find something better (hint: When an OutOfMemoryException is about to be
 	// thrown is a good idea, with every third mouse click not)
-	_gc.Collect(2, this);
+	CollectGarbage(2);
 	
 	TRACE(startTime = (micros() - startTime) / NUM_INSTRUCTIONS_AT_ONCE);
 	TRACE(Firmata.sendString(F("Interrupting method at 0x"), PC));
@@ -7622,23 +8905,132 @@ MethodState FirmataIlExecutor::ExecuteIlCode(ThreadState *threadState, Variable*
 	return MethodState::Running;
 }
 
+#undef RAISE_EXCEPTION
+#undef DISPATCH_PENDING_EXCEPTION
+
 /// <summary>
-/// Returns the previous stack frame.
+/// Raises a managed exception of a system exception type. The exception object is only created when the exception is dispatched.
 /// </summary>
-/// <param name="thread">The current thread</param>
-/// <param name="currentFrame">The current stack frame. Must be in the stack of the current thread.</param>
-/// <returns>The previous stack frame.</returns>
-ExecutionState* FirmataIlExecutor::PreviousStackFrame(ThreadState* thread, ExecutionState* currentFrame) const
+/// <returns>MethodState::Exception, so that the caller can directly return it</returns>
+MethodState FirmataIlExecutor::RaiseException(ThreadState* threadState, SystemException exceptionType, int exceptionToken)
+{
+	return RaiseException(threadState, nullptr, exceptionType, exceptionToken);
+}
+
+MethodState FirmataIlExecutor::RaiseException(ThreadState* threadState, const char* message, SystemException exceptionType, int exceptionToken)
+{
+	PendingException& pending = threadState->pendingException;
+	pending.ExceptionObject = nullptr;
+	pending.ExceptionType = exceptionType;
+	pending.ExceptionToken = exceptionToken;
+	pending.Message = message;
+	return MethodState::Exception;
+}
+
+/// <summary>
+/// Raises the given managed exception object (the throw instruction)
+/// </summary>
+MethodState FirmataIlExecutor::RaiseException(ThreadState* threadState, Variable& exceptionObject, int exceptionToken)
+{
+	if (exceptionObject.Type != VariableKind::Object)
+	{
+		throw ExecutionEngineException("Throwing a managed exception which is not of type Object");
+	}
+
+	PendingException& pending = threadState->pendingException;
+	pending.ExceptionObject = exceptionObject.Object;
+	pending.ExceptionType = SystemException::CustomException;
+	pending.ExceptionToken = exceptionToken;
+	pending.Message = nullptr;
+	return MethodState::Exception;
+}
+
+/// <summary>
+/// Hands the pending exception of the thread to the nearest matching handler. On success, currentFrame is the frame with the
+/// handler, its PC points to the handler and the exception is on its stack (for a catch clause).
+/// </summary>
+/// <returns>False if there's no handler. The exception is then fatal for the thread.</returns>
+bool FirmataIlExecutor::DispatchPendingException(ThreadState* threadState, ExecutionState*& currentFrame, uint16_t PC)
 {
-	// Don't expect root to be null here, and expect that currentFrame actually exists.
-	ExecutionState* frame = thread->rootOfExecutionStack;
-	// Find the frame which has the current frame as next (should be the second-last on the stack now)
-	while (frame->_next != currentFrame)
+	PendingException& pending = threadState->pendingException;
+	if (_breakOnException)
+	{
+		_nextStepBehavior.Kind = BreakpointType::Once;
+		_commandsToSkip = 0;
+		_debuggingThread = threadState->threadId;
+	}
+
+	// On an exception, send the state prior to the stack unwinding once
+	if (_debuggerEnabled)
+	{
+		Firmata.sendString(F("Exception caught. First follows the state before stack unwinding, then after: "));
+		SendDebugState(threadState->rootOfExecutionStack);
+	}
+
+	currentFrame->UpdatePc(PC);
+	Variable v(VariableKind::Object);
+	v.Object = pending.ExceptionObject;
+	if (v.Object == nullptr)
+	{
+		// A system exception: Create the managed exception object for it now
+		if (pending.Message != nullptr)
+		{
+			v.Object = ClrException(pending.Message, pending.ExceptionType, pending.ExceptionToken).ExceptionObject(this);
+		}
+		else
+		{
+			v.Object = ClrException(pending.ExceptionType, pending.ExceptionToken).ExceptionObject(this);
+		}
+	}
+
+	pending.ExceptionObject = nullptr;
+	pending.Message = nullptr;
+	ExceptionClause* c = nullptr;
+
+	// v.Object is only null if we were unable to convert a system exception into a managed exception.
+	if (v.Object == nullptr || !LocateCatchHandler(threadState, currentFrame, PC, v, &c))
+	{
+		// No suitable handler found
+		SendDebugState(threadState->rootOfExecutionStack);
+		CreateFatalException(threadState, pending.ExceptionType, v, pending.ExceptionToken);
+		return false;
+	}
+
+	uint16_t pc;
+	EvaluationStack* stack;
+	VariableVector* locals;
+	VariableVector* arguments;
+	currentFrame->UpdatePc(CreateExceptionFrame(currentFrame, 0, c, v));
+	currentFrame->ActivateState(&pc, &stack, &locals, &arguments);
+	// When entering a catch frame, the execution stack is cleared and the exception pushed to it (for a catch handler)
+	ClearExecutionStack(stack);
+	if (c->ClauseType == ExceptionHandlingClauseOptions::Clause)
 	{
-		frame = frame->_next;
+		stack->push(v);
+
+		// Drop the top element of the exception stack. We can't throw it away entirely, because we might be inside an outer finally clause
+		ExceptionFrame* frame = currentFrame->_exceptionFrame;
+		ExceptionFrame* previous = nullptr;
+		// This chain is only required for the rare case where another exception (including handler) sits inside a finally clause.
+		while (frame->Next != nullptr)
+		{
+			previous = frame;
+			frame = frame->Next;
+		}
+
+		if (previous)
+		{
+			delete previous->Next;
+			previous->Next = nullptr;
+		}
+		else
+		{
+			delete currentFrame->_exceptionFrame;
+			currentFrame->_exceptionFrame = nullptr;
+		}
 	}
 
-	return frame;
+	return true;
 }
 
 /// <summary>
@@ -7656,60 +9048,51 @@ bool FirmataIlExecutor::LocateCatchHandler(ThreadState *threadState, ExecutionSt
 	while (newState != nullptr)
 	{
 		*clauseThatMatches = nullptr;
-		uint32_t indexOfClause = 0;
-		uint32_t key = newState->_executingMethod->GetKey();
-		// This may return null if we don't have any clauses in this method
-		ExceptionClause* c = _clauses.BinarySearchKey(key, indexOfClause);
+		int32_t methodToken = newState->_executingMethod->methodToken;
+		const MethodClauseTable* table;
+		{
+			ScopeLock lock;
+			table = _clauseTables.FindClauseTable(methodToken);
+		}
+
+		if (table == nullptr)
+		{
+			MethodClauseTable* newTable = MethodClauseCache::Build(methodToken, _clauses, _classes);
+			ScopeLock lock;
+			table = _clauseTables.AddClauseTable(newTable);
+		}
 
+		// The clauses are sorted by the length of their try block, so the first one that fits is the innermost one.
 		// TODO: This probably also needs to check whether we are in a frame already
 		ExceptionClause* bestClause = nullptr;
-		while (c && c->GetKey() == key)
+		for (uint16_t i = 0; i < table->Count; i++)
 		{
-			// exceptionToHandle is void (empty) if we're only looking for finally handlers
-			if (c->ClauseType == ExceptionHandlingClauseOptions::Clause && exceptionToHandle.Type != VariableKind::Void)
+			const ResolvedClause& rc = table->Clauses[i];
+			if (!rc.Covers(tryBlockOffset))
 			{
-				ClassDeclaration* catchType = GetClassWithToken(c->FilterToken, true);
-				// if the block offset where whe left the protected block (the try{} part) is within this handler's try block, it is a possible candidate
-				if (tryBlockOffset >= c->TryOffset && tryBlockOffset <= c->TryOffset + c->TryLength
-					&& IsAssignableFrom(catchType, exceptionToHandle) == MethodState::Running)
-				{
-					if (bestClause == nullptr)
-					{
-						bestClause = c;
-					}
-					else
-					{
-						// If multiple try blocks surround the code location in question, we use the shortest one
-						if (c->TryLength < bestClause->TryLength)
-						{
-							bestClause = c;
-						}
-					}
-				}
+				continue;
 			}
-			else if (c->ClauseType == ExceptionHandlingClauseOptions::Finally && tryBlockOffset >= c->TryOffset && tryBlockOffset <= c->TryOffset + c->TryLength)
+
+			// exceptionToHandle is void (empty) if we're only looking for finally handlers
+			if (rc.Clause->ClauseType == ExceptionHandlingClauseOptions::Clause && exceptionToHandle.Type != VariableKind::Void)
 			{
-				if (bestClause == nullptr)
+				ClassDeclaration* catchType = rc.CatchType;
+				if (catchType == nullptr)
 				{
-					bestClause = c;
+					// Throws, since the type is unknown
+					catchType = GetClassWithToken(rc.Clause->FilterToken, true);
 				}
-				else
+
+				if (IsAssignableFrom(catchType, exceptionToHandle) == MethodState::Running)
 				{
-					// If multiple try blocks surround the code location in question, we use the shortest one
-					if (c->TryLength < bestClause->TryLength)
-					{
-						bestClause = c;
-					}
+					bestClause = rc.Clause;
+					break;
 				}
 			}
-			indexOfClause++;
-			if (indexOfClause < _clauses.size())
+			else if (rc.Clause->ClauseType == ExceptionHandlingClauseOptions::Finally)
 			{
-				c = _clauses.at(indexOfClause);
-			}
-			else
-			{
-				c = nullptr;
+				bestClause = rc.Clause;
+				break;
 			}
 		}
 
@@ -7731,6 +9114,7 @@ bool FirmataIlExecutor::LocateCatchHandler(ThreadState *threadState, ExecutionSt
 			// We'll be using this handler. Now clean any stack frames below the one we are in
 			CleanStack(newState->_next);
 			newState->_next = nullptr;
+			threadState->innermostFrame = newState;
 			state = newState;
 			*clauseThatMatches = bestClause;
 			// We found an exception handler in a different function than where we ended up unwinding the stack. That's bad.
@@ -7744,13 +9128,11 @@ bool FirmataIlExecutor::LocateCatchHandler(ThreadState *threadState, ExecutionSt
 			return false;
 		}
 
-		ExecutionState* tempState = newState;
 		// Go up one stack frame
-		newState = threadState->rootOfExecutionStack;
-		tryBlockOffset = newState->CurrentPc(); // search from previous call location
-		while (newState != nullptr && newState->_next != tempState)
+		newState = newState->_previous;
+		if (newState != nullptr)
 		{
-			newState = newState->_next;
+			tryBlockOffset = newState->CurrentPc(); // search from previous call location
 		}
 	}
 	return false;
@@ -7917,7 +9299,7 @@ void FirmataIlExecutor::SendVariables(ExecutionState* stackFrame, uint32_t frame
 	SendReplyHeader(ExecutorCommand::Variables);
 	Firmata.sendPackedUInt14((uint16_t)stackFrame->TaskId());
 	uint16_t pc;
-	VariableDynamicStack* stack;
+	EvaluationStack* stack;
 	VariableVector* locals;
 	VariableVector* arguments;
 	stackFrame->ActivateState(&pc, &stack, &locals, &arguments);
@@ -7927,7 +9309,7 @@ void FirmataIlExecutor::SendVariables(ExecutionState* stackFrame, uint32_t frame
 	int idx = 0;
 	if (variableType == 2)
 	{
-		VariableDynamicStack::Iterator stackIterator = stack->GetIterator();
+		EvaluationStack::Iterator stackIterator = stack->GetIterator();
 		Variable* var;
 		while ((var = stackIterator.next()) != nullptr)
 		{
@@ -8006,20 +9388,18 @@ void FirmataIlExecutor::CreateFatalException(ThreadState* threadWithException, S
 	threadWithException->currentException.TokenOfException = hintToken;
 	threadWithException->currentException.ExceptionObject = managedException; // Must be of type object
 
-	ExecutionState* currentFrame = threadWithException->rootOfExecutionStack;
+	// Only the innermost MaxStackTokens frames are recorded. Find the outermost of these.
+	ExecutionState* currentFrame = threadWithException->innermostFrame;
+	for (int i = 1; i < RuntimeException::MaxStackTokens && currentFrame->_previous != nullptr; i++)
+	{
+		currentFrame = currentFrame->_previous;
+	}
+
 	int idx = 0;
 	memset(threadWithException->currentException.StackTokens, 0, RuntimeException::MaxStackTokens * sizeof(int));
 	memset(threadWithException->currentException.PerStackPc, 0, RuntimeException::MaxStackTokens * sizeof(uint16_t));
 	while (currentFrame != NULL)
 	{
-		if (idx >= RuntimeException::MaxStackTokens)
-		{
-			// If we have more than MaxStackTokens elements, shift the list and drop the first (lowest) elements
-			memmove(threadWithException->currentException.StackTokens, &threadWithException->currentException.StackTokens[1], sizeof(int) * (RuntimeException::MaxStackTokens - 1));
-			memmove(threadWithException->currentException.PerStackPc, &threadWithException->currentException.PerStackPc[1], sizeof(uint16_t) * (RuntimeException::MaxStackTokens - 1));
-			idx--;
-		}
-		
 		threadWithException->currentException.StackTokens[idx] = currentFrame->_executingMethod->methodToken;
 		threadWithException->currentException.PerStackPc[idx++] = currentFrame->CurrentPc();
 		currentFrame = currentFrame->_next;
@@ -8056,26 +9436,9 @@ MethodState FirmataIlExecutor::IsAssignableFrom(ClassDeclaration* typeToAssignTo
 		return MethodState::Running;
 	}
 
-	// If sourceType derives from typeToAssign, that works as well
-	ClassDeclaration* parent = _classes.GetClassWithToken(sourceType->ParentToken, false);
-	while (parent != nullptr)
-	{
-		if (parent->ClassToken == typeToAssignTo->ClassToken)
-		{
-			return MethodState::Running;
-		}
-		
-		parent = _classes.GetClassWithToken(parent->ParentToken, false);
-	}
-
-	// If the assignment target implements the source interface, that's fine
-	if (typeToAssignTo->ImplementsInterface(sourceType->ClassToken))
-	{
-		return MethodState::Running;
-	}
-
-	// if the assignment target is an interface implemented by source, that's fine
-	if (sourceType->ImplementsInterface(typeToAssignTo->ClassToken))
+	// If sourceType derives from typeToAssign or one of them is an interface implemented by the other, that works as well.
+	// The cache of the class list is not synchronized, so it can only be used while a single core executes code.
+	if (_classes.IsAssignableTo(sourceType, typeToAssignTo, !_dualCoreActive))
 	{
 		return MethodState::Running;
 	}
@@ -8136,36 +9499,15 @@ ClassDeclaration* FirmataIlExecutor::ResolveClassFromCtorToken(int32_t ctorToken
 	throw ClrException(SystemException::MissingMethod, ctorToken);
 }
 
-ClassDeclaration* FirmataIlExecutor::ResolveClassFromFieldToken(int32_t fieldToken)
+const FieldIndexEntry* FirmataIlExecutor::ResolveFieldToken(int32_t fieldToken)
 {
-	// Profiling shows that this method is a major performance bottleneck, therefore added a small cache
-	for (int i = 0; i < CACHE_LINES; i++)
+	const FieldIndexEntry* entry = _fieldIndex.Find(fieldToken, _classes);
+	if (entry == nullptr)
 	{
-		if (_fieldLookupCache[i].FieldToken == fieldToken)
-		{
-			return _fieldLookupCache[i].Cls;
-		}
-	}
-
-	for (auto iterator = _classes.GetIterator(); iterator.Next();)
-	{
-		// TRACE(Firmata.sendString(F("Class "), cls.ClassToken));
-		int idx = 0;
-		ClassDeclaration* current = iterator.Current();
-		for (auto field = current->GetFieldByIndex(idx); field != nullptr; field = current->GetFieldByIndex(++idx))
-		{
-			// TRACE(Firmata.sendString(F("Member "), member.Uint32));
-			if (field->Int32 == fieldToken)
-			{
-				_nextLookup = (_nextLookup + 1) % CACHE_LINES;
-				_fieldLookupCache[_nextLookup].Cls = current;
-				_fieldLookupCache[_nextLookup].FieldToken = fieldToken;
-				return current;
-			}
-		}
+		throw ClrException(SystemException::FieldAccess, fieldToken);
 	}
 
-	throw ClrException(SystemException::FieldAccess, fieldToken);
+	return entry;
 }
 
 /// <summary>
@@ -8237,6 +9579,14 @@ ExecutionError FirmataIlExecutor::LoadClassSignature(bool isLastPart, int32_t cl
 		
 		ClassDeclarationDynamic* newType = new(ptr) ClassDeclarationDynamic(classToken, parent, dynamicSize, staticSize, (ClassProperties)flags);
 		_classes.Insert(newType);
+		_fieldIndex.Invalidate();
+		// The field sites of the decoded methods point into the offset tables
+		_classes.InvalidateFieldOffsets();
+		_decodedMethods.clear();
+		_escapeAnalysis.clear();
+		_classes.InvalidateHierarchy();
+		// A catch type may have been unknown so far
+		_clauseTables.clear();
 		decl = newType;
 	}
 	
@@ -8268,6 +9618,10 @@ ExecutionError FirmataIlExecutor::LoadClassSignature(bool isLastPart, int32_t cl
 	{
 		v.setSize(DecodePackedUint14(argv + i));
 		decl->fieldTypes.push_back(v);
+		_fieldIndex.Invalidate();
+		_classes.InvalidateFieldOffsets();
+		_decodedMethods.clear();
+		_escapeAnalysis.clear();
 		if (isLastPart)
 		{
 			decl->fieldTypes.truncate();
@@ -8332,6 +9686,7 @@ ExecutionError FirmataIlExecutor::LoadInterfaces(int32_t classToken, byte argc,
 		ty->interfaceTokens.push_back(token);
 		i += 5;
 	}
+	_classes.InvalidateHierarchy();
 	return ExecutionError::None;
 }
 
@@ -8496,6 +9851,90 @@ ExecutionError FirmataIlExecutor::ExecuteDebuggerCommand(ExecutionState* state,
 	return ExecutionError::None;
 }
 
+/// <summary>
+/// Executes a command that selects or queries the execution engine. These are sent using the debugger command channel.
+/// </summary>
+ExecutionError FirmataIlExecutor::ExecuteEngineCommand(EngineCommand cmd, uint32_t arg1, uint32_t arg2)
+{
+	switch (cmd)
+	{
+	case EngineCommand::SetExecutionEngine:
+		if (arg1 > (uint32_t)ExecutionEngineMode::PreDecoded)
+		{
+			return ExecutionError::InvalidArguments;
+		}
+		// This can safely be changed while code is running, both engines operate on the same stack frames
+		_executionEngine = (ExecutionEngineMode)arg1;
+		if (_executionEngine == ExecutionEngineMode::Interpreter)
+		{
+			_decodedMethods.clear();
+		}
+		break;
+	case EngineCommand::PrintStatistics:
+		Firmata.sendStringf(F("Execution engine: %s"), _executionEngine == ExecutionEngineMode::PreDecoded ? "Pre-decoded" : "Interpreter");
+		Firmata.sendStringf(F("Decoded methods: %d, using %d bytes"), _decodedMethods.size(), _decodedMethods.MemoryUsage());
+		Firmata.sendStringf(F("Inlined call sites: %d (inlining %s)"), _decodedMethods.InlinedCallSites(), _decodedMethods.GetInlineCalls() ? "enabled" : "disabled");
+		Firmata.sendStringf(F("Instructions executed: %d, of which %d pre-decoded"), _instructionsExecuted, _decodedInstructionsExecuted);
+		Firmata.sendStringf(F("Virtual call site cache: %d hits, %d misses"), _callSiteCacheHits, _callSiteCacheMisses);
+		Firmata.sendStringf(F("Interned string literals: %d"), _stringLiterals.size());
+		Firmata.sendStringf(F("Quickened instructions: %d, of which %d were reverted"), _instructionsQuickened, _quickeningGuardFailures);
+		Firmata.sendStringf(F("Inflated monitor locks: %d (%d active)"), _locksInflated, _activeLocks.size());
+		Firmata.sendStringf(F("Exception clause tables: %d"), _clauseTables.size());
+		Firmata.sendStringf(F("Objects allocated in frames: %d, from %d allocation sites in %d methods"), _stackAllocations, _escapeAnalysis.StackAllocatableSites(), _escapeAnalysis.size());
+		Firmata.sendStringf(F("Tail calls: %d"), _tailCalls);
+		if (_schedulerMode == SchedulerMode::TimeBudget)
+		{
+			Firmata.sendStringf(F("Scheduler: Time slice of %dus, currently %dus"), _timeSliceMicros, CurrentTimeSlice(0));
+		}
+		else
+		{
+			Firmata.sendStringf(F("Scheduler: %d instructions per slice"), NUM_INSTRUCTIONS_AT_ONCE);
+		}
+		Firmata.sendStringf(F("Execution cores: %d"), ActiveCoreCount());
+		Firmata.sendStringf(F("Superinstructions: %s"), _decodedMethods.GetFuseInstructions() ? "Enabled" : "Disabled");
+		for (int i = 0; i < (int)DecodedHandler::NumberOfFusedHandlers; i++)
+		{
+			if (_superinstructionsExecuted[i] > 0)
+			{
+				Firmata.sendStringf(F("  %s: %d"), DecodedMethod::FusedHandlerName((DecodedHandler)((int)DecodedHandler::FirstFused + i)), _superinstructionsExecuted[i]);
+			}
+		}
+		break;
+	case EngineCommand::BenchmarkEvaluationStacks:
+	{
+		SelfTest test;
+		test.BenchmarkExecutionStacks(arg1 != 0 ? arg1 : 10000);
+	}
+		break;
+	case EngineCommand::SetSuperinstructions:
+		// Already decoded methods keep their code otherwise
+		_decodedMethods.SetFuseInstructions(arg1 != 0);
+		_decodedMethods.clear();
+		break;
+	case EngineCommand::SetInlining:
+		_decodedMethods.SetInlineCalls(arg1 != 0);
+		_decodedMethods.clear();
+		break;
+	case EngineCommand::SetDualCore:
+		return SetDualCoreMode(arg1 != 0);
+	case EngineCommand::SetScheduler:
+		if (arg1 > (uint32_t)SchedulerMode::TimeBudget)
+		{
+			return ExecutionError::InvalidArguments;
+		}
+		_schedulerMode = (SchedulerMode)arg1;
+		if (arg2 != 0)
+		{
+			_timeSliceMicros = MAX(arg2, MIN_TIME_SLICE_MICROS);
+		}
+		break;
+	default:
+		return ExecutionError::InvalidArguments;
+	}
+
+	return ExecutionError::None;
+}
+
 
 OPCODE DecodeOpcode(const BYTE *pCode, uint16_t *pdwLen)
 {
@@ -8525,6 +9964,11 @@ OPCODE DecodeOpcode(const BYTE *pCode, uint16_t *pdwLen)
     return opcode;
 }
 
+OPCODE_FORMAT GetOpcodeFormat(OPCODE opcode)
+{
+	return (OPCODE_FORMAT)pgm_read_byte(OpcodeInfo + opcode);
+}
+
 void FirmataIlExecutor::reset()
 {
 	KillCurrentTask(); // TODO: Or skip if running? At least we must not clear the memory while the task runs
@@ -8534,19 +9978,27 @@ void FirmataIlExecutor::reset()
 		freeEx(_stringHeapRam);
 		_stringHeapRam = nullptr;
 		_stringHeapRamSize = 0;
+		_stringHeapRamUsed = 0;
 	}
+	_stringDirectoryRam.clear(true);
 	
+	_decodedMethods.clear();
+	_escapeAnalysis.clear();
+	_fieldIndex.clear(false);
 	_methods.clear(false);
 	_classes.clear(false);
 	_constants.clear(false);
 	_clauses.clear(false);
+	_clauseTables.clear();
 
 	freeEx(_staticVector);
+	_staticFieldSlots.clear(true);
 	
 	_specialTypeListRamLength = 0;
 	freeEx(_specialTypeListRam);
 
 	_gc.Clear(true, false);
+	_stringLiterals.clear(true);
 	_weakDependencies.clear(true);
 	ClearHandles();
 	
@@ -22,10 +22,14 @@
 #include "Variable.h"
 #include "VariableVector.h"
 #include "VariableDynamicStack.h"
+#include "VariableFixedStack.h"
 #include "VariableList.h"
 #include "ClassDeclaration.h"
 #include "MethodBody.h"
 #include "GarbageCollector.h"
+#include "DecodedMethod.h"
+#include "EscapeAnalysis.h"
+#include "MultiCore.h"
 
 #include "interface/NativeMethod.h"
 #include "interface/SystemException.h"
@@ -37,6 +41,7 @@
 #include "interface/BreakpointType.h"
 
 class LowlevelInterface;
+struct BlockHd;
 using namespace stdSimple;
 
 #ifndef NO_DEBUGGER_SUPPORT
@@ -51,6 +56,8 @@ enum class MethodState
 	Aborted = 1,
 	Running = 2,
 	Killed = 3,
+	// A managed exception was raised and is waiting in ThreadState::pendingException to be dispatched to its handler
+	Exception = 4,
 };
 
 enum class ExecutionError : byte
@@ -81,11 +88,70 @@ enum class TriStateBool
 #define STANDARD_ERROR_HANDLE 0xCEEF
 
 #define MAX_THREADS 10
-#define MAX_LOCKS 10
 #define MAX_HANDLES 10
-#define CACHE_LINES 4
 
 const int NUM_INSTRUCTIONS_AT_ONCE = 50;
+// Safety limit for the number of instructions in one time slice
+const int MAX_INSTRUCTIONS_PER_TIME_SLICE = 100000;
+
+/// <summary>
+/// Decides when ExecuteIlCode returns to the main loop
+/// </summary>
+enum class SchedulerMode
+{
+	// Return after NUM_INSTRUCTIONS_AT_ONCE instructions, regardless of how long they take
+	InstructionCount = 0,
+	// Return when the time slice is used up. The time is checked at backward branches and calls.
+	TimeBudget = 1,
+};
+
+#ifndef DEFAULT_SCHEDULER_MODE
+#define DEFAULT_SCHEDULER_MODE SchedulerMode::InstructionCount
+#endif
+
+#ifndef DEFAULT_TIME_SLICE_MICROS
+#define DEFAULT_TIME_SLICE_MICROS 2000
+#endif
+
+// The time slice is never shortened below this
+#define MIN_TIME_SLICE_MICROS 100
+
+/// <summary>
+/// The engine used to execute IL code
+/// </summary>
+enum class ExecutionEngineMode : byte
+{
+	// Decode every instruction from the IL stream each time it is executed
+	Interpreter = 0,
+	// Methods are translated to a pre-decoded instruction stream when they're first executed. Instructions that
+	// the pre-decoded engine doesn't support are still executed by the interpreter.
+	PreDecoded = 1,
+};
+
+#ifndef DEFAULT_EXECUTION_ENGINE
+#define DEFAULT_EXECUTION_ENGINE ExecutionEngineMode::PreDecoded
+#endif
+
+/// <summary>
+/// Additional commands that are sent using the DebuggerCommand channel. They're numbered above the debugger commands
+/// </summary>
+enum class EngineCommand
+{
+	First = 0x40,
+	// Arg1: The new ExecutionEngineMode
+	SetExecutionEngine = 0x40,
+	PrintStatistics = 0x41,
+	// Arg1: Number of iterations
+	BenchmarkEvaluationStacks = 0x42,
+	// Arg1: 1 to enable the superinstructions of the pre-decoded engine, 0 to disable them
+	SetSuperinstructions = 0x43,
+	// Arg1: The new SchedulerMode, Arg2: The time slice in microseconds (0 to keep the current value)
+	SetScheduler = 0x44,
+	// Arg1: 1 to execute the managed threads on two cores, 0 to use only the main loop
+	SetDualCore = 0x45,
+	// Arg1: 1 to inline calls to trivial methods in the pre-decoded engine, 0 to always call them
+	SetInlining = 0x46,
+};
 
 // The function prototype for critical finalizer functions (closing file handles, releasing mutexes etc.)
 typedef void (*FinalizerFunction)(void*);
@@ -126,6 +192,19 @@ public:
 	short PerStackPc[MaxStackTokens];
 };
 
+/// <summary>
+/// A managed exception on its way to its handler. Raising one is just a return value, so that managed exceptions
+/// don't need a C++ throw. If no exception object exists yet (a system exception), it is created from the type and the
+/// message when the exception is dispatched.
+/// </summary>
+struct PendingException
+{
+	void* ExceptionObject;
+	SystemException ExceptionType;
+	int ExceptionToken;
+	const char* Message;
+};
+
 /// <summary>
 /// Represents the current exception handler stack
 /// This is used to track returning to the correct position within a handler, particularly if
@@ -168,12 +247,123 @@ public:
 	ClassDeclaration* BottomClass;
 };
 
+// The evaluation stack of the stack frames. VariableDynamicStack has the same interface and can be used instead.
+typedef VariableFixedStack EvaluationStack;
+
+#ifdef ARDUINO_DUE
+const uint32_t FRAME_ARENA_SIZE = 2048;
+#else
+const uint32_t FRAME_ARENA_SIZE = 8 * 1024;
+#endif
+
+/// <summary>
+/// The memory for the stack frames of one thread. Frames are allocated and released in stack order, so this is just a
+/// bump allocator. When it is full, frames are allocated from the heap instead.
+/// </summary>
+class FrameArena
+{
+private:
+	byte* _begin;
+	uint32_t _size;
+	uint32_t _used;
+public:
+	FrameArena()
+	{
+		_begin = nullptr;
+		_size = 0;
+		_used = 0;
+	}
+
+	~FrameArena()
+	{
+		freeEx(_begin);
+	}
+
+	/// <summary>
+	/// Rounds a size up so that all blocks stay aligned for 8-byte values
+	/// </summary>
+	static size_t Align(size_t bytes)
+	{
+		return (bytes + 7) & ~7;
+	}
+
+	/// <summary>
+	/// Returns a block of the given size, or null if the arena is full
+	/// </summary>
+	void* Allocate(size_t bytes)
+	{
+		if (_begin == nullptr)
+		{
+			// The memory is only reserved when the thread calls its first method
+			_begin = (byte*)mallocEx(FRAME_ARENA_SIZE);
+			if (_begin == nullptr)
+			{
+				return nullptr;
+			}
+			_size = FRAME_ARENA_SIZE;
+		}
+
+		bytes = Align(bytes);
+		if (_used + bytes > _size)
+		{
+			return nullptr;
+		}
+
+		void* ret = _begin + _used;
+		_used += bytes;
+		return ret;
+	}
+
+	/// <summary>
+	/// Releases the given block and everything that was allocated after it.
+	/// Blocks that are already released (because a block below them was released first) are ignored.
+	/// </summary>
+	void Release(void* block)
+	{
+		byte* ptr = (byte*)block;
+		if (ptr >= _begin && ptr < _begin + _used)
+		{
+			_used = ptr - _begin;
+		}
+	}
+
+	uint32_t BytesUsed() const
+	{
+		return _used;
+	}
+
+	/// <summary>
+	/// True if the address lies within the given block or anything that was allocated after it
+	/// </summary>
+	bool IsAtOrAbove(const void* block, const void* address) const
+	{
+		return (const byte*)address >= (const byte*)block && (const byte*)address < _begin + _used;
+	}
+};
+
+/// <summary>
+/// An object that was allocated in the frame arena, because it never leaves the method that created it. The object data follows
+/// the header and is released together with the frame. Since no heap object can refer to it, the garbage collector marks its
+/// fields as roots while the frame exists.
+/// </summary>
+struct StackObject
+{
+	StackObject* Next;
+	uint32_t Size;
+
+	void* Object()
+	{
+		return this + 1;
+	}
+};
 
 class ExecutionState
 {
 	private:
 	uint16_t _pc;
-	VariableDynamicStack _executionStack;
+	// The arena this frame lives in, or null if it was allocated from the heap
+	FrameArena* _arena;
+	EvaluationStack _executionStack;
 	VariableVector _locals;
 	VariableVector _arguments;
 	int _taskId;
@@ -181,24 +371,70 @@ class ExecutionState
 	public:
 	// Next inner execution frame (the innermost frame is being executed) 
 	ExecutionState* _next;
+	// The calling frame (null for the root frame)
+	ExecutionState* _previous;
 	MethodBody* _executingMethod;
 	VariableList _localStorage; // Memory allocated by localloc
 	ExceptionFrame* _exceptionFrame;
+	// Objects allocated in the arena by this frame (newest first)
+	StackObject* _stackObjects;
 
-	ExecutionState(int taskId, uint16_t maxStack, MethodBody* executingMethod) :
-		_pc(0), _executionStack(MAX(maxStack, 10)),
-		_locals(), _arguments(), _exceptionFrame(nullptr)
+	ExecutionState(int taskId, uint16_t maxStack, MethodBody* executingMethod, FrameArena* arena = nullptr, byte* stackMemory = nullptr,
+		byte* localsMemory = nullptr, byte* argumentsMemory = nullptr) :
+		_pc(0), _arena(arena), _executionStack(MAX(maxStack, 10), stackMemory),
+		_locals(), _arguments(), _exceptionFrame(nullptr), _stackObjects(nullptr)
 	{
 		// Firmata.sendString(F("ExecutionState ctor"));
-		_locals.InitFrom(executingMethod->NumberOfLocals(), executingMethod->GetLocalsIterator());
-		_arguments.InitFrom(executingMethod->NumberOfArguments(), executingMethod->GetArgumentTypesIterator());
+		_locals.InitFrom(executingMethod->NumberOfLocals(), executingMethod->GetLocalsIterator(), localsMemory);
+		_arguments.InitFrom(executingMethod->NumberOfArguments(), executingMethod->GetArgumentTypesIterator(), argumentsMemory);
 		_taskId = taskId;
 		_next = nullptr;
+		_previous = nullptr;
 		_executingMethod = executingMethod;
 	}
+
+	/// <summary>
+	/// Creates a stack frame for the given method. If possible, the frame, its evaluation stack, its locals and its arguments are
+	/// placed together in the given arena, otherwise they're allocated from the heap. Use Destroy to delete the frame.
+	/// </summary>
+	static ExecutionState* Create(FrameArena* arena, int taskId, MethodBody* method)
+	{
+		uint16_t maxStack = method->MaxExecutionStack();
+		if (arena != nullptr)
+		{
+			size_t headerBytes = FrameArena::Align(sizeof(ExecutionState));
+			size_t stackBytes = FrameArena::Align(EvaluationStack::RequiredBytes(MAX(maxStack, 10)));
+			size_t localsBytes = FrameArena::Align(VariableVector::RequiredBytes(method->NumberOfLocals(), method->GetLocalsIterator()));
+			size_t argumentsBytes = FrameArena::Align(VariableVector::RequiredBytes(method->NumberOfArguments(), method->GetArgumentTypesIterator()));
+			byte* memory = (byte*)arena->Allocate(headerBytes + stackBytes + localsBytes + argumentsBytes);
+			if (memory != nullptr)
+			{
+				byte* stackMemory = memory + headerBytes;
+				byte* localsMemory = stackMemory + stackBytes;
+				byte* argumentsMemory = localsMemory + localsBytes;
+				return new(memory) ExecutionState(taskId, maxStack, method, arena, stackMemory, localsMemory, argumentsMemory);
+			}
+		}
+
+		return new ExecutionState(taskId, maxStack, method);
+	}
+
+	static void Destroy(ExecutionState* state)
+	{
+		FrameArena* arena = state->_arena;
+		if (arena == nullptr)
+		{
+			delete state;
+			return;
+		}
+
+		state->~ExecutionState();
+		arena->Release(state);
+	}
 	~ExecutionState()
 	{
 		_next = nullptr;
+		_previous = nullptr;
 		while (_exceptionFrame)
 		{
 			ExceptionFrame *temp = _exceptionFrame->Next;
@@ -209,7 +445,56 @@ class ExecutionState
 		_exceptionFrame = nullptr;
 	}
 	
-	void ActivateState(uint16_t* pc, VariableDynamicStack** stack, VariableVector** locals, VariableVector** arguments)
+	/// <summary>
+	/// Allocates zeroed memory for an object in the arena of this frame, so that it is released when the frame is destroyed.
+	/// Returns null if the frame is not in an arena or the arena is full. Must only be called while this is the innermost frame.
+	/// </summary>
+	void* AllocateStackObject(uint32_t size)
+	{
+		if (_arena == nullptr)
+		{
+			return nullptr;
+		}
+
+		StackObject* entry = (StackObject*)_arena->Allocate(sizeof(StackObject) + size);
+		if (entry == nullptr)
+		{
+			return nullptr;
+		}
+
+		memset(entry->Object(), 0, size);
+		entry->Size = size;
+		entry->Next = _stackObjects;
+		_stackObjects = entry;
+		return entry->Object();
+	}
+
+	/// <summary>
+	/// Prepares the frame for executing its method again from the start (a recursive tail call): The locals are set back to
+	/// their initial value and the evaluation stack is emptied. The caller then sets the new arguments.
+	/// </summary>
+	void RestartMethod()
+	{
+		_pc = 0;
+		_executionStack.clear();
+		_locals.Reinitialize(_executingMethod->NumberOfLocals(), _executingMethod->GetLocalsIterator());
+	}
+
+	/// <summary>
+	/// True if the address may point into the memory of this frame. Must only be called for the innermost frame.
+	/// For frames outside the arena, this is always true.
+	/// </summary>
+	bool OwnsAddress(const void* address) const
+	{
+		if (_arena == nullptr)
+		{
+			return true;
+		}
+
+		return _arena->IsAtOrAbove(this, address);
+	}
+
+	void ActivateState(uint16_t* pc, EvaluationStack** stack, VariableVector** locals, VariableVector** arguments)
 	{
 		*pc = _pc;
 		*stack = &_executionStack;
@@ -264,6 +549,29 @@ class ExecutionState
 	}
 };
 
+/// <summary>
+/// What a thread is blocked on. Blocked threads are not scheduled until the object they wait for wakes them.
+/// </summary>
+enum class ThreadWaitReason : byte
+{
+	// The thread is runnable
+	None = 0,
+	// Waiting for a monitor lock held by another thread. The wait object is the locked object.
+	MonitorLock = 1,
+	// Waiting for an EventWaitHandle to become signaled
+	Event = 2,
+	// Waiting for another thread (a ThreadState) to end
+	Join = 3,
+	// Waiting only for the deadline of the thread (Thread.Sleep)
+	Sleep = 4,
+};
+
+// ThreadState::waitDeadline when the thread is not in a timed wait
+#define NO_WAIT_DEADLINE -1
+
+// Shorter sleeps are done by busy waiting, for better precision
+#define MIN_BLOCKING_SLEEP_MICROS 1000
+
 class ThreadState
 {
 public:
@@ -271,22 +579,78 @@ public:
 		: threadStatics(), managedThreadInstance(VariableKind::Object)
 	{
 		rootOfExecutionStack = nullptr;
+		innermostFrame = nullptr;
 		threadId = id;
 		threadFlags = 0;
-		waitTimeout = -2; // Not set
+		waitDeadline = NO_WAIT_DEADLINE;
+		waitReason = ThreadWaitReason::None;
+		waitObject = nullptr;
+		nextWaiter = nullptr;
+		joinWaiters = nullptr;
+		heldThinLocks = 0;
+		pendingException.ExceptionObject = nullptr;
+		pendingException.ExceptionType = SystemException::None;
+		pendingException.ExceptionToken = 0;
+		pendingException.Message = nullptr;
+	}
+
+	bool IsRunnable() const
+	{
+		return rootOfExecutionStack != nullptr && waitReason == ThreadWaitReason::None;
+	}
+
+	/// <summary>
+	/// Makes the given frame the new innermost frame (a method call)
+	/// </summary>
+	void PushFrame(ExecutionState* frame)
+	{
+		innermostFrame->_next = frame;
+		frame->_previous = innermostFrame;
+		innermostFrame = frame;
+	}
+
+	/// <summary>
+	/// Removes the innermost frame from the stack and returns it (a method return). The caller must destroy it.
+	/// </summary>
+	ExecutionState* PopFrame()
+	{
+		ExecutionState* frame = innermostFrame;
+		innermostFrame = frame->_previous;
+		innermostFrame->_next = nullptr;
+		frame->_previous = nullptr;
+		return frame;
 	}
 
 	int threadId;
 	ExecutionState* rootOfExecutionStack;
+	PendingException pendingException;
+	// The frame that is being executed. Cached, so that neither method returns nor the start of each time slice need to walk the stack.
+	ExecutionState* innermostFrame;
 	RuntimeException currentException;
 	VariableList threadStatics;
 	Variable managedThreadInstance;
 	// Bit 0: Thread pool thread (for IsThreadPoolThread property)
 	// Bit 1: Background thread (for IsBackground property)
 	int threadFlags;
-	int waitTimeout; // global per-thread variable for timeouts in wait functions
+	// The TickCount64 value at which the current timed wait ends. Stays set while the wait operation is retried.
+	int64_t waitDeadline;
+	// Memory for the stack frames of this thread (except the root frame of the main thread)
+	FrameArena frameArena;
+	ThreadWaitReason waitReason;
+	// The object the thread is blocked on (see ThreadWaitReason)
+	void* waitObject;
+	// The next thread in the same wait queue
+	ThreadState* nextWaiter;
+	// The threads waiting for this thread to end
+	ThreadState* joinWaiters;
+	// The number of objects this thread has locked in their header
+	int heldThinLocks;
 };
 
+/// <summary>
+/// An inflated monitor. Locks are normally kept in the header of the object (see BlockHd). They're moved here when another
+/// thread needs to wait for them, when they're nested too deep or when the object is not on the managed heap.
+/// </summary>
 class MonitorLock
 {
 public:
@@ -295,13 +659,14 @@ public:
 		object = nullptr;
 		owningThread = nullptr;
 		lockCount = 0;
-		endTime = 0;
+		waiters = nullptr;
 	}
 
 	void* object;
 	ThreadState* owningThread;
 	int lockCount;
-	int endTime;
+	// The threads waiting for this lock to be released
+	ThreadState* waiters;
 };
 
 class EventWaitHandle
@@ -312,11 +677,14 @@ public:
 		handle = -1;
 		signaled = false;
 		flags = 0;
+		waiters = nullptr;
 	}
 
 	int handle;
 	bool signaled;
 	byte flags; // 1 = Manual reset 2 = Initially signaled
+	// The threads waiting for this handle to become signaled
+	ThreadState* waiters;
 };
 
 class Breakpoint
@@ -334,34 +702,68 @@ public:
 	int Pc;
 };
 
+/// <summary>
+/// Holds the global lock for the current scope. Since this disables the interrupts on single-core boards, only the
+/// lookups and updates of shared tables should be done under it. Expensive work, such as building a new cache entry or
+/// allocating memory, should be done outside, and the result added under the lock afterwards.
+/// </summary>
 class ScopeLock
 {
 public:
 	ScopeLock()
 	{
-		// TODO: Take a global mutex, so that really only one CPU core can be in a scope lock
-		noInterrupts();
+		CoreLockEnter();
 	}
 
 	~ScopeLock()
 	{
-		interrupts();
+		CoreLockExit();
 	}
 };
 
-class FieldLookupCacheEntry
+/// <summary>
+/// A string literal that was already loaded by ldstr. Since strings are immutable, each literal needs only one instance.
+/// </summary>
+struct StringLiteral
 {
-public:
-	FieldLookupCacheEntry()
+	int32_t Token;
+	void* Instance;
+
+	int32_t GetKey() const
 	{
-		FieldToken = 0;
-		Cls = nullptr;
+		return Token;
 	}
+};
+
+/// <summary>
+/// Location of a string within the string heap
+/// </summary>
+struct StringHeapEntry
+{
+	int32_t Token;
+	// Offset of the string data (after the token)
+	uint32_t Offset;
 
-	int FieldToken;
-	ClassDeclaration* Cls;
+	int32_t GetKey() const
+	{
+		return Token;
+	}
 };
 
+/// <summary>
+/// Location of a static field within the static vector
+/// </summary>
+struct StaticFieldSlot
+{
+	int32_t Token;
+	// Offset of the field's Variable header (after the token)
+	uint32_t Offset;
+
+	int32_t GetKey() const
+	{
+		return Token;
+	}
+};
 
 class FirmataIlExecutor: public FirmataFeature
 {
@@ -376,8 +778,33 @@ class FirmataIlExecutor: public FirmataFeature
 
 	boolean handleSysex(byte command, byte argc, byte* argv) override;
 	void reset() override;
-	int ThreadToSchedule();
+	int ThreadToSchedule(int core);
+	void BlockThread(ThreadState* thread, ThreadWaitReason reason, void* waitObject, ThreadState** queue);
+	void WakeWaiters(ThreadState** queue);
+	void RemoveFromWaitQueue(ThreadState* thread);
+	void WakeSignaledEventWaiters();
+	void StartTimedWait(ThreadState* thread, int32_t timeoutMillis);
+	bool TimedWaitExpired(ThreadState* thread) const;
+	void EndTimedWait(ThreadState* thread);
+	void RemoveFromTimerQueue(ThreadState* thread);
+	void WakeExpiredTimers();
+	int RunnableThreadCount(int core);
+	uint32_t CurrentTimeSlice(int core);
 	void report(bool elapsed) override;
+	void SecondCoreLoop();
+
+	/// <summary>
+	/// The core that executes the given thread. The main thread always runs on core 0, which is the core of the main loop.
+	/// </summary>
+	int CoreOfThread(int threadId) const
+	{
+		return (_dualCoreActive && (threadId & 1)) ? 1 : 0;
+	}
+
+	int ActiveCoreCount() const
+	{
+		return _dualCoreActive ? NUMBER_OF_EXECUTION_CORES : 1;
+	}
 
 	void Init();
 
@@ -395,6 +822,8 @@ class FirmataIlExecutor: public FirmataFeature
 	static char* GetAsUtf8String(const wchar_t* stringData, int length);
 	TriStateBool MonitorTryEnter(ThreadState* currentThread, void* object, int timeout);
 	bool MonitorExit(ThreadState* currentThread, void* object, bool throwIfNotOwned);
+	int FindInflatedLock(void* object);
+	int InflateLock(void* object, BlockHd* header);
 	ThreadState* FindThread(Variable& threadVar) const;
 	TriStateBool MonitorWait(ThreadState* currentThread, void* object, int timeout);
 
@@ -422,6 +851,7 @@ class FirmataIlExecutor: public FirmataFeature
 	ExecutionError LoadSpecialTokens(uint32_t totalListLength, uint32_t offset, byte argc, byte* argv);
 	ExecutionError LoadExceptionClause(int methodToken, int clauseType, int tryOffset, int tryLength, int handlerOffset, int handlerLength, int exceptionFilterToken);
 	ExecutionError ExecuteDebuggerCommand(ExecutionState* state, DebuggerCommand cmd, uint32_t arg1, uint32_t arg2);
+	ExecutionError ExecuteEngineCommand(EngineCommand cmd, uint32_t arg1, uint32_t arg2);
 	ExecutionError LoadGlobalMetadata(uint32_t staticVectorMemorySize);
 
 	int ReverseSearchSpecialTypeList(int32_t genericToken, bool tokenListContainsTypes, void* tokenList);
@@ -443,8 +873,8 @@ class FirmataIlExecutor: public FirmataFeature
 	void* Stfld(MethodBody* currentMethod, Variable& obj, int32_t token, Variable& var);
 	Variable Box(Variable& value, ClassDeclaration* ty);
 
-	void ClearExecutionStack(VariableDynamicStack* stack);
-    MethodState BasicStackInstructions(ExecutionState* state, uint16_t PC, VariableDynamicStack* stack, VariableVector* locals, VariableVector* arguments,
+	void ClearExecutionStack(EvaluationStack* stack);
+    MethodState BasicStackInstructions(ThreadState* threadState, ExecutionState* state, uint16_t PC, EvaluationStack* stack, VariableVector* locals, VariableVector* arguments,
 	                                   OPCODE instr, Variable& value1, Variable& value2, Variable& value3);
 	int AllocateArrayInstance(int tokenOfArrayType, int numberOfElements, Variable& result);
 
@@ -462,16 +892,25 @@ class FirmataIlExecutor: public FirmataFeature
     int GetHandleFromType(Variable& object) const;
     MethodState IsAssignableFrom(ClassDeclaration* typeToAssignTo, const Variable& object);
     void SetField4(ClassDeclaration* type, const Variable& data, Variable& instance, int fieldNo);
-    Variable& GetVariableDescription(ClassDeclaration* vtable, int32_t token);
     int MethodMatchesArgumentTypes(MethodBody* declaration, Variable& argumentArray);
 	bool LocateCatchHandler(ThreadState* threadState, ExecutionState*& state, int tryBlockOffset,
 	                        Variable& exceptionToHandle, ExceptionClause** clauseThatMatches);
+	MethodState RaiseException(ThreadState* threadState, SystemException exceptionType, int exceptionToken);
+	MethodState RaiseException(ThreadState* threadState, const char* message, SystemException exceptionType, int exceptionToken);
+	MethodState RaiseException(ThreadState* threadState, Variable& exceptionObject, int exceptionToken);
+	bool DispatchPendingException(ThreadState* threadState, ExecutionState*& currentFrame, uint16_t PC);
 	bool CheckForBreakCondition(ExecutionState* state, uint16_t pc, byte* code);
 	void SendDebugState(ExecutionState* executionState);
 	void SendVariables(ExecutionState* stackFrame, uint32_t frameNo, int variableType);
 	void SendVariable(const Variable& variable, int& idx);
 	MethodState ExecuteIlCode(ThreadState* threadState, Variable* returnValue);
-	ExecutionState* PreviousStackFrame(ThreadState* thread, ExecutionState* currentFrame) const;
+	int ExecuteDecodedCode(DecodedMethod* decodedMethod, uint16_t& PC, EvaluationStack* stack, VariableVector* locals, VariableVector* arguments, int budget, DecodedInstruction*& stoppedAt);
+	DecodedMethod* GetDecodedCode(ThreadState* thread, MethodBody* method);
+	void ReleaseLocksOfThread(int threadId);
+	void CollectGarbage(int generation);
+	ExecutionError SetDualCoreMode(bool enable);
+	bool CanTailCall(ThreadState* threadState, ExecutionState* currentFrame, MethodBody* newMethod, EvaluationStack* stack);
+	const FieldOffsetEntry* ResolveFieldSite(FieldSite* site, Variable& obj);
 	void SignExtend(Variable& variable, int inputSize);
 	ClassDeclaration* GetTypeFromTypeInstance(Variable& ownTypeInstance);
 	bool StringEquals(const VariableVector& args, int stringComparison);
@@ -480,7 +919,7 @@ class FirmataIlExecutor: public FirmataFeature
     void* CreateInstance(ClassDeclaration* cls);
 	void* CreateInstanceOfClass(int32_t typeToken, uint32_t length, bool throwIfNotFound = true);
     ClassDeclaration* ResolveClassFromCtorToken(int32_t ctorToken);
-    ClassDeclaration* ResolveClassFromFieldToken(int32_t fieldToken);
+	const FieldIndexEntry* ResolveFieldToken(int32_t fieldToken);
     static uint16_t SizeOfClass(ClassDeclaration* cls);
 	uint32_t DecodeUint32(byte* argv);
 	void SendUint32(uint32_t value);
@@ -494,13 +933,15 @@ class FirmataIlExecutor: public FirmataFeature
 	uint32_t ReadUint32FromArbitraryAddress(byte* pCode);
 	uint16_t CreateExceptionFrame(ExecutionState* currentFrame, uint16_t continuationAddress, ExceptionClause* c, Variable &exception);
 	Variable CreateStringInstance(size_t length, const char* string);
+	Variable GetStringLiteral(int32_t stringToken);
 	void SendQueryHardwareReply();
 
 	char* GetString(int stringToken, int& length);
-	byte* GetString(byte* heap, int stringToken, int& length);
 	byte* GetConstant(int token);
 
 	void* CopyStringsToFlash();
+	void* CopyStringDirectoryToFlash();
+	void ReadStringDirectoryFromFlash(void* flashAddress);
 	int* CopySpecialTokenListToFlash();
 
 	void InitStaticVector();
@@ -508,27 +949,48 @@ class FirmataIlExecutor: public FirmataFeature
 
 	GarbageCollector _gc;
 	uint32_t _instructionsExecuted;
+	// Number of instructions executed by the pre-decoded engine (this is a subset of the above)
+	uint32_t _decodedInstructionsExecuted;
 	uint32_t _taskStartTime;
 	ThreadState* _threads[MAX_THREADS];
-	MonitorLock _activeLocks[MAX_LOCKS]; // Monitor locks - assume a constant maximum number of simultaneous locks
+	stdSimple::vector<MonitorLock> _activeLocks; // Inflated monitor locks
 	EventWaitHandle _waitHandles[MAX_HANDLES];
-	int _lastThreadRun;
+	// The threads in a timed wait, sorted by their deadline
+	ThreadState* _timerQueue[MAX_THREADS];
+	int _timerQueueCount;
+	int _lastThreadRun[NUMBER_OF_EXECUTION_CORES];
+	// True while the second core executes managed threads
+	bool _dualCoreActive;
+	WorldLock _world;
+	SchedulerMode _schedulerMode;
+	uint32_t _timeSliceMicros;
 
 	SortedClassList _classes;
 	SortedMethodList _methods;
 	SortedClauseList _clauses;
+	// Pre-resolved clauses of the methods that were unwound, built from _clauses
+	MethodClauseCache _clauseTables;
 
 	uint32_t _staticVectorMemorySize;
 	byte* _staticVector;
+	// Index into _staticVector, sorted by token
+	stdSimple::vector<StaticFieldSlot> _staticFieldSlots;
 
 	// Constant data fields (such as array initializers). Does not include the string heap
 	SortedConstantList _constants;
 
-	// The string heap. Just a bunch of strings. The token/length field is used to iterate trough it
+	// The string heap. Just a bunch of strings, each prefixed with its token/length field
 	byte* _stringHeapRam;
 	byte* _stringHeapFlash;
 	
 	uint32_t _stringHeapRamSize;
+	// Number of bytes of the RAM heap already in use
+	uint32_t _stringHeapRamUsed;
+
+	// The directories of the string heaps, sorted by token
+	stdSimple::vector<StringHeapEntry> _stringDirectoryRam;
+	StringHeapEntry* _stringDirectoryFlash;
+	uint32_t _stringDirectoryFlashCount;
 
 	int* _specialTypeListRam;
 	int* _specialTypeListFlash;
@@ -539,7 +1001,6 @@ class FirmataIlExecutor: public FirmataFeature
 	bool _startedFromFlash;
 
 	// An empty instance of type Variable, used for error returns where a "null reference" would be required
-	Variable _clearVariable;
 	FlashMemoryManager* _flashMemoryManager;
 	stdSimple::vector<LowlevelInterface*> _lowLevelLibraries;
 	uint32_t _lastError;
@@ -559,8 +1020,26 @@ class FirmataIlExecutor: public FirmataFeature
 	stdSimple::vector<Breakpoint> _breakpoints;
 	Breakpoint _nextStepBehavior;
 
-	FieldLookupCacheEntry _fieldLookupCache[CACHE_LINES];
-	bool _nextLookup;
+	FieldTokenIndex _fieldIndex;
+
+	ExecutionEngineMode _executionEngine;
+	DecodedMethodCache _decodedMethods;
+	uint32_t _callSiteCacheHits;
+	uint32_t _callSiteCacheMisses;
+	// How often each superinstruction was executed
+	uint32_t _superinstructionsExecuted[(int)DecodedHandler::NumberOfFusedHandlers];
+	// Number of instructions that were specialised for the type of their operands, and how often such a specialisation had to be undone
+	uint32_t _instructionsQuickened;
+	uint32_t _quickeningGuardFailures;
+	uint32_t _locksInflated;
+	// The allocation sites whose objects can live in the frame of the creating method, and how many objects were created there
+	EscapeAnalysis _escapeAnalysis;
+	uint32_t _stackAllocations;
+	// Calls that replaced or reused the frame of the calling method
+	uint32_t _tailCalls;
+
+	// The string instances created by ldstr, sorted by token. These are GC roots.
+	stdSimple::vector<StringLiteral> _stringLiterals;
 public:
 	// Currently public, because DependentHandle is separate
 	stdSimple::vector<pair<void*, void*>> _weakDependencies; // Garbage collector weak dependencies (created using DependentObject)
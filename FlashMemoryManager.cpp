@@ -42,6 +42,10 @@ public:
 	void* Constants;
 	void* Clauses;
 	void* StringHeap;
+	// The token directory of the string heap
+	void* StringDirectory;
+	// The global field token index (see FieldTokenIndex)
+	void* FieldIndex;
 	byte* EndOfHeap;
 	int* SpecialTokenList;
 	
@@ -102,8 +106,8 @@ long FlashMemoryManager::UsedFlashMemory()
 
 
 
-void FlashMemoryManager::Init(void*& classes, void*& methods, void*& constants, void*& stringHeap, int*& specialTokenList,
-	void*& clauses, int& startupToken, int& startupFlags, uint32_t& staticVectorMemorySize)
+void FlashMemoryManager::Init(void*& classes, void*& methods, void*& constants, void*& stringHeap, void*& stringDirectory, int*& specialTokenList,
+	void*& clauses, void*& fieldIndex, int& startupToken, int& startupFlags, uint32_t& staticVectorMemorySize)
 {
 	bool tryRead = ValidateFlashContents();
 	if (tryRead && _header->DataVersion != -1 && _header->DataVersion != 0)
@@ -114,7 +118,9 @@ void FlashMemoryManager::Init(void*& classes, void*& methods, void*& constants,
 		methods = _header->Methods;
 		constants = _header->Constants;
 		clauses = _header->Clauses;
+		fieldIndex = _header->FieldIndex;
 		stringHeap = _header->StringHeap;
+		stringDirectory = _header->StringDirectory;
 		startupToken = _header->StartupToken;
 		startupFlags = _header->StartupFlags;
 		specialTokenList = _header->SpecialTokenList;
@@ -126,7 +132,9 @@ void FlashMemoryManager::Init(void*& classes, void*& methods, void*& constants,
 		methods = nullptr;
 		constants = nullptr;
 		stringHeap = nullptr;
+		stringDirectory = nullptr;
 		clauses = nullptr;
+		fieldIndex = nullptr;
 		startupToken = 0;
 		startupFlags = 0;
 		specialTokenList = nullptr;
@@ -225,7 +233,7 @@ void FlashMemoryManager::CopyToFlash(void* src, void* flashTarget, size_t length
 }
 
 void FlashMemoryManager::WriteHeader(int dataVersion, int hashCode, void* classesPtr, void* methodsPtr, void* constantsPtr,
-	void* stringHeapPtr, int* specialTokenList, void* clauses, int startupToken, int startupFlags, int staticVectorMemorySize)
+	void* stringHeapPtr, void* stringDirectoryPtr, int* specialTokenList, void* clauses, void* fieldIndex, int startupToken, int startupFlags, int staticVectorMemorySize)
 {
 	_flashClear = false;
 	FlashMemoryHeader hd;
@@ -236,9 +244,11 @@ void FlashMemoryManager::WriteHeader(int dataVersion, int hashCode, void* classe
 	hd.Identifier = FLASH_MEMORY_IDENTIFIER;
 	hd.Classes = classesPtr;
 	hd.Clauses = clauses;
+	hd.FieldIndex = fieldIndex;
 	hd.Methods = methodsPtr;
 	hd.Constants = constantsPtr;
 	hd.StringHeap = stringHeapPtr;
+	hd.StringDirectory = stringDirectoryPtr;
 	hd.SpecialTokenList = specialTokenList;
 	hd.StartupToken = startupToken;
 	hd.StartupFlags = startupFlags;
@@ -23,7 +23,7 @@ private:
 public:
 	FlashMemoryManager();
 
-	void Init(void*& classes, void*& methods, void*& constants, void*& stringHeap, int*& specialTokenList, void*& clauses, int&
+	void Init(void*& classes, void*& methods, void*& constants, void*& stringHeap, void*& stringDirectory, int*& specialTokenList, void*& clauses, void*& fieldIndex, int&
 	          startupToken, int& startupFlags, uint32_t& staticVectorMemorySize);
 	/// <summary>
 	/// Allocate memory in flash.
@@ -35,8 +35,8 @@ public:
 	void* FlashAlloc(size_t bytes);
 
 	void CopyToFlash(void* src, void* flashTarget, size_t length, const char* usage);
-	void WriteHeader(int dataVersion, int hashCode, void* classesPtr, void* methodsPtr, void* constantsPtr, void* stringHeapPtr, int*
-	                 specialTokenList, void* clauses, int startupToken, int startupFlags, int staticVectorMemorySize);
+	void WriteHeader(int dataVersion, int hashCode, void* classesPtr, void* methodsPtr, void* constantsPtr, void* stringHeapPtr, void* stringDirectoryPtr, int*
+	                 specialTokenList, void* clauses, void* fieldIndex, int startupToken, int startupFlags, int staticVectorMemorySize);
 
 	/// <summary>
 	/// Marks the flash as empty. It does not write anything yet, so if this is called without a subsequent CopyToFlash or WriteHeader, the memory will still be there after bootup
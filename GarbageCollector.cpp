@@ -405,7 +405,7 @@ void GarbageCollector::MarkAllFree(GcBlock& block)
 	{
 		int blockSize = hd->BlockSize;
 
-		hd->flags = BlockFlags::Free;
+		hd->MarkFree();
 
 		hd = AddBytes(hd, blockSize + ALLOCATE_ALLIGNMENT);
 		offset = offset + blockSize + ALLOCATE_ALLIGNMENT;
@@ -473,6 +473,8 @@ int GarbageCollector::ComputeFreeBlockSizes()
 
 			if (hd->IsFree())
 			{
+				// An object that died while locked doesn't pass its lock on to the next one allocated here
+				hd->flags = BlockFlags::Free;
 				blockFree += entryLength;
 #if GC_DEBUG_LEVEL >= 2
 				{
@@ -507,13 +509,10 @@ int GarbageCollector::ComputeFreeBlockSizes()
 
 int GarbageCollector::Collect(int generation, FirmataIlExecutor* referenceContainer)
 {
-	if (generation >= 2 && !_gcPressureHigh)
+	// If the generation is given as 2, we skip the GC run if we think not much memory has been allocated
+	if (!CollectionRequired(generation))
 	{
-		// If the generation is given as 2, we skip the GC run if we think not much memory has been allocated
-		if (_numAllocsSinceLastGc < 100 && _bytesAllocatedSinceLastGc < 5000)
-		{
-			return 0;
-		}
+		return 0;
 	}
 	TRACE(Firmata.sendString(F("Beginning GC")));
 	MarkAllFree();
@@ -539,7 +538,7 @@ void GarbageCollector::MarkDependentHandles(FirmataIlExecutor* referenceContaine
 		{
 			// If I got the concept of DependentHandle right, we shall mark the second as used when the first is.
 			hd = BlockHd::Cast((byte*)p.second - (int32_t)ALLOCATE_ALLIGNMENT);
-			hd->flags = BlockFlags::Used;
+			hd->MarkUsed();
 		}
 	}
 }
@@ -547,6 +546,14 @@ void GarbageCollector::MarkDependentHandles(FirmataIlExecutor* referenceContaine
 
 void GarbageCollector::MarkStatics(FirmataIlExecutor* referenceContainer)
 {
+	// The interned string literals live as long as the program
+	for (size_t i = 0; i < referenceContainer->_stringLiterals.size(); i++)
+	{
+		Variable literal(VariableKind::Object);
+		literal.Object = referenceContainer->_stringLiterals[i].Instance;
+		MarkVariable(literal, referenceContainer);
+	}
+
 	size_t offset = 0;
 	byte* start = referenceContainer->_staticVector;
 
@@ -594,14 +601,21 @@ void GarbageCollector::MarkStacks(FirmataIlExecutor* referenceContainer)
 			e = thread->threadStatics.next(e);
 		}
 
+		if (thread->pendingException.ExceptionObject != nullptr)
+		{
+			Variable pending(VariableKind::Object);
+			pending.Object = thread->pendingException.ExceptionObject;
+			MarkVariable(pending, referenceContainer);
+		}
+
 		while (state != nullptr)
 		{
 			uint16_t pc;
-			VariableDynamicStack* stack;
+			EvaluationStack* stack;
 			VariableVector* locals;
 			VariableVector* arguments;
 			state->ActivateState(&pc, &stack, &locals, &arguments);
-			VariableDynamicStack::Iterator stackIterator = stack->GetIterator();
+			EvaluationStack::Iterator stackIterator = stack->GetIterator();
 			Variable* var;
 			while ((var = stackIterator.next()) != nullptr)
 			{
@@ -635,11 +649,53 @@ void GarbageCollector::MarkStacks(FirmataIlExecutor* referenceContainer)
 				ex = ex->Next;
 			}
 
+			// Objects in the frame are not on the heap, so they're not reached by MarkVariable. Their fields are roots.
+			StackObject* stackObject = state->_stackObjects;
+			while (stackObject != nullptr)
+			{
+				MarkFields(stackObject->Object(), *(ClassDeclaration**)stackObject->Object(), referenceContainer);
+				stackObject = stackObject->Next;
+			}
+
 			state = state->_next;
 		}
 	}
 }
 
+BlockHd* GarbageCollector::HeaderOf(void* object)
+{
+	for (size_t idx1 = 0; idx1 < _gcBlocks.size(); idx1++)
+	{
+		if (object > _gcBlocks[idx1].BlockStart && object < AddBytes(_gcBlocks[idx1].BlockStart, _gcBlocks[idx1].BlockSize))
+		{
+			return BlockHd::Cast(AddBytes(object, -((int32_t)ALLOCATE_ALLIGNMENT)));
+		}
+	}
+
+	return nullptr;
+}
+
+void GarbageCollector::ReleaseThinLocks(int threadId)
+{
+	for (size_t idx1 = 0; idx1 < _gcBlocks.size(); idx1++)
+	{
+		BlockHd* hd = _gcBlocks[idx1].BlockStart;
+		int offset = 0;
+		int blockLen = _gcBlocks[idx1].BlockSize;
+		while (offset < blockLen)
+		{
+			int entrySize = hd->BlockSize;
+			if (!hd->IsFree() && hd->ThinLockOwner() == threadId)
+			{
+				hd->ClearThinLock();
+			}
+
+			hd = AddBytes(hd, entrySize + ALLOCATE_ALLIGNMENT);
+			offset = offset + entrySize + ALLOCATE_ALLIGNMENT;
+		}
+	}
+}
+
 /// <summary>
 /// Tests whether the given pointer could be an object pointer (means that it contains a value that could be an address in our heap)
 /// </summary>
@@ -759,7 +815,7 @@ void GarbageCollector::MarkVariable(Variable& variable, FirmataIlExecutor* refer
 		return;
 	}
 	
-	hd->flags = BlockFlags::Used; // Mark as in use
+	hd->MarkUsed(); // Mark as in use
 	ClassDeclaration* cls = *(ClassDeclaration**)ptr;
 
 	if (variable.Type == VariableKind::ReferenceArray)
@@ -832,6 +888,37 @@ void GarbageCollector::MarkVariable(Variable& variable, FirmataIlExecutor* refer
 		return;
 	}
 
+	MarkFields(ptr, cls, referenceContainer);
+
+	/*
+	while ((fieldType = cls->GetFieldByIndex(idx)) != nullptr)
+	{
+		if ((fieldType->Type & VariableKind::StaticMember) != VariableKind::Void)
+		{
+			idx++;
+			continue;
+		}
+		if (fieldType->Type == VariableKind::Object || fieldType->Type == VariableKind::ReferenceArray || fieldType->Type == VariableKind::ValueArray)
+		{
+			Variable referenceField;
+			referenceField.Marker = VARIABLE_DEFAULT_MARKER;
+			referenceField.Type = fieldType->Type;
+			referenceField.setSize(4);
+			referenceField.Object = (void*)*AddBytes((int*)ptr, offset);
+			MarkVariable(referenceField, referenceContainer);
+		}
+
+		offset += fieldType->fieldSize();
+		idx++;
+	}
+	*/
+}
+
+/// <summary>
+/// Marks the objects referenced by the instance fields of the given object
+/// </summary>
+void GarbageCollector::MarkFields(void* ptr, ClassDeclaration* cls, FirmataIlExecutor* referenceContainer)
+{
 	// Iterate over the fields of a class
 	int offset = sizeof(void*);
 	VariableIterator it;
@@ -864,8 +951,8 @@ void GarbageCollector::MarkVariable(Variable& variable, FirmataIlExecutor* refer
 				// This tests whether it's really pointing to a valid object start address
 				if (IsValidMemoryPointer(potentiallyAnObject))
 				{
-					hd = BlockHd::Cast(AddBytes(potentiallyAnObject, -((int32_t)ALLOCATE_ALLIGNMENT)));
-					hd->flags = BlockFlags::Used;
+					BlockHd* hd = BlockHd::Cast(AddBytes(potentiallyAnObject, -((int32_t)ALLOCATE_ALLIGNMENT)));
+					hd->MarkUsed();
 					MarkRawMemoryBlock(potentiallyAnObject, handle->fieldSize(), referenceContainer);
 				}
 			}
@@ -873,27 +960,4 @@ void GarbageCollector::MarkVariable(Variable& variable, FirmataIlExecutor* refer
 		
 		offset += handle->fieldSize();
 	}
-
-	/*
-	while ((fieldType = cls->GetFieldByIndex(idx)) != nullptr)
-	{
-		if ((fieldType->Type & VariableKind::StaticMember) != VariableKind::Void)
-		{
-			idx++;
-			continue;
-		}
-		if (fieldType->Type == VariableKind::Object || fieldType->Type == VariableKind::ReferenceArray || fieldType->Type == VariableKind::ValueArray)
-		{
-			Variable referenceField;
-			referenceField.Marker = VARIABLE_DEFAULT_MARKER;
-			referenceField.Type = fieldType->Type;
-			referenceField.setSize(4);
-			referenceField.Object = (void*)*AddBytes((int*)ptr, offset);
-			MarkVariable(referenceField, referenceContainer);
-		}
-
-		offset += fieldType->fieldSize();
-		idx++;
-	}
-	*/
 }
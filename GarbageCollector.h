@@ -21,8 +21,19 @@ enum class BlockFlags : byte
 {
 	Used = 0,
 	Free = 1,
+	// The monitor of the object has been moved to the lock table of the executor
+	LockInflated = 2,
 };
 
+// The remaining bits of the flags hold the thin lock of the object: The id of the owning thread + 1 (0 if the object is not locked)
+// and the recursion count - 1 of the owner. Deeper recursion inflates the lock.
+const byte THIN_LOCK_OWNER_SHIFT = 2;
+const byte THIN_LOCK_OWNER_MASK = 0x3C;
+const byte THIN_LOCK_COUNT_SHIFT = 6;
+const byte THIN_LOCK_COUNT_MASK = 0xC0;
+const int THIN_LOCK_MAX_COUNT = 4;
+const byte THIN_LOCK_MASK = (byte)BlockFlags::LockInflated | THIN_LOCK_OWNER_MASK | THIN_LOCK_COUNT_MASK;
+
 inline BlockFlags operator | (BlockFlags lhs, BlockFlags rhs)
 {
 	return (BlockFlags)((byte)lhs | (byte)rhs);
@@ -46,6 +57,59 @@ struct BlockHd
 		return ((flags & BlockFlags::Free) == BlockFlags::Free);
 	}
 
+	// Marking must not touch the lock bits, since locked objects survive the collection
+	void MarkUsed()
+	{
+		flags = (BlockFlags)((byte)flags & ~(byte)BlockFlags::Free);
+	}
+
+	void MarkFree()
+	{
+		flags = flags | BlockFlags::Free;
+	}
+
+	/// <summary>
+	/// Returns the id of the thread holding the thin lock of this object, -1 if it is not locked
+	/// </summary>
+	int ThinLockOwner()
+	{
+		return (((byte)flags & THIN_LOCK_OWNER_MASK) >> THIN_LOCK_OWNER_SHIFT) - 1;
+	}
+
+	int ThinLockCount()
+	{
+		return (((byte)flags & THIN_LOCK_COUNT_MASK) >> THIN_LOCK_COUNT_SHIFT) + 1;
+	}
+
+	void SetThinLock(int owner, int count)
+	{
+		byte lockBits = (byte)(((owner + 1) << THIN_LOCK_OWNER_SHIFT) | ((count - 1) << THIN_LOCK_COUNT_SHIFT));
+		flags = (BlockFlags)(((byte)flags & ~(THIN_LOCK_OWNER_MASK | THIN_LOCK_COUNT_MASK)) | lockBits);
+	}
+
+	void ClearThinLock()
+	{
+		flags = (BlockFlags)((byte)flags & ~(THIN_LOCK_OWNER_MASK | THIN_LOCK_COUNT_MASK));
+	}
+
+	/// <summary>
+	/// True if the object is neither thin-locked nor has an inflated lock
+	/// </summary>
+	bool IsUnlocked()
+	{
+		return ((byte)flags & THIN_LOCK_MASK) == 0;
+	}
+
+	bool IsLockInflated()
+	{
+		return (flags & BlockFlags::LockInflated) == BlockFlags::LockInflated;
+	}
+
+	void SetLockInflated(bool inflated)
+	{
+		flags = inflated ? (flags | BlockFlags::LockInflated) : (BlockFlags)((byte)flags & ~(byte)BlockFlags::LockInflated);
+	}
+
 	static BlockHd* Cast(void* address)
 	{
 		return (BlockHd*)address;
@@ -124,6 +188,19 @@ public:
 		return _gcPressureHigh;
 	}
 
+	/// <summary>
+	/// False if a collection of the given generation would be skipped, because not much memory has been allocated since the last one
+	/// </summary>
+	bool CollectionRequired(int generation) const
+	{
+		if (generation >= 2 && !_gcPressureHigh)
+		{
+			return _numAllocsSinceLastGc >= 100 || _bytesAllocatedSinceLastGc >= 5000;
+		}
+
+		return true;
+	}
+
 	void Init(FirmataIlExecutor* referenceContainer, size_t preallocateSize);
 	int64_t TotalAllocatedBytes() const
 	{
@@ -136,6 +213,16 @@ public:
 	}
 
 	int64_t AllocatedMemory();
+
+	/// <summary>
+	/// Returns the block header of an object on the managed heap, or null if the object lives elsewhere (i.e. in flash)
+	/// </summary>
+	BlockHd* HeaderOf(void* object);
+
+	/// <summary>
+	/// Releases all thin locks the given thread holds. Used when a thread ends without releasing its locks.
+	/// </summary>
+	void ReleaseThinLocks(int threadId);
 private:
 	void MarkAllFree();
 	void MarkAllFree(GcBlock& block);
@@ -145,6 +232,7 @@ private:
 	bool IsValidMemoryPointer(void* ptr);
 	void MarkRawMemoryBlock(void* object, size_t objectSize, FirmataIlExecutor* referenceContainer);
 	void MarkVariable(Variable& variable, FirmataIlExecutor* referenceContainer);
+	void MarkFields(void* ptr, ClassDeclaration* cls, FirmataIlExecutor* referenceContainer);
 
 	int _totalAllocSize;
 	int _totalAllocations;
@@ -117,7 +117,7 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 		break;
 	case NativeMethod::EnvironmentProcessorCount:
 		result.Type = VariableKind::Int32;
-		result.Int32 = 1;
+		result.Int32 = executor->ActiveCoreCount();
 		break;
 	case NativeMethod::EnvironmentTickCount: // TickCount
 	{
@@ -133,9 +133,6 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 		result.Type = VariableKind::Int64;
 		}
 		break;
-	case NativeMethod::ArduinoNativeHelpersSleepMicroseconds:
-		delayMicroseconds(args[0].Uint32);
-		break;
 	case NativeMethod::ArduinoNativeHelpersGetMicroseconds:
 		result.Uint32 = micros();
 		result.Type = VariableKind::Uint32;
@@ -468,7 +465,7 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 			Variable& ref = args[0]; // Arg0 is a reference to an object
 			Variable& value = args[1];
 			Variable& comparand = args[2];
-			noInterrupts();
+			CoreLockEnter();
 			void** refPtr = (void**)ref.Object;
 			void* orig = *(refPtr);
 			if (orig == comparand.Object)
@@ -476,7 +473,7 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 				// The other properties at refTgt should already be equal, since this method only operates if all 3 arguments are objects.
 				*(refPtr) = value.Object; // Replace the object ref points to with the value if ref==comparand.
 			}
-			interrupts();
+			CoreLockExit();
 			result.Object = orig; // Return the original destination object
 	}
 		break;
@@ -487,11 +484,11 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 		result.setSize(4);
 		Variable& location = args[0]; // Arg0 is a reference to an object
 		Variable& value = args[1];
-		noInterrupts();
+		CoreLockEnter();
 		void** refPtr = (void**)location.Object;
 		void* orig = *(refPtr);
 		*(refPtr) = value.Object; // Replace the object ref points to with the value
-		interrupts();
+		CoreLockExit();
 		result.Object = orig; // Return the original destination object
 		}
 		break;
@@ -499,22 +496,22 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 		{
 			// Behavior is a bit confusing: Adds the two input values (first one given by-ref), updates the first one with the sum and returns the old value
 		result.Type = VariableKind::Int32;
-		noInterrupts();
+		CoreLockEnter();
 		int firstValue = *AddBytes((int*)args[0].Object, 0);
 		int sum = firstValue + args[1].Int32;
 		*AddBytes((int*)args[0].Object, 0) = sum;
-		interrupts();
+		CoreLockExit();
 		result.Int32 = firstValue;
 		}
 		break;
 	case NativeMethod::InterlockedExchangeInt:
 		{
 		result.Type = VariableKind::Int32;
-		noInterrupts();
+		CoreLockEnter();
 		int firstValue = *AddBytes((int*)args[0].Object, 0);
 		int newValue = args[1].Int32;
 		*AddBytes((int*)args[0].Object, 0) = newValue;
-		interrupts();
+		CoreLockExit();
 		result.Int32 = firstValue;
 		}
 		break;
@@ -524,25 +521,25 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 		Variable& ref = args[0]; // Arg0 is a reference to an int
 		Variable& value = args[1];
 		Variable& comparand = args[2];
-		noInterrupts();
+		CoreLockEnter();
 		int* refPtr = (int*)ref.Object;
 		int orig = *(refPtr);
 		if (orig == comparand.Int32)
 		{
 			*(refPtr) = value.Int32; // Replace the object ref points to with the value if ref==comparand.
 		}
-		interrupts();
+		CoreLockExit();
 		result.Int32 = orig; // Return the original destination value
 	}
 		break;
 	case NativeMethod::InterlockedExchangeInt64:
 	{
 		result.Type = VariableKind::Int64;
-		noInterrupts();
+		CoreLockEnter();
 		int64_t firstValue = *AddBytes((int64_t*)args[0].Object, 0);
 		int64_t newValue = args[1].Int64;
 		*AddBytes((int64_t*)args[0].Object, 0) = newValue;
-		interrupts();
+		CoreLockExit();
 		result.Int64 = firstValue;
 	}
 	break;
@@ -552,14 +549,14 @@ bool HardwareAccess::ExecuteHardwareAccess(FirmataIlExecutor* executor, Executio
 		Variable& ref = args[0]; // Arg0 is a reference to an int
 		Variable& value = args[1];
 		Variable& comparand = args[2];
-		noInterrupts();
+		CoreLockEnter();
 		int64_t* refPtr = (int64_t*)ref.Object;
 		int64_t orig = *(refPtr);
 		if (orig == comparand.Int64)
 		{
 			*(refPtr) = value.Int64; // Replace the object ref points to with the value if ref==comparand.
 		}
-		interrupts();
+		CoreLockExit();
 		result.Int64 = orig; // Return the original destination value
 	}
 	break;
@@ -32,7 +32,7 @@ public:
 	                                  result) override;
 
 	static void Reboot();
-private:
+	// The milliseconds since startup, without the 32 bit overflow of millis(). Also used for the deadlines of timed waits.
 	static int64_t TickCount64();
 };
 
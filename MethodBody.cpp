@@ -265,3 +265,82 @@ ExceptionClause* SortedClauseList::BinarySearchKeyInternal(stdSimple::vector<Exc
 	}
 	return ret;
 }
+
+MethodClauseTable* MethodClauseCache::Build(int32_t methodToken, SortedClauseList& clauses, SortedClassList& classes)
+{
+	MethodClauseTable* table = new MethodClauseTable(methodToken);
+	if (table == nullptr)
+	{
+		stdSimple::OutOfMemoryException::Throw("Out of memory building exception clause table");
+	}
+
+	uint32_t index = 0;
+	ExceptionClause* c = clauses.BinarySearchKey(methodToken, index);
+	if (c == nullptr)
+	{
+		return table;
+	}
+
+	uint32_t first = index;
+	while (index < clauses.size() && clauses.at(index)->GetKey() == (uint32_t)methodToken)
+	{
+		index++;
+	}
+
+	table->Clauses = (ResolvedClause*)mallocEx((index - first) * sizeof(ResolvedClause));
+	if (table->Clauses == nullptr)
+	{
+		deleteEx(table);
+		stdSimple::OutOfMemoryException::Throw("Out of memory building exception clause table");
+	}
+
+	for (uint32_t i = first; i < index; i++)
+	{
+		ResolvedClause entry;
+		entry.Clause = clauses.at(i);
+		// A missing catch type is reported when the clause is used
+		entry.CatchType = entry.Clause->ClauseType == ExceptionHandlingClauseOptions::Clause ? classes.GetClassWithToken(entry.Clause->FilterToken, false) : nullptr;
+
+		// Insertion sort by the length of the try block. Clauses with equal length keep their order.
+		uint16_t j = table->Count;
+		while (j > 0 && table->Clauses[j - 1].Clause->TryLength > entry.Clause->TryLength)
+		{
+			table->Clauses[j] = table->Clauses[j - 1];
+			j--;
+		}
+		table->Clauses[j] = entry;
+		table->Count++;
+	}
+
+	return table;
+}
+
+const MethodClauseTable* MethodClauseCache::FindClauseTable(int32_t methodToken)
+{
+	MethodClauseTable* const* entry = stdSimple::BinarySearch(_tables.begin(), _tables.size(), (uint32_t)methodToken);
+	return entry != nullptr ? *entry : nullptr;
+}
+
+const MethodClauseTable* MethodClauseCache::AddClauseTable(MethodClauseTable* table)
+{
+	size_t index = stdSimple::LowerBound(_tables.begin(), _tables.size(), table->GetKey());
+	if (index < _tables.size() && _tables[index]->GetKey() == table->GetKey())
+	{
+		// Another core built the same table in the meantime
+		deleteEx(table);
+		return _tables[index];
+	}
+
+	_tables.insert(index, table);
+	return table;
+}
+
+void MethodClauseCache::clear()
+{
+	for (size_t i = 0; i < _tables.size(); i++)
+	{
+		deleteEx(_tables[i]);
+	}
+
+	_tables.clear(true);
+}
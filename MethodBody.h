@@ -203,3 +203,85 @@ public:
 private:
 	ExceptionClause* CreateFlashDeclaration(FlashMemoryManager* manager, ExceptionClause* element);
 };
+
+/// <summary>
+/// An exception clause together with the resolved type of its catch block (null for finally clauses)
+/// </summary>
+struct ResolvedClause
+{
+	ExceptionClause* Clause;
+	ClassDeclaration* CatchType;
+
+	bool Covers(int pc) const
+	{
+		return pc >= Clause->TryOffset && pc <= Clause->TryOffset + Clause->TryLength;
+	}
+};
+
+/// <summary>
+/// The exception clauses of one method, ordered by the length of their try block. Since try blocks are properly nested,
+/// the first clause covering a given location is the innermost one.
+/// </summary>
+class MethodClauseTable
+{
+public:
+	MethodClauseTable(int32_t methodToken)
+	{
+		MethodToken = methodToken;
+		Clauses = nullptr;
+		Count = 0;
+	}
+
+	~MethodClauseTable()
+	{
+		freeEx(Clauses);
+		Count = 0;
+	}
+
+	uint32_t GetKey() const
+	{
+		return MethodToken;
+	}
+
+	int32_t MethodToken;
+	ResolvedClause* Clauses;
+	uint16_t Count;
+};
+
+/// <summary>
+/// The clause tables of the methods that were unwound at least once, sorted by method token. Methods without clauses
+/// get an empty table as well, so that they're not searched again. Must be cleared whenever the clause or the class list changes.
+/// </summary>
+class MethodClauseCache
+{
+private:
+	stdSimple::vector<MethodClauseTable*> _tables;
+public:
+	~MethodClauseCache()
+	{
+		clear();
+	}
+
+	/// <summary>
+	/// Returns the clause table of the given method, or null if it was not built yet
+	/// </summary>
+	const MethodClauseTable* FindClauseTable(int32_t methodToken);
+
+	/// <summary>
+	/// Adds a table created by Build and returns it. If there's already a table for the method, the new one is deleted
+	/// and the existing one is returned.
+	/// </summary>
+	const MethodClauseTable* AddClauseTable(MethodClauseTable* table);
+
+	/// <summary>
+	/// Creates the clause table of the given method. Doesn't access the cache, so it can run without holding a lock.
+	/// </summary>
+	static MethodClauseTable* Build(int32_t methodToken, SortedClauseList& clauses, SortedClassList& classes);
+
+	void clear();
+
+	size_t size()
+	{
+		return _tables.size();
+	}
+};
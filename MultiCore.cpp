@@ -0,0 +1,234 @@
+#include <ConfigurableFirmata.h>
+#include "MultiCore.h"
+
+#if MULTICORE_SUPPORT
+#ifdef ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+static CoreMutex GlobalCoreMutex;
+static bool _secondCoreStarted = false;
+// Nesting depth of CoreLockEnter while interrupts are used for locking
+static int _interruptLockDepth = 0;
+
+void CoreMutex::Init()
+{
+#if MULTICORE_SUPPORT
+	if (_handle != nullptr)
+	{
+		return;
+	}
+#ifdef ESP32
+	_handle = xSemaphoreCreateRecursiveMutex();
+#else
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_t* mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	if (mutex != nullptr)
+	{
+		pthread_mutex_init(mutex, &attributes);
+	}
+	pthread_mutexattr_destroy(&attributes);
+	_handle = mutex;
+#endif
+#endif
+}
+
+void CoreMutex::Lock()
+{
+#if MULTICORE_SUPPORT
+	if (_handle == nullptr)
+	{
+		return;
+	}
+#ifdef ESP32
+	xSemaphoreTakeRecursive((SemaphoreHandle_t)_handle, portMAX_DELAY);
+#else
+	pthread_mutex_lock((pthread_mutex_t*)_handle);
+#endif
+#endif
+}
+
+void CoreMutex::Unlock()
+{
+#if MULTICORE_SUPPORT
+	if (_handle == nullptr)
+	{
+		return;
+	}
+#ifdef ESP32
+	xSemaphoreGiveRecursive((SemaphoreHandle_t)_handle);
+#else
+	pthread_mutex_unlock((pthread_mutex_t*)_handle);
+#endif
+#endif
+}
+
+void WorldLock::BeginSlice()
+{
+	_mutex.Lock();
+	while (_stopRequested)
+	{
+		_mutex.Unlock();
+		CoreSleep();
+		_mutex.Lock();
+	}
+	_activeSlices++;
+	_mutex.Unlock();
+}
+
+void WorldLock::EndSlice()
+{
+	_mutex.Lock();
+	_activeSlices--;
+	_mutex.Unlock();
+}
+
+void WorldLock::StopTheWorld(bool insideSlice)
+{
+	_mutex.Lock();
+	if (insideSlice)
+	{
+		// While we wait, we count as stopped, otherwise two cores stopping the world at the same time would wait for each other
+		_activeSlices--;
+	}
+
+	while (_stopRequested)
+	{
+		_mutex.Unlock();
+		CoreSleep();
+		_mutex.Lock();
+	}
+
+	_stopRequested = true;
+	while (_activeSlices > 0)
+	{
+		_mutex.Unlock();
+		CoreSleep();
+		_mutex.Lock();
+	}
+	_mutex.Unlock();
+}
+
+void WorldLock::ResumeTheWorld(bool insideSlice)
+{
+	_mutex.Lock();
+	_stopRequested = false;
+	if (insideSlice)
+	{
+		_activeSlices++;
+	}
+	_mutex.Unlock();
+}
+
+void CoreLockEnter()
+{
+	if (_secondCoreStarted)
+	{
+		GlobalCoreMutex.Lock();
+		return;
+	}
+
+	noInterrupts();
+	_interruptLockDepth++;
+}
+
+void CoreLockExit()
+{
+	if (_secondCoreStarted)
+	{
+		GlobalCoreMutex.Unlock();
+		return;
+	}
+
+	_interruptLockDepth--;
+	if (_interruptLockDepth == 0)
+	{
+		interrupts();
+	}
+}
+
+bool SecondCoreStarted()
+{
+	return _secondCoreStarted;
+}
+
+#if MULTICORE_SUPPORT && !defined(ESP32)
+struct ThreadStartArgument
+{
+	void (*Entry)(void*);
+	void* Argument;
+};
+
+static void* SecondCoreThread(void* argument)
+{
+	ThreadStartArgument start = *(ThreadStartArgument*)argument;
+	free(argument);
+	start.Entry(start.Argument);
+	return nullptr;
+}
+#endif
+
+bool StartSecondCore(void (*entry)(void*), void* argument)
+{
+#if MULTICORE_SUPPORT
+	if (_secondCoreStarted)
+	{
+		return true;
+	}
+
+	// Must be ready before the other core can take it
+	GlobalCoreMutex.Init();
+	_secondCoreStarted = true;
+#ifdef ESP32
+	// The arduino loop runs on one core, the other one (which also runs the WiFi stack) gets the second interpreter
+	TaskHandle_t handle;
+	if (xTaskCreatePinnedToCore(entry, "ManagedCore", 16384, argument, 1, &handle, 1 - xPortGetCoreID()) != pdPASS)
+	{
+		_secondCoreStarted = false;
+		return false;
+	}
+#else
+	ThreadStartArgument* start = (ThreadStartArgument*)malloc(sizeof(ThreadStartArgument));
+	pthread_t thread;
+	if (start == nullptr)
+	{
+		_secondCoreStarted = false;
+		return false;
+	}
+	start->Entry = entry;
+	start->Argument = argument;
+	if (pthread_create(&thread, nullptr, SecondCoreThread, start) != 0)
+	{
+		free(start);
+		_secondCoreStarted = false;
+		return false;
+	}
+	pthread_detach(thread);
+#endif
+	return true;
+#else
+	(void)entry;
+	(void)argument;
+	return false;
+#endif
+}
+
+void CoreSleep()
+{
+#if MULTICORE_SUPPORT && defined(ESP32)
+	// Also lets the idle task of this core run, so the task watchdog stays quiet
+	vTaskDelay(1);
+#elif MULTICORE_SUPPORT
+	usleep(100);
+#else
+	delay(1);
+#endif
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <ConfigurableFirmata.h>
+
+// Managed threads can be distributed over the two cores of the ESP32. On Linux, the simulator uses a second pthread instead,
+// so that the mode can be tested there.
+#if defined(ESP32) || (defined(SIM) && defined(__linux__))
+#define MULTICORE_SUPPORT 1
+#else
+#define MULTICORE_SUPPORT 0
+#endif
+
+#define NUMBER_OF_EXECUTION_CORES 2
+
+/// <summary>
+/// A recursive mutex that works across cores. Lock and Unlock do nothing until Init was called.
+/// </summary>
+class CoreMutex
+{
+private:
+	void* _handle;
+public:
+	CoreMutex()
+	{
+		_handle = nullptr;
+	}
+
+	void Init();
+	void Lock();
+	void Unlock();
+};
+
+/// <summary>
+/// Coordinates the cores executing managed code with the garbage collector. Each core executes its time slices between BeginSlice and EndSlice.
+/// StopTheWorld waits until no other core is inside a slice and keeps them out until ResumeTheWorld is called.
+/// </summary>
+class WorldLock
+{
+private:
+	CoreMutex _mutex;
+	int _activeSlices;
+	bool _stopRequested;
+public:
+	WorldLock()
+	{
+		_activeSlices = 0;
+		_stopRequested = false;
+	}
+
+	void Init()
+	{
+		_mutex.Init();
+	}
+
+	void BeginSlice();
+	void EndSlice();
+
+	/// <summary>
+	/// Stops all other cores at the end of their current slice. insideSlice must be true if the caller is inside a slice itself.
+	/// </summary>
+	void StopTheWorld(bool insideSlice);
+	void ResumeTheWorld(bool insideSlice);
+};
+
+/// <summary>
+/// Enters and leaves the global critical section. Disables interrupts while only one core executes managed code and takes
+/// a mutex shared by all cores once the second core was started. Calls can be nested.
+/// </summary>
+void CoreLockEnter();
+void CoreLockExit();
+
+/// <summary>
+/// Starts the given function on the second core. Returns false if that's not possible.
+/// </summary>
+bool StartSecondCore(void (*entry)(void*), void* argument);
+
+/// <summary>
+/// True once StartSecondCore succeeded
+/// </summary>
+bool SecondCoreStarted();
+
+/// <summary>
+/// Gives up the CPU for a short time (i.e. because there's nothing to do or while waiting for the other core)
+/// </summary>
+void CoreSleep();
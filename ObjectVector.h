@@ -377,6 +377,71 @@ namespace stdSimple
 			memmove(&_data[index], &_data[index + 1], elementsToMove * sizeof(T));
 			--_count;
 		}
+
+		/// <summary>
+		/// Inserts an element at the given position, moving the following elements up by one
+		/// </summary>
+		void insert(size_t index, const T& object)
+		{
+			push_back(object);
+			int elementsToMove = _count - (index + 1); // May be 0
+			memmove(&_data[index + 1], &_data[index], elementsToMove * sizeof(T));
+			_data[index] = object;
+		}
 	};
 
+	/// <summary>
+	/// The key of an entry of a sorted table. The entries (or the objects they point to) provide it with GetKey().
+	/// </summary>
+	template<class T>
+	inline auto KeyOf(const T& entry) -> decltype(entry.GetKey())
+	{
+		return entry.GetKey();
+	}
+
+	template<class T>
+	inline auto KeyOf(T* const& entry) -> decltype(entry->GetKey())
+	{
+		return entry->GetKey();
+	}
+
+	/// <summary>
+	/// Returns the index of the first entry of a table sorted by key whose key is not less than the given key. This is
+	/// the index of the entry with the key, if there is one, or otherwise the index where it would have to be inserted.
+	/// </summary>
+	template<class T, class TKey>
+	size_t LowerBound(const T* table, size_t count, TKey key)
+	{
+		size_t left = 0;
+		size_t right = count;
+		while (left < right)
+		{
+			size_t current = (left + right) / 2;
+			if ((TKey)KeyOf(table[current]) < key)
+			{
+				left = current + 1;
+			}
+			else
+			{
+				right = current;
+			}
+		}
+
+		return left;
+	}
+
+	/// <summary>
+	/// Binary search in a table sorted by key. Returns the entry with the given key, or null if there is none.
+	/// </summary>
+	template<class T, class TKey>
+	const T* BinarySearch(const T* table, size_t count, TKey key)
+	{
+		size_t index = LowerBound(table, count, key);
+		if (index < count && (TKey)KeyOf(table[index]) == key)
+		{
+			return table + index;
+		}
+
+		return nullptr;
+	}
 }
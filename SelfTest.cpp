@@ -3,6 +3,8 @@
 #include "Variable.h"
 #include "VariableVector.h"
 #include "VariableDynamicStack.h"
+#include "VariableFixedStack.h"
+#include "FirmataIlExecutor.h"
 #ifdef ESP32
 #include <esp_log.h>
 #endif
@@ -35,7 +37,11 @@ bool SelfTest::PerformSelfTest()
 	PerformMemoryAnalysis();
 	ValidateMemoryManager();
 	// ValidateMemoryManager();
-	ValidateExecutionStack();
+	ValidateExecutionStack<VariableDynamicStack>();
+	ValidateExecutionStack<VariableFixedStack>();
+	ValidateLargeValuesOnStack();
+	ValidateFrameArena();
+	ValidateSortedTable();
 	UnalignedAccessWorks();
 	CompilerBehavior();
 	return _statusFlag;
@@ -112,9 +118,10 @@ void SelfTest::ValidateMemoryManager()
 	ASSERT(dataAddr - startAddr == 4, "Size of Variable type is not correct. Ensure the compiler uses 1-byte struct packing");
 }
 
+template<class TStack>
 void SelfTest::ValidateExecutionStack()
 {
-	VariableDynamicStack st(10);
+	TStack st(10);
 	Variable a;
 	a.Type = VariableKind::Int32;
 	a.Int32 = 10;
@@ -141,6 +148,161 @@ void SelfTest::ValidateExecutionStack()
 	ASSERT(c.Int32 == a.Int32, "Internal selftest error: Stack count doesn't fit");
 }
 
+void SelfTest::ValidateLargeValuesOnStack()
+{
+	VariableFixedStack st(2);
+	// A value type of 16 bytes
+	uint32_t buffer[(sizeof(Variable) + 8) / 4 + 1];
+	Variable* large = (Variable*)buffer;
+	large->Type = VariableKind::LargeValueType;
+	large->Marker = VARIABLE_DEFAULT_MARKER;
+	large->setSize(16);
+	uint32_t* data = &large->Uint32;
+	for (int i = 0; i < 4; i++)
+	{
+		data[i] = 0x1000 + i;
+	}
+
+	Variable a(VariableKind::Int32);
+	a.Int32 = 7;
+	st.push(a);
+	st.push(*large);
+	st.push(a); // Exceeds the initial capacity
+	st.push(st.nth(1)); // Duplicates the large value
+	ASSERT(st.nth(0).fieldSize() == 16, "Internal selftest error: Large value has wrong size");
+	data = &st.nth(0).Uint32;
+	ASSERT(data[0] == 0x1000 && data[3] == 0x1003, "Internal selftest error: Large value not copied");
+	st.pop();
+	st.pop();
+	data = &st.top().Uint32;
+	ASSERT(data[3] == 0x1003, "Internal selftest error: Large value overwritten");
+	st.pop();
+	ASSERT(st.top().Int32 == 7, "Internal selftest error: Stack count doesn't fit");
+	st.pop();
+	ASSERT(st.empty(), "Stack is not empty");
+}
+
+void SelfTest::ValidateFrameArena()
+{
+	FrameArena arena;
+	void* outer = arena.Allocate(60);
+	void* inner = arena.Allocate(16);
+	ASSERT(outer != nullptr && inner != nullptr, "Internal selftest error: Frame arena allocation failed");
+	ASSERT((byte*)inner == (byte*)outer + 64, "Internal selftest error: Frame arena blocks not aligned");
+	ASSERT(arena.IsAtOrAbove(outer, inner), "Internal selftest error: Frame arena block order wrong");
+	void* innermost = arena.Allocate(8);
+	arena.Release(innermost);
+	ASSERT(arena.BytesUsed() == 80, "Internal selftest error: Frame arena release wrong");
+	// Releasing a block also releases all blocks allocated after it
+	arena.Release(outer);
+	ASSERT(arena.BytesUsed() == 0, "Internal selftest error: Frame arena does not release in stack order");
+	ASSERT(!arena.IsAtOrAbove(outer, inner), "Internal selftest error: Released frame arena block still in use");
+	// Blocks that are already released are ignored
+	arena.Release(inner);
+	ASSERT(arena.BytesUsed() == 0, "Internal selftest error: Frame arena released a block twice");
+	ASSERT(arena.Allocate(8) == outer, "Internal selftest error: Frame arena does not reuse released memory");
+}
+
+void SelfTest::ValidateSortedTable()
+{
+	stdSimple::vector<StaticFieldSlot> table;
+	const int32_t tokens[] = { 30, 10, -5, 20, 40 };
+	for (size_t i = 0; i < sizeof(tokens) / sizeof(tokens[0]); i++)
+	{
+		StaticFieldSlot slot;
+		slot.Token = tokens[i];
+		slot.Offset = i;
+		table.insert(stdSimple::LowerBound(table.begin(), table.size(), slot.Token), slot);
+	}
+
+	for (size_t i = 1; i < table.size(); i++)
+	{
+		ASSERT(table[i - 1].Token < table[i].Token, "Internal selftest error: Sorted insertion wrong");
+	}
+
+	const StaticFieldSlot* slot = stdSimple::BinarySearch(table.begin(), table.size(), 20);
+	ASSERT(slot != nullptr && slot->Offset == 3, "Internal selftest error: Binary search did not find the key");
+	slot = stdSimple::BinarySearch(table.begin(), table.size(), -5);
+	ASSERT(slot != nullptr && slot->Offset == 2, "Internal selftest error: Binary search did not find the first key");
+	ASSERT(stdSimple::BinarySearch(table.begin(), table.size(), 25) == nullptr, "Internal selftest error: Binary search found a missing key");
+	ASSERT(stdSimple::BinarySearch(table.begin(), 0, 20) == nullptr, "Internal selftest error: Binary search in empty table");
+	table.clear(true);
+}
+
+/// <summary>
+/// The stack operations of a loop like "sum = sum + i": ldloc, ldloc, add, stloc
+/// </summary>
+template<class TStack>
+static uint32_t ArithmeticBenchmark(int iterations)
+{
+	TStack st(8);
+	Variable value(VariableKind::Int32);
+	uint32_t start = micros();
+	for (int i = 0; i < iterations; i++)
+	{
+		value.Int32 = i;
+		st.push(value);
+		st.push(value);
+		Variable& value2 = st.top();
+		st.pop();
+		Variable& value1 = st.top();
+		value1.Int32 = value1.Int32 + value2.Int32;
+		value.Int32 = st.top().Int32;
+		st.pop();
+	}
+
+	return micros() - start;
+}
+
+/// <summary>
+/// The stack operations of a virtual call with three arguments: Push the instance and the arguments, find the instance
+/// (callvirt uses nth() for this), pop the arguments into the new frame and push the return value.
+/// </summary>
+template<class TStack>
+static uint32_t CallBenchmark(int iterations)
+{
+	TStack st(8);
+	Variable instance(VariableKind::Object);
+	Variable argument(VariableKind::Int64);
+	// Something is already on the caller's stack
+	st.push(argument);
+	st.push(argument);
+	uint32_t start = micros();
+	for (int i = 0; i < iterations; i++)
+	{
+		instance.Object = &argument;
+		st.push(instance);
+		for (int j = 0; j < 3; j++)
+		{
+			argument.Int64 = i + j;
+			st.push(argument);
+		}
+
+		Variable& self = st.nth(3);
+		if (self.Object == nullptr)
+		{
+			break;
+		}
+
+		for (int j = 0; j < 4; j++)
+		{
+			st.pop();
+		}
+
+		st.push(argument);
+		st.pop();
+	}
+
+	return micros() - start;
+}
+
+void SelfTest::BenchmarkExecutionStacks(int iterations)
+{
+	Firmata.sendStringf(F("Evaluation stack benchmark, %d iterations"), iterations);
+	Firmata.sendStringf(F("Arithmetic: Dynamic stack %dus, fixed-slot stack %dus"), ArithmeticBenchmark<VariableDynamicStack>(iterations), ArithmeticBenchmark<VariableFixedStack>(iterations));
+	Firmata.sendStringf(F("Calls: Dynamic stack %dus, fixed-slot stack %dus"), CallBenchmark<VariableDynamicStack>(iterations), CallBenchmark<VariableFixedStack>(iterations));
+}
+
 void SelfTest::UnalignedAccessWorks()
 {
 	int64_t* ptrStart = (int64_t*)malloc(64);
@@ -21,12 +21,22 @@ public:
 	}
 	
 	bool PerformSelfTest();
+
+	/// <summary>
+	/// Compares the speed of the two evaluation stack implementations, using instruction patterns of call-heavy
+	/// and arithmetic-heavy code. The results are sent to the host.
+	/// </summary>
+	void BenchmarkExecutionStacks(int iterations);
 private:
 
 	void PerformMemoryAnalysis();
 	void ValidateMemoryManager();
 
+	template<class TStack>
 	void ValidateExecutionStack();
+	void ValidateLargeValuesOnStack();
+	void ValidateFrameArena();
+	void ValidateSortedTable();
 
 	void UnalignedAccessWorks();
 	void CompilerBehavior();
@@ -15,6 +15,8 @@ class VariableDynamicStack
 {
 private:
 	uint32_t _bytesAllocated;
+	// False if the initial memory was provided by the caller. The stack then moves to the heap when it needs to grow.
+	bool _ownsData;
 	Variable* _begin; // bottom of stack
 	Variable* _sp; // the stack pointer (points to next element that will be used)
 	int* _revPtr; // points to the tail of the stack. This field contains the size of the previous element. It is always 4 bytes in front of _sp
@@ -49,10 +51,29 @@ public:
 		}
 	};
 	
-	VariableDynamicStack(int initialElements)
+	/// <summary>
+	/// Returns the number of bytes the stack initially needs for the given number of elements
+	/// </summary>
+	static uint32_t RequiredBytes(int initialElements)
+	{
+		return (initialElements * sizeof(Variable)) + sizeof(void*);
+	}
+
+	/// <summary>
+	/// Creates a stack. If buffer is not null, it must be RequiredBytes(initialElements) large and must stay valid for the lifetime of the stack.
+	/// </summary>
+	VariableDynamicStack(int initialElements, void* buffer = nullptr)
 	{
-		_bytesAllocated = (initialElements * sizeof(Variable)) + sizeof(void*);
-		_begin = (Variable*)mallocEx(_bytesAllocated);
+		_bytesAllocated = RequiredBytes(initialElements);
+		_ownsData = buffer == nullptr;
+		if (_ownsData)
+		{
+			_begin = (Variable*)mallocEx(_bytesAllocated);
+		}
+		else
+		{
+			_begin = (Variable*)buffer;
+		}
 		if (_begin == nullptr)
 		{
 			_revPtr = nullptr;
@@ -68,7 +89,7 @@ public:
 
 	~VariableDynamicStack()
 	{
-		if (_begin != nullptr)
+		if (_begin != nullptr && _ownsData)
 		{
 			freeEx(_begin);
 		}
@@ -100,7 +121,21 @@ public:
 		if (sizeUsed > FreeBytes())
 		{
 			uint32_t newSize = _bytesAllocated + sizeUsed; // Extend so that it certainly matches
-			Variable* newBegin = (Variable*)realloc(_begin, newSize); // with this, also _sp and _revPtr become invalid
+			Variable* newBegin;
+			if (_ownsData)
+			{
+				newBegin = (Variable*)realloc(_begin, newSize); // with this, also _sp and _revPtr become invalid
+			}
+			else
+			{
+				// The initial buffer can't grow, move to the heap
+				newBegin = (Variable*)malloc(newSize);
+				if (newBegin != nullptr)
+				{
+					memcpy(newBegin, _begin, _bytesAllocated);
+					_ownsData = true;
+				}
+			}
 			if (newBegin == nullptr)
 			{
 				stdSimple::OutOfMemoryException::Throw("Out of memory increasing dynamic stack");
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <ConfigurableFirmata.h>
+#include <FirmataFeature.h>
+#include "MemoryManagement.h"
+#include "ObjectVector.h"
+#include "Variable.h"
+#include "Exceptions.h"
+
+// Marks a slot whose value is stored in the side area. The data field of the slot holds the offset into the side area.
+#define VARIABLE_SIDE_AREA_MARKER 0x3A
+
+/// <summary>
+/// An evaluation stack with uniform slots of sizeof(Variable) (a header and 8 bytes of data), so that push, pop and nth are
+/// all constant-time. Value types larger than 8 bytes are stored in a separate side area and the slot refers to them.
+/// Like VariableDynamicStack, elements retrieved with top() or nth() stay valid until the next push.
+/// </summary>
+class VariableFixedStack
+{
+private:
+	Variable* _slots;
+	uint32_t _capacity;
+	uint32_t _count;
+	// False if the slot array was provided by the caller. The slots then move to the heap when they need to grow.
+	bool _ownsSlots;
+
+	// Storage for large values. Always on the heap, since it's rarely needed.
+	byte* _sideArea;
+	uint32_t _sideAreaSize;
+	uint32_t _sideAreaUsed;
+
+	Variable& Resolve(Variable* slot) const
+	{
+		if (slot->Marker == VARIABLE_SIDE_AREA_MARKER)
+		{
+			return *(Variable*)(_sideArea + slot->Uint32);
+		}
+
+		return *slot;
+	}
+
+	void GrowSlots()
+	{
+		uint32_t newCapacity = _capacity + 10;
+		Variable* newSlots;
+		if (_ownsSlots)
+		{
+			newSlots = (Variable*)realloc(_slots, newCapacity * sizeof(Variable));
+		}
+		else
+		{
+			newSlots = (Variable*)malloc(newCapacity * sizeof(Variable));
+			if (newSlots != nullptr)
+			{
+				memcpy(newSlots, _slots, _count * sizeof(Variable));
+				_ownsSlots = true;
+			}
+		}
+
+		if (newSlots == nullptr)
+		{
+			stdSimple::OutOfMemoryException::Throw("Out of memory increasing fixed stack");
+		}
+
+		_slots = newSlots;
+		_capacity = newCapacity;
+	}
+
+	Variable* AllocateInSideArea(uint32_t bytes, uint32_t& offset)
+	{
+		if (_sideAreaUsed + bytes > _sideAreaSize)
+		{
+			uint32_t newSize = _sideAreaSize + MAX(bytes, 64);
+			byte* newSideArea = (byte*)realloc(_sideArea, newSize);
+			if (newSideArea == nullptr)
+			{
+				stdSimple::OutOfMemoryException::Throw("Out of memory increasing stack side area");
+			}
+			_sideArea = newSideArea;
+			_sideAreaSize = newSize;
+		}
+
+		offset = _sideAreaUsed;
+		_sideAreaUsed += bytes;
+		return (Variable*)(_sideArea + offset);
+	}
+
+public:
+	class Iterator
+	{
+		const VariableFixedStack* _stack;
+		uint32_t _index;
+	public:
+		Iterator(const VariableFixedStack* stack)
+		{
+			_stack = stack;
+			_index = stack->_count;
+		}
+
+		/// <summary>
+		/// Gets the next element in the stack (iterating in reverse).
+		/// The iteration starts before the first element.
+		/// Returns null at the end.
+		/// </summary>
+		Variable* next()
+		{
+			if (_index == 0)
+			{
+				return nullptr;
+			}
+
+			_index--;
+			return &_stack->Resolve(_stack->_slots + _index);
+		}
+	};
+
+	/// <summary>
+	/// Returns the number of bytes the slot array needs for the given number of elements
+	/// </summary>
+	static uint32_t RequiredBytes(int initialElements)
+	{
+		return initialElements * sizeof(Variable);
+	}
+
+	/// <summary>
+	/// Creates a stack. If buffer is not null, it must be RequiredBytes(initialElements) large and must stay valid for the lifetime of the stack.
+	/// </summary>
+	VariableFixedStack(int initialElements, void* buffer = nullptr)
+	{
+		_capacity = initialElements;
+		_count = 0;
+		_sideArea = nullptr;
+		_sideAreaSize = 0;
+		_sideAreaUsed = 0;
+		_ownsSlots = buffer == nullptr;
+		if (_ownsSlots)
+		{
+			_slots = (Variable*)mallocEx(RequiredBytes(initialElements));
+		}
+		else
+		{
+			_slots = (Variable*)buffer;
+		}
+
+		if (_slots == nullptr)
+		{
+			_capacity = 0;
+			stdSimple::OutOfMemoryException::Throw("Out of memory initializing fixed stack");
+		}
+	}
+
+	~VariableFixedStack()
+	{
+		if (_ownsSlots)
+		{
+			freeEx(_slots);
+		}
+		freeEx(_sideArea);
+		_slots = nullptr;
+		_count = 0;
+	}
+
+	bool empty() const
+	{
+		return _count == 0;
+	}
+
+	/// <summary>
+	/// Removes all elements. The memory is kept.
+	/// </summary>
+	void clear()
+	{
+		_count = 0;
+		_sideAreaUsed = 0;
+	}
+
+	uint32_t BytesUsed() const
+	{
+		return _count * sizeof(Variable) + _sideAreaUsed;
+	}
+
+	void push(const Variable& object)
+	{
+		const Variable* source = &object;
+		if (_count == _capacity)
+		{
+			// Pushing an element of this stack again (i.e. dup) must still work when the slots move
+			bool isSlot = source >= _slots && source < _slots + _count;
+			uint32_t index = isSlot ? source - _slots : 0;
+			GrowSlots();
+			if (isSlot)
+			{
+				source = _slots + index;
+			}
+		}
+
+		Variable* slot = _slots + _count;
+		uint16_t size = source->fieldSize();
+		if (size <= sizeof(uint64_t))
+		{
+			memcpy(slot, source, sizeof(Variable));
+			if (slot->Marker == VARIABLE_SIDE_AREA_MARKER)
+			{
+				slot->Marker = VARIABLE_DEFAULT_MARKER;
+			}
+		}
+		else
+		{
+			uint32_t offset;
+			bool inSideArea = (byte*)source >= _sideArea && (byte*)source < _sideArea + _sideAreaUsed;
+			uint32_t sourceOffset = inSideArea ? (byte*)source - _sideArea : 0;
+			// Keep the data in the side area 4-byte aligned
+			Variable* data = AllocateInSideArea((Variable::headersize() + size + 3) & ~3, offset);
+			if (inSideArea)
+			{
+				source = (Variable*)(_sideArea + sourceOffset);
+			}
+			memcpy(data, source, Variable::headersize() + size);
+			slot->Type = source->Type;
+			slot->Marker = VARIABLE_SIDE_AREA_MARKER;
+			slot->setSize(size);
+			slot->Uint64 = 0;
+			slot->Uint32 = offset;
+		}
+
+		_count++;
+	}
+
+	Variable& top() const
+	{
+		if (empty())
+		{
+			Firmata.sendString(F("FATAL: Execution stack underflow"));
+			throw stdSimple::ExecutionEngineException("Execution stack underflow");
+		}
+
+		return Resolve(_slots + _count - 1);
+	}
+
+	/// <summary>
+	/// Removes the last element from the stack.
+	/// Any previously retrieved elements (using top() or nth() stay valid until the next push)
+	/// </summary>
+	void pop()
+	{
+		if (empty())
+		{
+			Firmata.sendString(F("FATAL: Execution stack underflow"));
+			throw stdSimple::ExecutionEngineException("Execution stack underflow");
+		}
+
+		_count--;
+		Variable* slot = _slots + _count;
+		if (slot->Marker == VARIABLE_SIDE_AREA_MARKER)
+		{
+			_sideAreaUsed = slot->Uint32;
+		}
+	}
+
+	// Returns the nth-last element from the stack (0 being the top)
+	Variable& nth(int index)
+	{
+		return Resolve(_slots + _count - 1 - index);
+	}
+
+	Iterator GetIterator()
+	{
+		return Iterator(this);
+	}
+};
@@ -15,6 +15,8 @@ private:
 	int _size;
 	// True if all elements within the vector are sizeof(Variable)
 	bool _defaultSizesOnly;
+	// False if the memory was provided by the caller (see InitFrom)
+	bool _ownsData;
 	Variable* _data;
 public:
 	typedef Variable* iterator;
@@ -23,21 +25,51 @@ public:
 	{
 		_data = nullptr;
 		_defaultSizesOnly = true;
+		_ownsData = true;
 		_size = 0;
 	}
 
-	bool InitDefault(int numDescriptions, VariableDescription* variableDescriptions)
+	/// <summary>
+	/// Returns the number of bytes InitFrom needs for the given list of variables
+	/// </summary>
+	static size_t RequiredBytes(int numDescriptions, VariableDescription* variableDescriptions)
 	{
-		_defaultSizesOnly = true;
-		if (_data != nullptr)
+		bool canUseDefaultSizes = true;
+		size_t totalSize = 0;
+		for (int i = 0; i < numDescriptions; i++)
 		{
-			freeEx(_data);
-			_data = nullptr;
+			size_t size = variableDescriptions[i].fieldSize();
+			if (size > sizeof(double))
+			{
+				canUseDefaultSizes = false;
+			}
+			totalSize += MAX(size, sizeof(double)) + Variable::headersize();
+		}
+
+		if (canUseDefaultSizes)
+		{
+			return numDescriptions * sizeof(Variable);
 		}
 
+		return totalSize + sizeof(VariableDescription);
+	}
+
+	bool InitDefault(int numDescriptions, VariableDescription* variableDescriptions, void* buffer = nullptr)
+	{
+		_defaultSizesOnly = true;
+		FreeData();
+
 		if (numDescriptions > 0)
 		{
-			_data = (Variable*)mallocEx(numDescriptions * sizeof(Variable));
+			_ownsData = buffer == nullptr;
+			if (_ownsData)
+			{
+				_data = (Variable*)mallocEx(numDescriptions * sizeof(Variable));
+			}
+			else
+			{
+				_data = (Variable*)buffer;
+			}
 			if (_data == nullptr)
 			{
 				stdSimple::OutOfMemoryException::Throw("Out of memory initializing default variable description list");
@@ -64,7 +96,11 @@ public:
 		return true;
 	}
 
-	bool InitFrom(int numDescriptions, VariableDescription* variableDescriptions)
+	/// <summary>
+	/// Initializes the vector with the given list of variables. If buffer is not null, it must be at least RequiredBytes() large
+	/// and must stay valid for the lifetime of the vector.
+	/// </summary>
+	bool InitFrom(int numDescriptions, VariableDescription* variableDescriptions, void* buffer = nullptr)
 	{
 		bool canUseDefaultSizes = true;
 		int totalSize = 0;
@@ -83,14 +119,23 @@ public:
 
 		if (canUseDefaultSizes)
 		{
-			return InitDefault(numDescriptions, variableDescriptions);
+			return InitDefault(numDescriptions, variableDescriptions, buffer);
 		}
 
 		// This variable contains the number of elements in the vector, even if the vector has variable-lenght entries
+		FreeData();
 		_size = numDescriptions;
 		_defaultSizesOnly = false;
 		totalSize += sizeof(VariableDescription);
-		_data = (Variable*)mallocEx(totalSize);
+		_ownsData = buffer == nullptr;
+		if (_ownsData)
+		{
+			_data = (Variable*)mallocEx(totalSize);
+		}
+		else
+		{
+			_data = (Variable*)buffer;
+		}
 		if (_data == nullptr)
 		{
 			stdSimple::OutOfMemoryException::Throw("Out of memory initalizing dynamic variable vector");
@@ -116,13 +161,32 @@ public:
 		return true;
 	}
 
+	/// <summary>
+	/// Sets all variables back to their initial value, reusing the memory. The descriptions must be the same ones the
+	/// vector was initialized with.
+	/// </summary>
+	void Reinitialize(int numDescriptions, VariableDescription* variableDescriptions)
+	{
+		bool ownsData = _ownsData;
+		Variable* buffer = _data;
+		_ownsData = false;
+		InitFrom(numDescriptions, variableDescriptions, buffer);
+		_ownsData = ownsData;
+	}
+
 	~VariableVector()
 	{
-		if (_data != nullptr)
+		FreeData();
+	}
+
+	void FreeData()
+	{
+		if (_data != nullptr && _ownsData)
 		{
 			freeEx(_data);
 		}
 		_data = nullptr;
+		_ownsData = true;
 	}
 
 	Variable& at(int index) const